@@ -6,27 +6,77 @@ HUSL <-> RGB color conversion API
    * `to_husl`: converts an RGB array to a HUSL array
    * `to_rgb`: converts a HUSL array to and RGB array
    * `to_hue`: converts an RGB array to an array of HUSL hue values
-
-Context managers for enabling specific optimizations:
-   * `with_simd`: enablel OpenMP SIMD-friendly C implementation
-   * `with_cython`: enable Cython+OpenMp implementation
-   * `with_numexpr`: enbable NumExpr implementation
-   * `with_numpy`: enable the standard NumPy implementation
+   * `to_lightness`: converts an RGB array to an array of HUSL lightness
+   * `to_husl_indexed`, `to_rgb_indexed`: convert indexed-color images
+   * `husl_histogram`: counts an RGB array's HUSL values into histograms
+   * `husl_stats`: summarizes an RGB array's HUSL values
+   * `to_husl_from_yuv`: converts a YUV 4:2:0 (I420/NV12) frame to HUSL
+   * `to_yuv`: converts a HUSL array to a YUV 4:2:0 frame
+   * `set_quality`, `get_quality`: trade accuracy for speed in C kernels
+   * `set_schedule`, `get_schedule`: split work among OpenMP threads
+   * `set_affinity`, `get_affinity`: pin OpenMP threads to a set of CPUs
+   * `set_memory_budget`, `get_memory_budget`: convert big images in bands
+
+Out-of-core conversion of images that don't fit in memory:
+   * `convert_file`: converts a raw or .npy image file to a new file
+   * `convert_memmap`: converts between memory-mapped arrays
+
+Non-blocking conversion for asyncio programs:
+   * `aio.to_husl`, `aio.to_hue`, `aio.to_rgb`: awaitable conversions
+
+Batched conversion of many small requests from many threads:
+   * `batch.BatchingConverter`: coalesces requests into few kernel calls
+
+Incremental conversion of video from fixed cameras:
+   * `delta.DeltaConverter`: reconverts only the tiles that changed
+
+Compact on-disk storage of HUSL images:
+   * `tiled.save`, `tiled.load`: write and read quantized, tiled HUSL files
+
+Choosing an implementation (backend):
+   * `backend=` on each conversion, e.g. `to_husl(rgb, backend="numpy")`
+   * `use_backend`: context manager for the calling thread or task only
+   * `set_backend`: the default for the whole process
+   * `simd_enabled`, `cython_enabled`, `numexpr_enabled`, `numpy_enabled`:
+     shorthands for `use_backend`, e.g. `with simd_enabled(): ...`
+   * `calibrate`: tunes the "best" backend to this host (see `tuning`)
 
 The C SIMD-friendly implementation is used if it's available.
 """
 
 __version__ = "1.5.0"
-__all__ = ["to_husl", "to_hue", "to_rgb"]
+__all__ = ["to_husl", "to_hue", "to_lightness", "to_rgb",
+           "to_husl_indexed", "to_rgb_indexed", "from_fixed16",
+           "husl_histogram", "husl_stats", "to_husl_from_yuv", "to_yuv",
+           "set_quality", "get_quality", "set_schedule", "get_schedule",
+           "set_affinity", "get_affinity",
+           "set_memory_budget", "get_memory_budget",
+           "set_backend", "get_backend", "use_backend", "calibrate",
+           "convert_file", "convert_memmap"]
 
 
-from contextlib import contextmanager
 from functools import partial
 
-from .nphusl import to_husl, to_hue, to_rgb
+from .nphusl import to_husl, to_hue, to_lightness, to_rgb
+from .nphusl import to_husl_indexed, to_rgb_indexed
+from .nphusl import from_fixed16
+from .nphusl import to_husl_from_yuv, to_yuv
+from .nphusl import husl_histogram, husl_stats
+from .nphusl import set_quality, get_quality
+from .nphusl import set_schedule, get_schedule
+from .nphusl import set_affinity, get_affinity
+from .nphusl import set_memory_budget, get_memory_budget
+from .nphusl import set_backend, get_backend, use_backend
 from .nphusl import SIMD, CYTHON, NUMEXPR, NUMPY
+from .stream import convert_file, convert_memmap
+from .tuning import calibrate
 from . import nphusl
 from . import constants
+from . import aio
+from . import batch
+from . import delta
+from . import tiled
+from . import tuning
 
 try:
     from . import _numexpr_opt
@@ -43,50 +93,24 @@ except ImportError:
 
 
 def enable_best_optimized():
-    order = SIMD, CYTHON, NUMEXPR, NUMPY
-    for name, fn in NUMPY.items():
-        fns = (fn_map.get(name) for fn_map in order)
-        chosen_fn = next(f for f in fns if f)
-        _select_fn(chosen_fn, name)
-
-
-@contextmanager
-def _with_fns(enable_other_fns, back_to_std=False):
-    revert = enable_numpy if back_to_std else enable_best_optimized
-    enable_other_fns()
-    try:
-        yield
-    finally:
-        revert()
-
-
-def _enable_fns(fn_dictionary=None):
-    _set_module_globals(NUMPY)
-    if fn_dictionary:
-        _set_module_globals(fn_dictionary)
-
-
-def _set_module_globals(fn_dictionary):
-    assert fn_dictionary, "implementation not available"
-    for name, fn in fn_dictionary.items():
-        _select_fn(fn, name)
+    set_backend("best")
 
 
-def _select_fn(fn, name):
-    globals()[name] = fn
-    setattr(nphusl, name, fn)
+def _with_backend(backend, back_to_std=False):
+    """Use `backend` in this context only (see `use_backend`). The previous
+    choice is restored on exit, so `back_to_std` has no effect."""
+    return use_backend(backend)
 
 
-enable_numpy = partial(_enable_fns, NUMPY)
-enable_cython = partial(_enable_fns, CYTHON)
-enable_numexpr = partial(_enable_fns, NUMEXPR)
-enable_simd = partial(_enable_fns, SIMD)
-best_enabled = partial(_with_fns, enable_best_optimized)
-numpy_enabled = partial(_with_fns, enable_numpy)
-cython_enabled = partial(_with_fns, enable_cython)
-numexpr_enabled = partial(_with_fns, enable_numexpr)
-simd_enabled = partial(_with_fns, enable_simd)
+enable_numpy = partial(set_backend, "numpy")
+enable_cython = partial(set_backend, "cython")
+enable_numexpr = partial(set_backend, "numexpr")
+enable_simd = partial(set_backend, "simd")
+best_enabled = partial(_with_backend, "best")
+numpy_enabled = partial(_with_backend, "numpy")
+cython_enabled = partial(_with_backend, "cython")
+numexpr_enabled = partial(_with_backend, "numexpr")
+simd_enabled = partial(_with_backend, "simd")
 
 
 del partial
-del contextmanager
@@ -0,0 +1,194 @@
+// CPU affinity of the threads that run the conversion kernels
+//
+// Kept apart from _simd.c because sched_setaffinity needs _GNU_SOURCE,
+// like madvise in _alloc.c.
+//
+// Important functions:
+// 1) set_affinity: confine later conversions to a set of CPUs
+// 2) begin_affinity, end_affinity: confine the calling thread during a
+//    conversion, and restore it afterwards
+// 3) pin_thread: pin an OpenMP thread to its CPU of the set
+
+
+#define _GNU_SOURCE  // sched_setaffinity, CPU_SET
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <_affinity.h>
+
+
+#ifdef __linux__
+
+
+// The CPUs set with set_affinity (none: threads aren't pinned), and a
+// count of the calls to set_affinity. Each thread pins itself again when
+// the count is past the one it was last pinned for. Kernels on other
+// threads read the set while it may be replaced, so it's only written and
+// read under affinity_lock; the count is also read without it, as a hint.
+static pthread_mutex_t affinity_lock = PTHREAD_MUTEX_INITIALIZER;
+static int affinity_cpus[AFFINITY_MAX_CPUS];
+static int affinity_n = 0;
+static int affinity_generation = 0;
+
+// CPUs of the process when set_affinity was first called, for unpinning
+// (set once, under affinity_lock, before the first set is published)
+static cpu_set_t process_cpus;
+static int process_cpus_saved = 0;
+
+static __thread int pinned_generation = 0;
+static __thread cpu_set_t caller_cpus;
+static __thread int caller_threads;
+static __thread int caller_confined = 0;
+static __thread int kernel_depth = 0;  // kernels running on this thread
+
+
+// Run later conversions on `n` threads, the OpenMP thread k pinned to CPU
+// cpus[k], or unpin them all if `n` is 0. Returns 0, or (changing nothing)
+// AFFINITY_BAD_CPU if a CPU is out of range or not available to the
+// process, or AFFINITY_UNSUPPORTED if threads can't be pinned here.
+int set_affinity(const int *cpus, int n) {
+    int k, status = 0;
+    if (n < 0 || n > AFFINITY_MAX_CPUS) {
+        return AFFINITY_BAD_CPU;
+    }
+    pthread_mutex_lock(&affinity_lock);
+    if (!process_cpus_saved) {
+        if (sched_getaffinity(0, sizeof(cpu_set_t), &process_cpus)) {
+            status = AFFINITY_UNSUPPORTED;
+            goto done;
+        }
+        process_cpus_saved = 1;
+    }
+    for (k = 0; k < n; k++) {
+        if (cpus[k] < 0 || cpus[k] >= CPU_SETSIZE
+                || !CPU_ISSET(cpus[k], &process_cpus)) {
+            status = AFFINITY_BAD_CPU;
+            goto done;
+        }
+    }
+    memcpy(affinity_cpus, cpus, n * sizeof(int));
+    affinity_n = n;
+    __atomic_add_fetch(&affinity_generation, 1, __ATOMIC_RELEASE);
+done:
+    pthread_mutex_unlock(&affinity_lock);
+    return status;
+}
+
+
+// Number of CPUs set with set_affinity, which are copied to `cpus`
+int get_affinity(int *cpus) {
+    int n;
+    pthread_mutex_lock(&affinity_lock);
+    n = affinity_n;
+    memcpy(cpus, affinity_cpus, n * sizeof(int));
+    pthread_mutex_unlock(&affinity_lock);
+    return n;
+}
+
+
+// Before a conversion's parallel regions: size the calling thread's teams
+// to the CPU set and confine the thread to it. Kernels call this on the
+// calling thread, each followed by end_affinity; kernels called by other
+// kernels leave it to the outermost one.
+void begin_affinity(void) {
+    cpu_set_t cpus;
+    int n, k;
+    if (kernel_depth++ > 0
+            || __atomic_load_n(&affinity_generation, __ATOMIC_ACQUIRE) == 0) {
+        return;  // nested, or set_affinity was never called
+    }
+    CPU_ZERO(&cpus);
+    pthread_mutex_lock(&affinity_lock);
+    n = affinity_n;
+    for (k = 0; k < n; k++) {
+        CPU_SET(affinity_cpus[k], &cpus);
+    }
+    pthread_mutex_unlock(&affinity_lock);
+    if (n == 0 || sched_getaffinity(0, sizeof(cpu_set_t), &caller_cpus)) {
+        return;
+    }
+    sched_setaffinity(0, sizeof(cpu_set_t), &cpus);
+#ifdef _OPENMP
+    caller_threads = omp_get_max_threads();
+    omp_set_num_threads(n);
+#endif
+    caller_confined = 1;
+    pinned_generation = 0;  // pin_thread narrows it to its own CPU
+}
+
+
+// After a conversion: give the calling thread back its CPUs and team size
+void end_affinity(void) {
+    if (--kernel_depth > 0 || !caller_confined) {
+        return;
+    }
+    sched_setaffinity(0, sizeof(cpu_set_t), &caller_cpus);
+#ifdef _OPENMP
+    omp_set_num_threads(caller_threads);
+#endif
+    caller_confined = 0;
+    pinned_generation = 0;
+}
+
+
+// Pin the calling OpenMP thread to its CPU of the set (or unpin it), if
+// that hasn't been done since the last set_affinity. It's a thread-local
+// load and compare otherwise, so kernels call it for every run of pixels.
+void pin_thread(void) {
+    int generation, n, cpu = 0, thread = 0;
+    cpu_set_t cpus;
+    if (pinned_generation ==
+            __atomic_load_n(&affinity_generation, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+#ifdef _OPENMP
+    thread = omp_get_thread_num();
+#endif
+    pthread_mutex_lock(&affinity_lock);
+    generation = affinity_generation;
+    n = affinity_n;
+    if (n) {
+        cpu = affinity_cpus[thread % n];
+    }
+    pthread_mutex_unlock(&affinity_lock);
+    if (n) {
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        sched_setaffinity(0, sizeof(cpu_set_t), &cpus);
+    } else if (thread > 0) {
+        // a worker pinned under an earlier set; the caller unpins itself
+        sched_setaffinity(0, sizeof(cpu_set_t), &process_cpus);
+    }
+    pinned_generation = generation;
+}
+
+
+#else  // threads aren't pinned without sched_setaffinity
+
+
+int set_affinity(const int *cpus, int n) {
+    (void) cpus;
+    return n ? AFFINITY_UNSUPPORTED : 0;
+}
+
+
+int get_affinity(int *cpus) {
+    (void) cpus;
+    return 0;
+}
+
+
+void begin_affinity(void) {}
+void end_affinity(void) {}
+void pin_thread(void) {}
+
+
+#endif
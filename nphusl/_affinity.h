@@ -0,0 +1,12 @@
+// Most CPUs that set_affinity takes
+#define AFFINITY_MAX_CPUS 1024
+
+// Errors of set_affinity
+#define AFFINITY_BAD_CPU -1
+#define AFFINITY_UNSUPPORTED -2
+
+extern int set_affinity(const int *cpus, int n);
+extern int get_affinity(int *cpus);
+extern void begin_affinity(void);
+extern void end_affinity(void);
+extern void pin_thread(void);
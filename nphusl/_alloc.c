@@ -0,0 +1,79 @@
+// Aligned allocation of large output buffers
+//
+// Kept apart from _simd.c because madvise needs _GNU_SOURCE, which would
+// also pull extra constants (e.g. M_PI_4) out of math.h there.
+//
+// Important functions:
+// 1) alloc_untouched: cache line (or huge page) aligned, unwritten memory
+// 2) hugepage_copy: a copy of a lookup table on transparent huge pages
+
+
+#define _GNU_SOURCE  // posix_memalign, madvise, MADV_HUGEPAGE
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <_alloc.h>
+
+
+// Buffers of at least this many bytes are aligned to (and advised as)
+// transparent huge pages when compiled with -DUSE_HUGEPAGES
+#ifndef HUGEPAGE_MIN_BYTES
+#define HUGEPAGE_MIN_BYTES (64 << 20)
+#endif
+// Tables of at least this many bytes are copied by hugepage_copy
+#ifndef HUGEPAGE_TABLE_MIN_BYTES
+#define HUGEPAGE_TABLE_MIN_BYTES (512 << 10)
+#endif
+#define HUGEPAGE_BYTES (2 << 20)
+#define CACHE_LINE_BYTES 64
+
+
+// Returns `bytes` of memory (free with free()) or NULL. The memory isn't
+// written here, so each page is placed on the NUMA node of the thread
+// that touches it first.
+void *alloc_untouched(size_t bytes) {
+    size_t alignment = CACHE_LINE_BYTES;
+    void *buffer = NULL;
+#if defined(USE_HUGEPAGES) && defined(MADV_HUGEPAGE)
+    if (bytes >= HUGEPAGE_MIN_BYTES) {
+        alignment = HUGEPAGE_BYTES;
+    }
+#endif
+    if (posix_memalign(&buffer, alignment, bytes ? bytes : alignment)) {
+        return NULL;
+    }
+#if defined(USE_HUGEPAGES) && defined(MADV_HUGEPAGE)
+    if (alignment == HUGEPAGE_BYTES) {
+        // only a hint; THP may be disabled system-wide
+        madvise(buffer, bytes - bytes % HUGEPAGE_BYTES, MADV_HUGEPAGE);
+    }
+#endif
+    return buffer;
+}
+
+
+// Returns a copy of the `bytes` of `table` (free with free()) on memory
+// aligned to and advised as transparent huge pages, so that scattered
+// lookups share a few TLB entries instead of one per 4 KiB page. Returns
+// NULL if the table is too small to gain from that, if built without
+// huge pages, or if the copy can't be made; keep using `table` then.
+void *hugepage_copy(const void *table, size_t bytes) {
+    void *copy = NULL;
+#if defined(USE_HUGEPAGES) && defined(MADV_HUGEPAGE)
+    // round up so the advice covers the end of the table too
+    const size_t mapped = (bytes + HUGEPAGE_BYTES - 1) / HUGEPAGE_BYTES
+                          * HUGEPAGE_BYTES;
+    if (bytes < HUGEPAGE_TABLE_MIN_BYTES
+            || posix_memalign(&copy, HUGEPAGE_BYTES, mapped)) {
+        return NULL;
+    }
+    // advise before writing, so the first touch faults in huge pages
+    madvise(copy, mapped, MADV_HUGEPAGE);
+    memcpy(copy, table, bytes);
+#else
+    (void) table;
+    (void) bytes;
+#endif
+    return copy;
+}
@@ -0,0 +1,5 @@
+
+#include <stddef.h>
+
+extern void *alloc_untouched(size_t bytes);
+extern void *hugepage_copy(const void *table, size_t bytes);
@@ -6,6 +6,8 @@ from . import constants
 from . import transform
 from cython.parallel import prange, parallel
 from libc.math cimport sin, cos, M_PI, atan2, sqrt
+from libc.stdint cimport uint64_t
+from libc.string cimport memcpy
 
 
 cdef double[3][3] M = constants.M
@@ -20,14 +22,14 @@ cdef double EPSILON = constants.EPSILON
 
 
 @transform.rgb_float_input
-def _rgb_to_husl(rgb):
+def _rgb_to_husl(rgb, linear=False):
     is_3d = rgb.ndim == 3
     if is_3d:
         size = rgb.shape[0] * rgb.shape[1]
         rgb_2d = rgb.reshape((size, 3))
     else:
         rgb_2d = rgb
-    husl = _rgb_to_husl_2d(rgb_2d)
+    husl = _rgb_to_husl_2d(rgb_2d, linear)
     if is_3d:
         husl = husl.reshape(rgb.shape)
     return husl
@@ -38,11 +40,11 @@ def _rgb_to_husl(rgb):
 @cython.cdivision(True)
 @cython.wraparound(False)
 cpdef np.ndarray[ndim=2, dtype=double] _rgb_to_husl_2d(
-        np.ndarray[ndim=2, dtype=double] rgb):
+        np.ndarray[ndim=2, dtype=double] rgb, bint linear=False):
     cdef int i
     cdef int rows = rgb.shape[0]
     cdef np.ndarray[ndim=2, dtype=double] husl = (
-        np.zeros(dtype=float, shape=(rows, 3)))
+        np.empty(dtype=float, shape=(rows, 3)))
 
     cdef double r, g, b
     cdef double x, y, z
@@ -51,10 +53,15 @@ cpdef np.ndarray[ndim=2, dtype=double] _rgb_to_husl_2d(
     cdef double c, h, hrad, s
 
     for i in prange(rows, schedule="guided", nogil=True):
-        # from linear RGB
-        r = to_linear(rgb[i, 0])
-        g = to_linear(rgb[i, 1])
-        b = to_linear(rgb[i, 2])
+        # from linear RGB (unless it's linear already)
+        if linear:
+            r = clamp_unit(rgb[i, 0])
+            g = clamp_unit(rgb[i, 1])
+            b = clamp_unit(rgb[i, 2])
+        else:
+            r = to_linear(clamp_unit(rgb[i, 0]))
+            g = to_linear(clamp_unit(rgb[i, 1]))
+            b = to_linear(clamp_unit(rgb[i, 2]))
 
         # to XYZ
         x = M_INV[0][0] * r + M_INV[0][1] * g + M_INV[0][2] * b
@@ -94,14 +101,14 @@ cpdef np.ndarray[ndim=2, dtype=double] _rgb_to_husl_2d(
 
 
 @transform.rgb_float_input
-def _rgb_to_hue(rgb):
+def _rgb_to_hue(rgb, linear=False):
     is_3d = rgb.ndim == 3
     if is_3d:
         size = rgb.shape[0] * rgb.shape[1]
         rgb_2d = rgb.reshape((size, 3))
     else:
         rgb_2d = rgb
-    hue = _rgb_to_hue_2d(rgb_2d)
+    hue = _rgb_to_hue_2d(rgb_2d, linear)
     if is_3d:
         hue = hue.reshape((rgb.shape[0], rgb.shape[1]))
     return hue
@@ -112,11 +119,11 @@ def _rgb_to_hue(rgb):
 @cython.cdivision(True)
 @cython.wraparound(False)
 cpdef np.ndarray[ndim=1, dtype=double] _rgb_to_hue_2d(
-        np.ndarray[ndim=2, dtype=double] rgb):
+        np.ndarray[ndim=2, dtype=double] rgb, bint linear=False):
     cdef int i
     cdef int rows = rgb.shape[0]
     cdef np.ndarray[ndim=1, dtype=double] hue = (
-        np.zeros(dtype=float, shape=(rows,)))
+        np.empty(dtype=float, shape=(rows,)))
 
     cdef double r, g, b
     cdef double x, y, z
@@ -125,10 +132,15 @@ cpdef np.ndarray[ndim=1, dtype=double] _rgb_to_hue_2d(
     cdef double c, h, hrad
 
     for i in prange(rows, schedule="guided", nogil=True):
-        # from linear RGB
-        r = to_linear(rgb[i, 0])
-        g = to_linear(rgb[i, 1])
-        b = to_linear(rgb[i, 2])
+        # from linear RGB (unless it's linear already)
+        if linear:
+            r = clamp_unit(rgb[i, 0])
+            g = clamp_unit(rgb[i, 1])
+            b = clamp_unit(rgb[i, 2])
+        else:
+            r = to_linear(clamp_unit(rgb[i, 0]))
+            g = to_linear(clamp_unit(rgb[i, 1]))
+            b = to_linear(clamp_unit(rgb[i, 2]))
 
         # to XYZ
         x = M_INV[0][0] * r + M_INV[0][1] * g + M_INV[0][2] * b
@@ -165,6 +177,16 @@ cdef inline double _to_light(double y_value) nogil:
         return (y_value / REF_Y) * KAPPA
 
 
+cdef inline double clamp_unit(double value) nogil:
+    # [0, 1], with NaN as 0. NaN is found in the bits, since -ffast-math
+    # lets the compiler assume that comparisons never see it.
+    cdef uint64_t bits
+    memcpy(&bits, &value, sizeof(bits))
+    if bits & 0x7fffffffffffffffULL > 0x7ff0000000000000ULL:
+        return 0.0
+    return (value if value < 1.0 else 1.0) if value > 0.0 else 0.0
+
+
 @cython.nonecheck(False)
 @cython.cdivision(True)
 cdef inline double to_linear(double value) nogil:
@@ -197,7 +219,7 @@ cpdef np.ndarray[ndim=2, dtype=double] _husl_to_rgb_2d(
     cdef int i, k
     cdef int rows = hsl.shape[0]
     cdef np.ndarray[ndim=2, dtype=double] rgb = (
-        np.zeros(dtype=float, shape=(rows, 3)))
+        np.empty(dtype=float, shape=(rows, 3)))
 
     cdef double h, s, l
     cdef double c
@@ -51,6 +51,20 @@ double compute_linear(double value) {
 }
 
 
+double linear_table_16[LINEAR_16_SIZE + 2];
+
+
+// Fill the interpolation table for 16-bit RGB. 4097 points keep the
+// interpolated curve within ~1e-6 of compute_linear over all 65536 inputs.
+void fill_linear_table_16(void) {
+    int j;
+    for (j = 0; j <= LINEAR_16_SIZE; j++) {
+        linear_table_16[j] = compute_linear((double) j / LINEAR_16_SIZE);
+    }
+    linear_table_16[LINEAR_16_SIZE + 1] = linear_table_16[LINEAR_16_SIZE];
+}
+
+
 double _linear_table[256]; // placeholder for table generation
 
 
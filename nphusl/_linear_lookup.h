@@ -1,3 +1,10 @@
 
 extern const double linear_table[256];
 
+
+// Linear RGB at LINEAR_16_SIZE + 1 evenly spaced 16-bit sRGB values
+// (plus one repeated entry so that interpolating at 65535 stays in bounds).
+// Filled by fill_linear_table_16() before the first 16-bit conversion.
+#define LINEAR_16_SIZE 4096
+extern double linear_table_16[LINEAR_16_SIZE + 2];
+extern void fill_linear_table_16(void);
@@ -5,22 +5,41 @@
 // 2) husl_to_rgb_nd: HUSL -> RGB
 // 3) rgb_to_hue_nd: RGB -> HUSL hue
 // 4) rgb_to_lightness_nd: RGB -> HUSL lightness
+// 5) yuv420_to_husl_nd: YUV 4:2:0 (I420 or NV12) -> HUSL
+// 6) rgb16_to_husl_nd: 16-bit RGB -> HUSL
+// 7) rgbf_to_husl_nd, rgbf32_to_husl_nd: float64/float32 RGB -> HUSL
+// 8) rgb_to_husl_hist_nd: RGB -> histograms of HUSL values
+// 9) rgb_to_husl_stats_nd: RGB -> sums and a lightness sketch of HUSL values
+// 10) gray_to_husl_nd: grayscale -> HUSL or HUSL lightness
+// 11) rgb_tiles_to_husl_nd: RGB -> HUSL for the dirty tiles of a frame
+// 12) gather_palette_nd: palette entries -> pixels of an indexed image
+// 13) rgb_dedupe_to_husl_nd: RGB -> HUSL, converting each distinct color once
+// 14) rgb_runs_to_husl_nd: RGB -> HUSL, converting each run of a row once
+// 15) rgb_to_husl_format_nd: RGB of any type, channel order, and layout ->
+//     HUSL doubles or floats, interleaved or planar
 
 
 #include <math.h>
 #include <stdlib.h>
-#include <stdio.h>
 #include <stdint.h>
+#include <string.h>
  
 
 #ifdef _OPENMP
-// Min array size for OpenMP parallelized loops
-#define MIN_IMG_SIZE_THREADED 30*30*3
 #include <omp.h>
 #endif
 
 
 #include <_simd.h>
+#include <_alloc.h>
+#include <_affinity.h>
+
+
+// Runs handed to a thread at a time by the default (dynamic) schedule
+#define DEFAULT_SCHEDULE_CHUNK 4
+
+// Fraction bits of the fixed point YUV -> RGB coefficients
+#define YUV_FRACTION_BITS 14
 #include <_linear_lookup.h>
 #include <_scale_const.h>
 
@@ -36,43 +55,96 @@
 
 
 static double *allocate_hsl(size_t size);
-static void rgb_to_luv_nd(uint8_t *rgb, double *luv, int size);
-static void rgbluv_to_husl_nd(uint8_t *rgb, double *luv_hsl, int size);
+static void rgb_to_luv_run(const uint8_t *rgb, double *luv, int size,
+                           int quality);
+static void rgbluv_to_husl_run(const uint8_t *rgb, double *luv_hsl, int size,
+                               int quality);
+static void rgb16_to_luv_run(const uint16_t *rgb, double *luv, int size,
+                             int quality);
+static void rgbluv16_to_husl_run(const uint16_t *rgb, double *luv_hsl,
+                                 int size, int quality);
+static void rgbf_to_husl_run(const double *rgb, double *hsl,
+                             int size, int linear, int quality);
+static void rgb_run_to_husl(const void *rgb, int depth, long start,
+                            int size, int linear, int quality, double *hsl);
+static void luv_px_to_husl(int white, int black, double *luv_hsl,
+                           int quality);
+static int kernel_quality(void);
+static double to_linear16(uint16_t value);
+static double to_linear_float(double value);
+static double clamp_unit(double value);
+static double hue_sin(double hue);
+static double to_linear_any(const void *rgb, int depth, size_t i, int linear);
+static size_t color_slot(size_t mask, uint32_t key);
+static uint8_t clamp_rgb(int32_t value);
 static void to_linear_rgb(uint8_t r, uint8_t g, uint8_t b,
                           double *rl, double *gl, double *bl);
 static void to_xyz(double r, double g, double b,
                    double *x, double *y, double *z);
 static void to_luv(double x, double y, double z,
-                   double *l, double *u, double *v);
-static double to_light(double);
-static double to_hue(double u, double v);
-static double to_saturation(double, double, double, double);
-static double max_chroma(double, double);
-
-
-// Enable luminance lookup interpolation based on compile flag
-#if defined(USE_LIGHT_LUT)
+                   double *l, double *u, double *v, int quality);
+static double to_light(double, int quality);
+static double to_hue(double u, double v, int quality);
+static double to_saturation(double, double, double, double, int quality);
+static double max_chroma(double, double, int quality);
+
+
+// Every variant of the expensive steps is compiled, and a quality level
+// picks one at runtime (see set_default_quality):
+//   QUALITY_FAST: L and max chroma from the nearest LUT entries, and an
+//     approximate atan2 for H
+//   QUALITY_BALANCED: L from the LUT, bilinear max chroma, and atan2f
+//   QUALITY_EXACT: cbrt for L, max chroma from the HUSL gamut lines, and
+//     double precision atan2
 #include <_light_lookup.h>
-#endif
-
-
-// Choose CIE-LUV -> LCH croma function based on compile flag
-#if defined(USE_CHROMA_LUT)
 #include <_chroma_lookup.h>
-static double linear_interp_chroma(double, double, double);
-#else
-#define CHROMA_SCALE 1
+static double to_light_lut(double y_value);
+static double to_light_exact(double y_value);
+static double to_hue_approx(double u, double v);
+static double to_hue_atan2f(double u, double v);
+static double to_hue_exact(double u, double v);
+static double max_chroma_nearest(double lightness, double hue);
+static double max_chroma_bilinear(double lightness, double hue);
+static double max_chroma_exact(double lightness, double hue);
 static double min_chroma_length(
     int iteration, double lightness, double sub1, double sub2,
     double top2, double top2_b, double sintheta, double costheta);
-#endif
-
-
-// Choose CIE-LUV -> Hue function based on compile flag
-#ifdef USE_HUE_ATAN2_APPROX
 static double atan2_approx(double u, double v);
 static double atan_approx(double z);
-#endif
+
+
+// 16-bit fixed point H, S, or L (channel `k`): [0, 360] or [0, 100]
+// scaled to [0, 65535] and rounded, like 16-bit tiles in _tiles.c
+static const double FIXED16_SCALE[3] = {65535.0/360, 65535.0/100,
+                                        65535.0/100};
+static inline uint16_t to_fixed16(double value, int k) {
+    return (uint16_t) fmin(65535.0, fmax(0.0,
+                                         value*FIXED16_SCALE[k] + 0.5));
+}
+
+
+// Load and store steps of rgb_to_husl_format_nd for each value type
+#define FORMAT_TYPE uint8_t
+#define FORMAT_NAME(name) name##_u8
+#define FORMAT_ALPHA(c, a) ((uint8_t) nearbyint((c) * ((a) / 255.0)))
+#include <_simd_formats.h>
+#define FORMAT_TYPE uint16_t
+#define FORMAT_NAME(name) name##_u16
+#define FORMAT_ALPHA(c, a) ((uint16_t) nearbyint((c) * ((a) / 65535.0)))
+#define FORMAT_STORE(value, k) to_fixed16(value, k)
+#include <_simd_formats.h>
+#define FORMAT_TYPE float
+#define FORMAT_NAME(name) name##_f32
+#define FORMAT_ALPHA(c, a) ((c) * (a))
+#define FORMAT_STORE(value, k) ((float) (value))
+#include <_simd_formats.h>
+#define FORMAT_TYPE double
+#define FORMAT_NAME(name) name##_f64
+#define FORMAT_ALPHA(c, a) ((c) * (a))
+#define FORMAT_STORE(value, k) (value)
+#include <_simd_formats.h>
+static void load_run(const void *rgb, int depth, int order, int planar,
+                     size_t pixels, long start, int run, void *loaded);
 
 
 // Constant HUSL H, S, and L for white pixels
@@ -81,56 +153,578 @@ static const double WHITE_SATURATION = 0.0;
 static const double WHITE_LIGHTNESS = 100.0;
 
 
+// Quality level of every conversion: the process-wide default, unless the
+// calling thread has set its own. Kernels read it once, on the calling
+// thread, before any parallel region.
+static int default_quality = QUALITY_FAST;
+static __thread int thread_quality = -1;
+
+
+// Set the quality level of conversions in all threads without their own
+void set_default_quality(int quality) {
+    default_quality = quality;
+}
+
+
+// Set the quality level of conversions started from the calling thread,
+// or go back to the default with -1. Returns the thread's previous level.
+int set_thread_quality(int quality) {
+    const int previous = thread_quality;
+    thread_quality = quality;
+    return previous;
+}
+
+
+// Quality level of conversions started from the calling thread
+int get_quality(void) {
+    return kernel_quality();
+}
+
+
+static inline int kernel_quality(void) {
+    return thread_quality >= 0 ? thread_quality : default_quality;
+}
+
+
+// OpenMP schedule of the passes over runs of RGB pixels. Pixels differ a
+// lot in cost (white and black ones skip the chroma math), so runs are
+// handed out a few at a time by default instead of in equal shares, which
+// would leave threads with blown-out regions idle.
+static int schedule_kind = SCHEDULE_DYNAMIC;
+static int schedule_chunk = DEFAULT_SCHEDULE_CHUNK;
+static __thread int thread_chunk = 0;  // overrides schedule_chunk if set
+
+// Min array size (values, e.g. 3 per RGB pixel) for parallelized loops
+static size_t threaded_min_size = MIN_IMG_SIZE_THREADED;
+
+
+// Set the schedule (SCHEDULE_*) and chunk size, in runs of RUN_PIXELS
+// pixels, of every later conversion. A chunk of 0 is OpenMP's default for
+// the schedule (e.g. equal shares for SCHEDULE_STATIC).
+void set_schedule(int kind, int chunk) {
+    schedule_kind = kind;
+    schedule_chunk = chunk;
+}
+
+
+// The schedule set with set_schedule, with its chunk size in `chunk`
+int get_schedule(int *chunk) {
+    *chunk = schedule_chunk;
+    return schedule_kind;
+}
+
+
+// Set the chunk size of conversions started from the calling thread, or go
+// back to set_schedule's with 0. Returns the thread's previous chunk size.
+int set_thread_chunk(int chunk) {
+    const int previous = thread_chunk;
+    thread_chunk = chunk;
+    return previous;
+}
+
+
+// Set the size of the teams of conversions started from the calling thread
+// (its OpenMP nthreads-var), if `threads` is positive. Returns the previous
+// size. A CPU set from set_affinity sizes the teams instead.
+int set_thread_team(int threads) {
+#ifdef _OPENMP
+    const int previous = omp_get_max_threads();
+    if (threads > 0) {
+        omp_set_num_threads(threads);
+    }
+    return previous;
+#else
+    (void) threads;
+    return 1;
+#endif
+}
+
+
+// Parallelize the loops of later conversions over at least `size` values
+void set_threaded_min_size(size_t size) {
+    threaded_min_size = size;
+}
+
+
+size_t get_threaded_min_size(void) {
+    return threaded_min_size;
+}
+
+
+// Make the calling thread's `schedule(runtime)` loops use set_schedule's
+// schedule, and confine its threads as set with set_affinity. Kernels call
+// this before their parallel regions, as OpenMP keeps the runtime schedule
+// per thread, and end_kernel after them. Their threads call pin_thread
+// before each run of pixels.
+static inline void begin_kernel(void) {
+#ifdef _OPENMP
+    omp_set_schedule((omp_sched_t) schedule_kind,
+                     thread_chunk ? thread_chunk : schedule_chunk);
+#endif
+    begin_affinity();
+}
+
+
+static inline void end_kernel(void) {
+    end_affinity();
+}
+
+
 // RGB -> HUSL conversion
 // Converts an array of c-contiguous RGB ints to an array of c-contiguous
-// HSL doubles. RGB ints should be in the interval [0, 255]
+// HSL doubles. RGB ints should be in the interval [0, 255]. Returns NULL if
+// the HSL array couldn't be allocated (as do the other *_to_husl_nd).
 double* rgb_to_husl_nd(uint8_t *restrict rgb, size_t size) {
     double *hsl = allocate_hsl(size);  // HUSL H, S, L tripets
+    if (hsl != NULL) {
+        rgb_to_husl_nd_out(rgb, hsl, size);
+    }
+    return hsl;
+}
 
-// Choose private variables for OpenMP threads
-// We want chroma and luminance LUTs to be firstprivate if present
-#if defined(USE_CHROMA_LUT) && defined(USE_LIGHT_LUT)
-#pragma omp parallel \
-    default(none) shared(hsl, rgb) \
-    firstprivate(size, chroma_table, light_table_big, \
-                 CL_TABLE_SIZE, CH_TABLE_SIZE) \
-    if (size >= MIN_IMG_SIZE_THREADED)
-#else  // else we don't have tables to make firstprivate
-#pragma omp parallel \
-    default(none) shared(hsl, rgb) \
-    firstprivate(size) \
-    if (size >= MIN_IMG_SIZE_THREADED)
-#endif  // end OMP pragma
 
-    {  // start OMP parallel
-    rgb_to_luv_nd(rgb, hsl, size);
-#pragma omp barrier
-    rgbluv_to_husl_nd(rgb, hsl, size);
-    } // end OMP parallel
+// RGB -> HUSL conversion into a caller-owned array of `size` doubles
+// (e.g. a band of a memory-mapped output file). Each run goes through both
+// passes while it's still in cache.
+void rgb_to_husl_nd_out(uint8_t *restrict rgb, double *restrict hsl,
+                        size_t size) {
+    const int quality = kernel_quality();
+    long i;
+    begin_kernel();
+#pragma omp parallel for schedule(runtime) \
+    if (size >= threaded_min_size)
+    for (i = 0; i < (long) size; i += RUN_PIXELS*3) {
+        const int run = size - i < RUN_PIXELS*3 ? size - i : RUN_PIXELS*3;
+        pin_thread();
+        rgb_run_to_husl(rgb, 8, i, run, 0, quality, hsl + i);
+    }
+    end_kernel();
+}
+
 
+// 16-bit RGB -> HUSL conversion
+// Like rgb_to_husl_nd, but for RGB ints in [0, 65535]. 10 and 12-bit
+// samples should be scaled up to 16 bits first.
+double* rgb16_to_husl_nd(uint16_t *restrict rgb, size_t size) {
+    double *hsl = allocate_hsl(size);
+    if (hsl != NULL) {
+        rgb16_to_husl_nd_out(rgb, hsl, size);
+    }
     return hsl;
 }
 
 
-// Aligned malloc for HUSL double arrays
-static double* __attribute__((alloc_size(1))) allocate_hsl(size_t size) {
-    double *hsl __attribute__((aligned(64))) = \
-        (double*) malloc(size * sizeof(double));
-    if (hsl == NULL) {
-        fprintf(stderr, "Error: Couldn't allocate memory for HUSL array\n");
-        exit(EXIT_FAILURE);
+// 16-bit RGB -> HUSL conversion into a caller-owned array of `size` doubles
+void rgb16_to_husl_nd_out(uint16_t *restrict rgb, double *restrict hsl,
+                          size_t size) {
+    const int quality = kernel_quality();
+    long i;
+    begin_kernel();
+#pragma omp parallel for schedule(runtime) \
+    if (size >= threaded_min_size)
+    for (i = 0; i < (long) size; i += RUN_PIXELS*3) {
+        const int run = size - i < RUN_PIXELS*3 ? size - i : RUN_PIXELS*3;
+        pin_thread();
+        rgb_run_to_husl(rgb, 16, i, run, 0, quality, hsl + i);
+    }
+    end_kernel();
+}
+
+
+// Float RGB -> HUSL conversion
+// Like rgb_to_husl_nd, but for RGB doubles in [0, 1] (values outside
+// are clamped). The sRGB transfer function is interpolated in
+// linear_table_16 instead of calling pow() for every channel. If `linear`
+// is nonzero, the input is already linear RGB and isn't decoded at all.
+double* rgbf_to_husl_nd(const double *restrict rgb, size_t size,
+                        int linear) {
+    double *hsl = allocate_hsl(size);
+    if (hsl != NULL) {
+        rgbf_to_husl_nd_out(rgb, hsl, size, linear);
     }
     return hsl;
 }
 
 
-// Convert nonlinear RGB to CIE-LUV
-static void rgb_to_luv_nd(uint8_t *restrict rgb, double *restrict luv, int size) {
+// Float RGB -> HUSL conversion into a caller-owned array of `size` doubles
+void rgbf_to_husl_nd_out(const double *restrict rgb, double *restrict hsl,
+                         size_t size, int linear) {
+    const int quality = kernel_quality();
+    long i;
+    begin_kernel();
+#pragma omp parallel for schedule(runtime) \
+    if (size >= threaded_min_size)
+    for (i = 0; i < (long) size; i += RUN_PIXELS*3) {
+        const int run = size - i < RUN_PIXELS*3 ? size - i : RUN_PIXELS*3;
+        pin_thread();
+        rgb_run_to_husl(rgb, 64, i, run, linear, quality, hsl + i);
+    }
+    end_kernel();
+}
+
+
+// Single-precision float RGB -> HUSL conversion. Each run is widened to
+// doubles in a stack buffer, so no image-sized float64 copy is made.
+double* rgbf32_to_husl_nd(const float *restrict rgb, size_t size,
+                          int linear) {
+    double *hsl = allocate_hsl(size);
+    if (hsl != NULL) {
+        rgbf32_to_husl_nd_out(rgb, hsl, size, linear);
+    }
+    return hsl;
+}
+
+
+// Single-precision float RGB -> HUSL conversion into a caller-owned array
+void rgbf32_to_husl_nd_out(const float *restrict rgb, double *restrict hsl,
+                           size_t size, int linear) {
+    const int quality = kernel_quality();
+    long i;
+    begin_kernel();
+#pragma omp parallel for schedule(runtime) \
+    if (size >= threaded_min_size)
+    for (i = 0; i < (long) size; i += RUN_PIXELS*3) {
+        const int run = size - i < RUN_PIXELS*3 ? size - i : RUN_PIXELS*3;
+        pin_thread();
+        rgb_run_to_husl(rgb, 32, i, run, linear, quality, hsl + i);
+    }
+    end_kernel();
+}
+
+
+// RGB -> HUSL conversion of other formats
+// Like rgbf32_to_husl_nd_out, but for `pixels` pixels of any type (`depth`
+// as in rgb_to_husl_hist_nd) in any channel order (ORDER_*, see
+// _simd_formats.h for alpha), with H, S, and L stored as `out_depth` 16
+// (uint16_t fixed point, see to_fixed16), 32 (float) or 64 (double)
+// values in `out`. If `planar_in` is nonzero, each
+// channel of `rgb` is a separate plane of `pixels` values, and if
+// `planar_out` is, H, S, and L are stored as three such planes. Each run
+// is loaded into RGB and stored from HSL through stack buffers, so no
+// image-sized copy is made in either direction; interleaved RGB input and
+// interleaved double output skip the buffers.
+//
+// The type, order, and layout are picked once per run (RUN_PIXELS pixels)
+// rather than hoisted out of the loop, like the quality level in
+// rgb_run_to_husl: the per-pixel loops of load_run_*, load_planes_*, and
+// store_run_* have constant offsets, and a few branches per run are lost
+// in the conversion of its pixels.
+void rgb_to_husl_format_nd(const void *restrict rgb, int depth, int order,
+                           int planar_in, size_t pixels, int linear,
+                           void *restrict out, int out_depth,
+                           int planar_out) {
+    const int quality = kernel_quality();
+    const int direct_out = out_depth == 64 && !planar_out;
+    long i;
+    begin_kernel();
+#pragma omp parallel for schedule(runtime) \
+    if (pixels*3 >= threaded_min_size)
+    for (i = 0; i < (long) pixels; i += RUN_PIXELS) {
+        const int run = pixels - i < RUN_PIXELS ? pixels - i : RUN_PIXELS;
+        const long out_start = planar_out ? i : i*3;
+        double loaded[RUN_PIXELS*3];  // room for RGB of any type
+        double hsl_run[RUN_PIXELS*3];
+        double *hsl = direct_out ? (double*) out + i*3 : hsl_run;
+        pin_thread();
+        if (order == ORDER_RGB && !planar_in) {
+            rgb_run_to_husl(rgb, depth, i*3, run*3, linear, quality, hsl);
+        } else {
+            load_run(rgb, depth, order, planar_in, pixels, i, run, loaded);
+            rgb_run_to_husl(loaded, depth, 0, run*3, linear, quality, hsl);
+        }
+        if (out_depth == 16) {
+            store_run_u16(hsl, run, planar_out, pixels,
+                          (uint16_t*) out + out_start);
+        } else if (out_depth == 32) {
+            store_run_f32(hsl, run, planar_out, pixels,
+                          (float*) out + out_start);
+        } else if (!direct_out) {
+            store_run_f64(hsl, run, planar_out, pixels,
+                          (double*) out + out_start);
+        }
+    }
+    end_kernel();
+}
+
+
+// Load pixels [`start`, `start` + `run`) of rgb_to_husl_format_nd input
+// into interleaved RGB of the same type in `loaded`
+static void load_run(const void *restrict rgb, int depth, int order,
+                     int planar, size_t pixels, long start, int run,
+                     void *restrict loaded) {
+    const long channels = order == ORDER_RGBA || order == ORDER_BGRA ? 4 : 3;
+    const long offset = planar ? start : start*channels;
+    if (depth == 8) {
+        const uint8_t *px = (const uint8_t*) rgb + offset;
+        if (planar) {
+            load_planes_u8(px, pixels, order, run, (uint8_t*) loaded);
+        } else {
+            load_run_u8(px, order, run, (uint8_t*) loaded);
+        }
+    } else if (depth == 16) {
+        const uint16_t *px = (const uint16_t*) rgb + offset;
+        if (planar) {
+            load_planes_u16(px, pixels, order, run, (uint16_t*) loaded);
+        } else {
+            load_run_u16(px, order, run, (uint16_t*) loaded);
+        }
+    } else if (depth == 32) {
+        const float *px = (const float*) rgb + offset;
+        if (planar) {
+            load_planes_f32(px, pixels, order, run, (float*) loaded);
+        } else {
+            load_run_f32(px, order, run, (float*) loaded);
+        }
+    } else {
+        const double *px = (const double*) rgb + offset;
+        if (planar) {
+            load_planes_f64(px, pixels, order, run, (double*) loaded);
+        } else {
+            load_run_f64(px, order, run, (double*) loaded);
+        }
+    }
+}
+
+
+// RGB -> HUSL histograms
+// Counts the HUSL values of `size` RGB values into `n_hists` histograms
+// without making an HSL array. Each thread converts a run of pixels into
+// a stack buffer, bins it into its own private copy of the histograms,
+// and adds its copy to `hist` at the end. `depth` is the RGB type:
+// 8 (uint8_t), 16 (uint16_t), 32 (float), or 64 (double). H is binned
+// over [0, 360] and S and L over [0, 100] into `bins` = {h, s, l} bins,
+// with values past either end counted in the first or last bin. The
+// histograms share the flat `hist` array of `hist_size` counts: pixel
+// bins {bh, bs, bl} are counted at
+//   hist[s[0] + bh*s[1] + bs*s[2] + bl*s[3]], s = strides + 4*k
+// for histogram k, so a channel with stride 0 isn't part of histogram k.
+// Returns 0, or KERNEL_NO_MEMORY if a thread's copy couldn't be allocated.
+int rgb_to_husl_hist_nd(const void *restrict rgb, int depth, size_t size,
+                         int linear, const int32_t *restrict bins,
+                         int n_hists, const int64_t *restrict strides,
+                        int64_t *restrict hist, size_t hist_size) {
+    const double scale[3] = {bins[0] / 360.0, bins[1] / 100.0,
+                             bins[2] / 100.0};
+    const int quality = kernel_quality();
+    int no_memory = 0;
+    begin_kernel();
+#pragma omp parallel if (size >= threaded_min_size)
+    {  // start OMP parallel
+    int64_t *local = (int64_t*) calloc(hist_size, sizeof(int64_t));
+    double hsl[RUN_PIXELS*3];
+    size_t j;
+    long i;
+    pin_thread();
+    if (local == NULL) {
+        __atomic_store_n(&no_memory, 1, __ATOMIC_RELAXED);
+    }
+#pragma omp for schedule(runtime)
+    for (i = 0; i < (long) size; i += RUN_PIXELS*3) {
+        const int run = size - i < RUN_PIXELS*3 ? size - i : RUN_PIXELS*3;
+        int p, c, k;
+        if (local == NULL) {
+            continue;  // the team still shares out the runs
+        }
+        rgb_run_to_husl(rgb, depth, i, run, linear, quality, hsl);
+        for (p = 0; p < run; p += 3) {
+            int64_t b[3];
+            for (c = 0; c < 3; c++) {
+                const int q = (int) (hsl[p + c] * scale[c]);
+                b[c] = q < 0 ? 0 : (q >= bins[c] ? bins[c] - 1 : q);
+            }
+            for (k = 0; k < n_hists; k++) {
+                const int64_t *s = strides + 4*k;
+                local[s[0] + b[0]*s[1] + b[1]*s[2] + b[2]*s[3]]++;
+            }
+        }
+    }
+    if (local != NULL) {
+#pragma omp critical
+        for (j = 0; j < hist_size; j++) {
+            hist[j] += local[j];
+        }
+        free(local);
+    }
+    }  // end OMP parallel
+    end_kernel();
+    return no_memory ? KERNEL_NO_MEMORY : 0;
+}
+
+
+// sin(H) at HUE_SIN_STEPS evenly spaced hues per 360 degrees, for H in
+// [0, 450] so that cos(H) = sin(H + 90) comes from the same table
+#define HUE_SIN_STEPS 4096
+static double hue_sin_table[HUE_SIN_STEPS*5/4 + 2];
+
+
+// Fill hue_sin_table. Interpolating in it is within ~3e-7 of sin().
+// Not vectorized, since vector sin() would need glibc's libmvec.
+__attribute__((optimize("no-tree-vectorize")))
+void fill_hue_sin_table(void) {
+    int j;
+    for (j = 0; j <= HUE_SIN_STEPS*5/4 + 1; j++) {
+        hue_sin_table[j] = sin(j * (2.0*M_PI / HUE_SIN_STEPS));
+    }
+}
+
+
+// RGB -> HUSL statistics
+// Reduces the HUSL values of `size` RGB values (`depth` as in
+// rgb_to_husl_hist_nd) to the sums
+//   {n, sum(S*cos(H)), sum(S*sin(H)), sum(S), sum(S^2), sum(L), sum(L^2)}
+// and a sketch of L: counts of L in `light_bins` equal bins over [0, 100],
+// from which percentiles are interpolated. Pixels whose `mask` value is 0
+// are skipped (`mask` may be NULL). Each thread reduces its runs into
+// private sums and a private sketch, and they're added up at the end.
+// Returns 0, or KERNEL_NO_MEMORY if a thread's sketch couldn't be allocated.
+int rgb_to_husl_stats_nd(const void *restrict rgb, int depth, size_t size,
+                         int linear, const uint8_t *restrict mask,
+                         double *restrict sums, int64_t *restrict light_hist,
+                         int light_bins) {
+    const double light_scale = light_bins / 100.0;
+    const int quality = kernel_quality();
+    double n = 0, s_cos = 0, s_sin = 0, s_sum = 0, s_sq = 0;
+    double l_sum = 0, l_sq = 0;
+    int no_memory = 0;
+    begin_kernel();
+#pragma omp parallel if (size >= threaded_min_size) \
+    reduction(+: n, s_cos, s_sin, s_sum, s_sq, l_sum, l_sq)
+    {  // start OMP parallel
+    int64_t *local = (int64_t*) calloc(light_bins, sizeof(int64_t));
+    double hsl[RUN_PIXELS*3];
+    long i;
+    int j;
+    pin_thread();
+    if (local == NULL) {
+        __atomic_store_n(&no_memory, 1, __ATOMIC_RELAXED);
+    }
+#pragma omp for schedule(runtime)
+    for (i = 0; i < (long) size; i += RUN_PIXELS*3) {
+        const int run = size - i < RUN_PIXELS*3 ? size - i : RUN_PIXELS*3;
+        int p;
+        if (local == NULL) {
+            continue;
+        }
+        rgb_run_to_husl(rgb, depth, i, run, linear, quality, hsl);
+        for (p = 0; p < run; p += 3) {
+            if (mask != NULL && !mask[(i + p) / 3]) {
+                continue;
+            }
+            const double h = hsl[p];
+            const double s = hsl[p+1];
+            const double l = hsl[p+2];
+            const int q = (int) (l * light_scale);
+            local[q < 0 ? 0 : (q >= light_bins ? light_bins - 1 : q)]++;
+            n += 1;
+            s_cos += s * hue_sin(h + 90.0);
+            s_sin += s * hue_sin(h);
+            s_sum += s;
+            s_sq += s * s;
+            l_sum += l;
+            l_sq += l * l;
+        }
+    }
+    if (local != NULL) {
+#pragma omp critical
+        for (j = 0; j < light_bins; j++) {
+            light_hist[j] += local[j];
+        }
+        free(local);
+    }
+    }  // end OMP parallel
+    end_kernel();
+    sums[0] = n;
+    sums[1] = s_cos;
+    sums[2] = s_sin;
+    sums[3] = s_sum;
+    sums[4] = s_sq;
+    sums[5] = l_sum;
+    sums[6] = l_sq;
+    return no_memory ? KERNEL_NO_MEMORY : 0;
+}
+
+
+// YUV 4:2:0 -> HUSL conversion
+// Converts a (rows x cols) frame of 8-bit Y samples with half-resolution
+// chroma into c-contiguous HSL doubles. Each chroma sample covers a 2x2
+// block of pixels (nearest-neighbor upsampling). The U and V planes are
+// addressed with a row stride and a sample step, so I420 (separate planes,
+// step 1) and NV12 (interleaved UV, step 2) take the same path. `coeffs`
+// maps 8-bit samples to 8-bit RGB in fixed point (YUV_FRACTION_BITS):
+//   {y_offset, y_scale, r_v, g_u, g_v, b_u}
+// with U and V centered on 128. Each thread converts short runs of a row
+// to RGB in a small stack buffer and then converts it like a run of
+// rgb_to_husl_nd, so no frame-sized RGB array is ever made.
+void yuv420_to_husl_nd(
+        const uint8_t *restrict y, const uint8_t *restrict u,
+        const uint8_t *restrict v, double *restrict hsl,
+        int rows, int cols, size_t y_stride,
+        size_t c_stride, size_t c_step, const int32_t *restrict coeffs) {
+    const int32_t y_offset = coeffs[0], y_scale = coeffs[1];
+    const int32_t r_v = coeffs[2], g_u = coeffs[3];
+    const int32_t g_v = coeffs[4], b_u = coeffs[5];
+    const int quality = kernel_quality();
+    int row;
+
+#pragma omp parallel for schedule(static) \
+    if ((size_t) rows*cols*3 >= threaded_min_size)
+    for (row = 0; row < rows; row++) {
+        const uint8_t *y_row = y + row*y_stride;
+        const uint8_t *u_row = u + (row/2)*c_stride;
+        const uint8_t *v_row = v + (row/2)*c_stride;
+        uint8_t rgb[RUN_PIXELS*3];
+        int start;
+        for (start = 0; start < cols; start += RUN_PIXELS) {
+            const int run = cols - start < RUN_PIXELS ?
+                            cols - start : RUN_PIXELS;
+            int i;
+            for (i = 0; i < run; i++) {
+                // RUN_PIXELS is even, so (start + i)/2 == start/2 + i/2
+                const size_t c = (size_t) (start/2 + i/2)*c_step;
+                const int32_t cb = u_row[c] - 128;
+                const int32_t cr = v_row[c] - 128;
+                const int32_t luma = y_scale*(y_row[start + i] - y_offset);
+                rgb[i*3] = clamp_rgb(luma + r_v*cr);
+                rgb[i*3 + 1] = clamp_rgb(luma + g_u*cb + g_v*cr);
+                rgb[i*3 + 2] = clamp_rgb(luma + b_u*cb);
+            }
+            double *hsl_run = hsl + ((size_t) row*cols + start)*3;
+            rgb_run_to_husl(rgb, 8, 0, run*3, 0, quality, hsl_run);
+        }
+    }
+}
+
+
+// Round a fixed point RGB value and clamp it to [0, 255]
+static inline uint8_t clamp_rgb(int32_t value) {
+    value = (value + (1 << (YUV_FRACTION_BITS - 1))) >> YUV_FRACTION_BITS;
+    return (uint8_t) (value < 0 ? 0 : value > 255 ? 255 : value);
+}
+
+
+// Aligned malloc for HUSL double arrays. The pages aren't touched here:
+// the conversion kernels write them first, so on NUMA systems each page
+// lands on the node of the thread that fills it. With the default
+// dynamic schedule, that's whichever thread took its chunk of
+// DEFAULT_SCHEDULE_CHUNK runs (24 KiB of output each), not the owner of
+// a fixed slice, so a later pass over the output on the same threads
+// isn't guaranteed local pages; set_schedule("static") gives each thread
+// the same slice in every conversion. Returns NULL if out of memory.
+static double* __attribute__((alloc_size(1))) allocate_hsl(size_t size) {
+    if (size > SIZE_MAX / sizeof(double)) {
+        return NULL;
+    }
+    return (double*) alloc_untouched(size * sizeof(double));
+}
+
+
+// Convert a run of nonlinear RGB to CIE-LUV on the calling thread
+static void rgb_to_luv_run(const uint8_t *restrict rgb, double *restrict luv,
+                           int size, int quality) {
     int i;
-#pragma omp for
     for (i = 0; i < size; i+=3) {
         double *luv_p = luv + i;
-        uint8_t *rgb_p = rgb + i;
+        const uint8_t *rgb_p = rgb + i;
         const uint8_t r = *(rgb_p++);
         const uint8_t g = *(rgb_p++);
         const uint8_t b = *(rgb_p++);
@@ -146,8 +740,528 @@ static void rgb_to_luv_nd(uint8_t *restrict rgb, double *restrict luv, int size)
         u = luv_p++;
         v = luv_p++;
         to_xyz(rl, gl, bl, &x, &y, &z);
-        to_luv(x, y, z, l, u, v);
+        to_luv(x, y, z, l, u, v, quality);
+    }
+}
+
+
+// Convert a run of 16-bit nonlinear RGB to CIE-LUV on the calling thread
+static void rgb16_to_luv_run(const uint16_t *restrict rgb,
+                             double *restrict luv, int size, int quality) {
+    int i;
+    for (i = 0; i < size; i+=3) {
+        double x, y, z;
+        to_xyz(to_linear16(rgb[i]), to_linear16(rgb[i+1]),
+               to_linear16(rgb[i+2]), &x, &y, &z);
+        to_luv(x, y, z, luv + i, luv + i + 1, luv + i + 2, quality);
+    }
+}
+
+
+// The chroma LUT read by the kernels: the table in _chroma_lookup.c, or its
+// copy on huge pages (see use_hugepage_tables). The light LUT is a few KiB,
+// so it stays where it is.
+typedef const c_table_t chroma_row_t[sizeof chroma_table[0] /
+                                     sizeof chroma_table[0][0]];
+static chroma_row_t *chroma_lut = chroma_table;
+static chroma_row_t *chroma_lut_copy = NULL;
+
+
+// Read the chroma LUT from a copy on transparent huge pages (made once, on
+// first use, and kept) if `enable` is nonzero, else from the original.
+// Random (H, L) lookups touch hundreds of 4 KiB pages of the 2 MiB table,
+// but only one or two huge pages. Returns nonzero if the copy is in use;
+// it isn't if huge pages are unavailable.
+int use_hugepage_tables(int enable) {
+    if (enable && chroma_lut_copy == NULL) {
+        chroma_lut_copy = hugepage_copy(chroma_table, sizeof chroma_table);
     }
+    chroma_lut = enable && chroma_lut_copy ? chroma_lut_copy : chroma_table;
+    return chroma_lut != chroma_table;
+}
+
+
+// HUSL lightness of each 8-bit gray level, from the light LUT (row 0) and
+// at full precision (row 1), filled by fill_gray_light_table()
+static double gray_light_table[2][256];
+
+
+void fill_gray_light_table(void) {
+    int j;
+    for (j = 0; j < 256; j++) {
+        gray_light_table[0][j] = to_light_lut(linear_table[j]);
+        gray_light_table[1][j] = to_light_exact(linear_table[j]);
+    }
+    for (j = 0; j < 2; j++) {
+        gray_light_table[j][0] = 0;
+        gray_light_table[j][255] = WHITE_LIGHTNESS;
+    }
+}
+
+
+// Grayscale -> HUSL conversion
+// Converts `pixels` gray values (`depth` as in rgb_to_husl_hist_nd) to
+// HSL triplets, or to lightness alone if `lightness_only` is nonzero.
+// Gray has the chromaticity of the white point, so there's no chroma
+// math: H is the hue of white (0 for black), S is 0, and L depends only
+// on the gray level (a table lookup for 8-bit gray). Like the RGB kernels,
+// float gray is in [0, 1] and may be `linear`.
+void gray_to_husl_nd(const void *restrict gray, int depth, size_t pixels,
+                     int linear, int lightness_only, double *restrict out) {
+    const int quality = kernel_quality();
+    const double *light_table = gray_light_table[quality == QUALITY_EXACT];
+    long i;
+#pragma omp parallel for schedule(static) \
+    if (pixels*3 >= threaded_min_size)
+    for (i = 0; i < (long) pixels; i++) {
+        double l;
+        if (depth == 8) {
+            l = light_table[((const uint8_t*) gray)[i]];
+        } else {
+            const double y = to_linear_any(gray, depth, i, linear);
+            l = y >= 1.0 ? WHITE_LIGHTNESS : (y <= 0.0 ? 0.0 : to_light(y, quality));
+        }
+        if (lightness_only) {
+            out[i] = l;
+        } else {
+            out[3*i] = l > 0.0 ? WHITE_HUE : 0.0;
+            out[3*i + 1] = WHITE_SATURATION;
+            out[3*i + 2] = l;
+        }
+    }
+}
+
+
+// RGB -> HUSL lightness conversion
+// HUSL lightness only depends on CIE-XYZ Y, so none of the chroma math of
+// rgb_to_husl_nd is done. `depth` and `linear` are as in gray_to_husl_nd.
+void rgb_to_lightness_nd(const void *restrict rgb, int depth, size_t pixels,
+                         int linear, double *restrict light) {
+    const int quality = kernel_quality();
+    long i;
+#pragma omp parallel for schedule(static) \
+    if (pixels*3 >= threaded_min_size)
+    for (i = 0; i < (long) pixels; i++) {
+        const double r = to_linear_any(rgb, depth, 3*i, linear);
+        const double g = to_linear_any(rgb, depth, 3*i + 1, linear);
+        const double b = to_linear_any(rgb, depth, 3*i + 2, linear);
+        const double y = 0.212639*r + 0.715169*g + 0.072192*b;
+        if (r >= 1.0 && g >= 1.0 && b >= 1.0) {
+            light[i] = WHITE_LIGHTNESS;
+        } else if (r <= 0.0 && g <= 0.0 && b <= 0.0) {
+            light[i] = 0.0;
+        } else {
+            light[i] = to_light(y, quality);
+        }
+    }
+}
+
+
+// RGB -> HUSL conversion of selected tiles
+// Converts the `tile` x `tile` squares of a (rows x cols) RGB image for
+// which `dirty[t]` is nonzero (`t` in row-major tile order, as in
+// diff_tiles_nd) into the same pixels of the full size `hsl` image. Other
+// pixels of `hsl` are left alone. `depth` and `linear` are as in
+// rgb_to_husl_hist_nd.
+void rgb_tiles_to_husl_nd(const void *restrict rgb, int depth, int rows,
+                          int cols, int tile, const uint8_t *restrict dirty,
+                          int linear, double *restrict hsl) {
+    const int tiles_y = (rows + tile - 1) / tile;
+    const int tiles_x = (cols + tile - 1) / tile;
+    const int quality = kernel_quality();
+    int t;
+
+#pragma omp parallel for schedule(dynamic) if (tiles_y*tiles_x > 1)
+    for (t = 0; t < tiles_y*tiles_x; t++) {
+        const int r0 = (t / tiles_x) * tile;
+        const int c0 = (t % tiles_x) * tile;
+        const int tile_rows = rows - r0 < tile ? rows - r0 : tile;
+        const int tile_cols = cols - c0 < tile ? cols - c0 : tile;
+        int r, c;
+        if (!dirty[t]) {
+            continue;
+        }
+        for (r = r0; r < r0 + tile_rows; r++) {
+            for (c = c0; c < c0 + tile_cols; c += RUN_PIXELS) {
+                const long start = ((long) r*cols + c)*3;
+                const int run = c0 + tile_cols - c < RUN_PIXELS ?
+                    c0 + tile_cols - c : RUN_PIXELS;
+                rgb_run_to_husl(rgb, depth, start, run*3, linear, quality,
+                                hsl + start);
+            }
+        }
+    }
+}
+
+
+// Indexed color -> pixels
+// Copies palette entry `indices[i]` (each entry is `entry_bytes` bytes, e.g.
+// an HSL triplet of doubles) to pixel `i` of `out` for `pixels` indices.
+// Indices are `index_bytes` wide: 1 or 2 (unsigned), or 4 or 8 (signed).
+// Pixels with an index outside of the palette's `entries` are zeroed, and
+// their number is returned.
+size_t gather_palette_nd(const uint8_t *restrict palette, size_t entry_bytes,
+                         size_t entries, const void *restrict indices,
+                         int index_bytes, size_t pixels,
+                         uint8_t *restrict out) {
+    size_t bad = 0;
+    long i;
+#pragma omp parallel for schedule(static) reduction(+:bad) \
+    if (pixels*entry_bytes >= threaded_min_size)
+    for (i = 0; i < (long) pixels; i++) {
+        int64_t index;
+        if (index_bytes == 1) {
+            index = ((const uint8_t*) indices)[i];
+        } else if (index_bytes == 2) {
+            index = ((const uint16_t*) indices)[i];
+        } else if (index_bytes == 4) {
+            index = ((const int32_t*) indices)[i];
+        } else {
+            index = ((const int64_t*) indices)[i];
+        }
+        if (index < 0 || (uint64_t) index >= entries) {
+            memset(out + i*entry_bytes, 0, entry_bytes);
+            bad++;
+        } else {
+            memcpy(out + i*entry_bytes, palette + index*entry_bytes,
+                   entry_bytes);
+        }
+    }
+    return bad;
+}
+
+
+// Deduplicated RGB -> HUSL conversion
+// For 8-bit RGB with few distinct colors (logos, charts, flat renders).
+// The distinct colors are found with a parallel, open-addressed hash table
+// of packed colors (lock-free inserts with compare-and-swap), converted
+// once with rgb_to_husl_nd_out, and scattered back to the pixels in `hsl`.
+// Gives up early and returns -1 (leaving `hsl` undefined) if there are
+// more than `max_colors` colors, or KERNEL_NO_MEMORY if its tables couldn't
+// be allocated; otherwise returns the number of colors.
+long rgb_dedupe_to_husl_nd(const uint8_t *restrict rgb, size_t pixels,
+                           size_t max_colors, double *restrict hsl) {
+    size_t table_size = 1024;
+    size_t mask, slot, n_colors = 0;
+    uint32_t *table, *ids;
+    uint8_t *colors;
+    double *color_hsl;
+    int overflow = 0;
+    long i;
+    while (table_size < 2*max_colors + 2) {
+        table_size *= 2;  // at most half full, for short probe sequences
+    }
+    mask = table_size - 1;
+    table = (uint32_t*) calloc(table_size, sizeof(uint32_t));
+    if (!table) {
+        return KERNEL_NO_MEMORY;
+    }
+
+    // pass 1: insert each pixel's color (packed RGB + 1, as 0 means empty)
+#pragma omp parallel for schedule(static) \
+    if (pixels*3 >= threaded_min_size)
+    for (i = 0; i < (long) pixels; i++) {
+        const uint32_t key = ((uint32_t) rgb[3*i] << 16 |
+            (uint32_t) rgb[3*i + 1] << 8 | rgb[3*i + 2]) + 1;
+        size_t j = color_slot(mask, key);
+        if (__atomic_load_n(&overflow, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        for (;;) {
+            uint32_t found = __atomic_load_n(table + j, __ATOMIC_RELAXED);
+            if (!found && __atomic_compare_exchange_n(
+                    table + j, &found, key, 0,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                if (__atomic_add_fetch(&n_colors, 1, __ATOMIC_RELAXED)
+                        > max_colors) {
+                    __atomic_store_n(&overflow, 1, __ATOMIC_RELAXED);
+                }
+                break;
+            }
+            if (found == key) {
+                break;  // seen before, or another thread just inserted it
+            }
+            j = (j + 1) & mask;
+        }
+    }
+    if (overflow) {
+        free(table);
+        return -1;
+    }
+
+    // pass 2: number the colors in table order and convert them once
+    ids = (uint32_t*) malloc(table_size*sizeof(uint32_t));
+    colors = (uint8_t*) malloc(n_colors*3 + 3);
+    color_hsl = (double*) malloc((n_colors*3 + 3)*sizeof(double));
+    if (!ids || !colors || !color_hsl) {
+        free(table);
+        free(ids);
+        free(colors);
+        free(color_hsl);
+        return KERNEL_NO_MEMORY;
+    }
+    n_colors = 0;
+    for (slot = 0; slot < table_size; slot++) {
+        if (table[slot]) {
+            const uint32_t color = table[slot] - 1;
+            ids[slot] = n_colors;
+            colors[3*n_colors] = color >> 16;
+            colors[3*n_colors + 1] = (color >> 8) & 255;
+            colors[3*n_colors + 2] = color & 255;
+            n_colors++;
+        }
+    }
+    if (n_colors) {
+        rgb_to_husl_nd_out(colors, color_hsl, n_colors*3);
+    }
+
+    // pass 3: scatter each color's HSL to its pixels
+#pragma omp parallel for schedule(static) \
+    if (pixels*3 >= threaded_min_size)
+    for (i = 0; i < (long) pixels; i++) {
+        const uint32_t key = ((uint32_t) rgb[3*i] << 16 |
+            (uint32_t) rgb[3*i + 1] << 8 | rgb[3*i + 2]) + 1;
+        size_t j = color_slot(mask, key);
+        while (table[j] != key) {
+            j = (j + 1) & mask;
+        }
+        hsl[3*i] = color_hsl[3*ids[j]];
+        hsl[3*i + 1] = color_hsl[3*ids[j] + 1];
+        hsl[3*i + 2] = color_hsl[3*ids[j] + 2];
+    }
+    free(table);
+    free(ids);
+    free(colors);
+    free(color_hsl);
+    return (long) n_colors;
+}
+
+
+// Run-length RGB -> HUSL conversion
+// For 8-bit RGB with long horizontal runs of one color (scanned documents,
+// screen captures). Each row of a (rows x cols) image is split into runs
+// of identical pixels. White and black runs take the constants of the
+// white/black special case (luv_px_to_husl). The first pixels of other
+// runs are packed into a buffer of up to RUN_PIXELS pixels, which is
+// converted like any other run, and each result is then stored to every
+// pixel of its run.
+void rgb_runs_to_husl_nd(const uint8_t *restrict rgb, int rows, int cols,
+                         double *restrict hsl) {
+    const int quality = kernel_quality();
+    int r;
+#pragma omp parallel for schedule(dynamic) \
+    if ((size_t) rows*cols*3 >= threaded_min_size)
+    for (r = 0; r < rows; r++) {
+        const uint8_t *row = rgb + (size_t) r*cols*3;
+        double *out = hsl + (size_t) r*cols*3;
+        uint8_t heads[RUN_PIXELS*3];
+        double head_hsl[(RUN_PIXELS + 2)*3];  // white, black, then heads
+        int lengths[RUN_PIXELS], slots[RUN_PIXELS];
+        int c = 0;
+        luv_px_to_husl(1, 0, head_hsl, quality);
+        luv_px_to_husl(0, 1, head_hsl + 3, quality);
+        while (c < cols) {
+            int n_runs = 0, n_heads = 0, k, j;
+            while (c < cols && n_runs < RUN_PIXELS) {
+                const uint8_t *px = row + (size_t) c*3;
+                int length = 1;
+                while (c + length < cols && px[3*length] == px[0] &&
+                       px[3*length + 1] == px[1] &&
+                       px[3*length + 2] == px[2]) {
+                    length++;
+                }
+                if ((px[0] & px[1] & px[2]) == 255) {
+                    slots[n_runs] = 0;
+                } else if ((px[0] | px[1] | px[2]) == 0) {
+                    slots[n_runs] = 1;
+                } else {
+                    heads[3*n_heads] = px[0];
+                    heads[3*n_heads + 1] = px[1];
+                    heads[3*n_heads + 2] = px[2];
+                    slots[n_runs] = 2 + n_heads++;
+                }
+                lengths[n_runs++] = length;
+                c += length;
+            }
+            if (n_heads) {
+                rgb_run_to_husl(heads, 8, 0, n_heads*3, 0, quality,
+                                head_hsl + 6);
+            }
+            for (k = 0; k < n_runs; k++) {
+                const double *run_hsl = head_hsl + 3*slots[k];
+                const double h = run_hsl[0];
+                const double s = run_hsl[1];
+                const double l = run_hsl[2];
+                for (j = 0; j < lengths[k]; j++) {
+                    out[3*j] = h;
+                    out[3*j + 1] = s;
+                    out[3*j + 2] = l;
+                }
+                out += 3*lengths[k];
+            }
+        }
+    }
+}
+
+
+// First slot to probe for a packed color in a table of `mask` + 1 slots
+static inline size_t color_slot(size_t mask, uint32_t key) {
+    return (size_t) ((key * UINT64_C(0x9E3779B97F4A7C15)) >> 32) & mask;
+}
+
+
+// Linear RGB of the `i`th value of an RGB (or gray) array of `depth`
+static inline double to_linear_any(const void *restrict rgb, int depth,
+                                   size_t i, int linear) {
+    double value;
+    if (depth == 8) {
+        return linear_table[((const uint8_t*) rgb)[i]];
+    } else if (depth == 16) {
+        return to_linear16(((const uint16_t*) rgb)[i]);
+    } else if (depth == 32) {
+        value = clamp_unit(((const float*) rgb)[i]);
+    } else {
+        value = clamp_unit(((const double*) rgb)[i]);
+    }
+    return linear ? value : to_linear_float(value);
+}
+
+
+// Convert the run of `size` RGB values at `start` to HUSL in `hsl` on the
+// calling thread. `depth` is the RGB type, as in rgb_to_husl_hist_nd.
+// Each quality level has its own copy of the run conversion, with the
+// level's variants inlined.
+#define RUN_TO_HUSL_ARGS const void *restrict rgb, int depth, long start, \
+                         int size, int linear, double *restrict hsl
+static void __attribute__((flatten)) run_to_husl_fast(RUN_TO_HUSL_ARGS);
+static void __attribute__((flatten)) run_to_husl_balanced(RUN_TO_HUSL_ARGS);
+static void __attribute__((flatten)) run_to_husl_exact(RUN_TO_HUSL_ARGS);
+
+
+static void rgb_run_to_husl(const void *restrict rgb, int depth, long start,
+                            int size, int linear, int quality,
+                            double *restrict hsl) {
+    if (quality == QUALITY_EXACT) {
+        run_to_husl_exact(rgb, depth, start, size, linear, hsl);
+    } else if (quality == QUALITY_BALANCED) {
+        run_to_husl_balanced(rgb, depth, start, size, linear, hsl);
+    } else {
+        run_to_husl_fast(rgb, depth, start, size, linear, hsl);
+    }
+}
+
+
+static inline void run_to_husl(const void *restrict rgb, int depth,
+                               long start, int size, int linear,
+                               int quality, double *restrict hsl) {
+    if (depth == 8) {
+        const uint8_t *rgb_run = (const uint8_t*) rgb + start;
+        rgb_to_luv_run(rgb_run, hsl, size, quality);
+        rgbluv_to_husl_run(rgb_run, hsl, size, quality);
+    } else if (depth == 16) {
+        const uint16_t *rgb_run = (const uint16_t*) rgb + start;
+        rgb16_to_luv_run(rgb_run, hsl, size, quality);
+        rgbluv16_to_husl_run(rgb_run, hsl, size, quality);
+    } else if (depth == 32) {
+        const float *rgb_run = (const float*) rgb + start;
+        double wide[RUN_PIXELS*3];
+        int k;
+        for (k = 0; k < size; k++) {
+            wide[k] = rgb_run[k];
+        }
+        rgbf_to_husl_run(wide, hsl, size, linear, quality);
+    } else {
+        rgbf_to_husl_run((const double*) rgb + start, hsl, size, linear,
+                         quality);
+    }
+}
+
+
+static void run_to_husl_fast(RUN_TO_HUSL_ARGS) {
+    run_to_husl(rgb, depth, start, size, linear, QUALITY_FAST, hsl);
+}
+
+
+static void run_to_husl_balanced(RUN_TO_HUSL_ARGS) {
+    run_to_husl(rgb, depth, start, size, linear, QUALITY_BALANCED, hsl);
+}
+
+
+static void run_to_husl_exact(RUN_TO_HUSL_ARGS) {
+    run_to_husl(rgb, depth, start, size, linear, QUALITY_EXACT, hsl);
+}
+
+
+// Convert a run of float RGB to HUSL on the calling thread: CIE-LUV
+// first, then HUSL while the run is still in cache
+static void rgbf_to_husl_run(const double *restrict rgb,
+                             double *restrict hsl, int size, int linear,
+                             int quality) {
+    int i;
+    for (i = 0; i < size; i+=3) {
+        const double r = clamp_unit(rgb[i]);
+        const double g = clamp_unit(rgb[i+1]);
+        const double b = clamp_unit(rgb[i+2]);
+        double x, y, z;
+        if (linear) {
+            to_xyz(r, g, b, &x, &y, &z);
+        } else {
+            to_xyz(to_linear_float(r), to_linear_float(g),
+                   to_linear_float(b), &x, &y, &z);
+        }
+        to_luv(x, y, z, hsl + i, hsl + i + 1, hsl + i + 2, quality);
+    }
+    for (i = 0; i < size; i+=3) {
+        const double r = clamp_unit(rgb[i]);
+        const double g = clamp_unit(rgb[i+1]);
+        const double b = clamp_unit(rgb[i+2]);
+        luv_px_to_husl(r >= 1.0 && g >= 1.0 && b >= 1.0,
+                       r <= 0.0 && g <= 0.0 && b <= 0.0, hsl + i, quality);
+    }
+}
+
+
+// sin() of a hue in degrees (in [0, 450]) by interpolating in
+// hue_sin_table
+static inline double hue_sin(double hue) {
+    const double position = hue * (HUE_SIN_STEPS / 360.0);
+    int i = (int) position;
+    i = i < 0 ? 0 : (i > HUE_SIN_STEPS*5/4 ? HUE_SIN_STEPS*5/4 : i);
+    const double low = hue_sin_table[i];
+    return low + (position - i)*(hue_sin_table[i+1] - low);
+}
+
+
+// Clamp a float RGB value to [0, 1], with NaN as 0 so it never reaches
+// the tables as an index. NaN is found in the bits, since -ffast-math lets
+// the compiler assume that comparisons never see it.
+static inline double clamp_unit(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof bits);
+    if ((bits & ~(UINT64_C(1) << 63)) > UINT64_C(0x7ff0000000000000)) {
+        return 0.0;
+    }
+    return value > 0.0 ? (value < 1.0 ? value : 1.0) : 0.0;
+}
+
+
+// Convert a float sRGB value in [0, 1] to linear RGB by interpolating in
+// linear_table_16 (within ~1e-6 of the exact curve)
+static inline double to_linear_float(double value) {
+    const double position = value * LINEAR_16_SIZE;
+    const int i = (int) position;
+    const double low = linear_table_16[i];
+    return low + (position - i)*(linear_table_16[i+1] - low);
+}
+
+
+// Convert a 16-bit RGB value to linear RGB by interpolating in
+// linear_table_16
+static inline double to_linear16(uint16_t value) {
+    const double position = value * (LINEAR_16_SIZE / 65535.0);
+    const int i = (int) position;
+    const double low = linear_table_16[i];
+    return low + (position - i)*(linear_table_16[i+1] - low);
 }
 
 
@@ -177,50 +1291,70 @@ static inline void to_xyz(
 // Convert CIE-XYZ to CIE-LUV
 static inline void to_luv(
         double x, double y, double z,
-        double *restrict l, double *restrict u, double *restrict v) {
+        double *restrict l, double *restrict u, double *restrict v,
+        int quality) {
     const double var_scale = x + 15*y + 3*z;
     const double var_u = 4*x / var_scale;
     const double var_v = 9*y / var_scale;
-    *l = to_light(y);
+    *l = to_light(y, quality);
     const double l13 = (*l)*13;
     *u = l13*(var_u - REF_U);
     *v = l13*(var_v - REF_V);
 }
 
 
-// Convert CIE-LUV to HUSL. The original RGB array is still passed in
-// for the handling of boundary conditions (white and black pixels).
-static void rgbluv_to_husl_nd(
-        uint8_t *restrict rgb, double *restrict luv_hsl,
-        int size) {
+// Convert a run of CIE-LUV to HUSL on the calling thread
+static void rgbluv_to_husl_run(
+        const uint8_t *restrict rgb, double *restrict luv_hsl,
+        int size, int quality) {
     int i;
-#pragma omp for
     for (i = 0; i < size; i+=3) {
         double *hsl_p = luv_hsl + i;
-        uint8_t *rgb_p = rgb + i;
+        const uint8_t *rgb_p = rgb + i;
         const uint8_t r = *(rgb_p++);
         const uint8_t g = *(rgb_p++);
         const uint8_t b = *(rgb_p++);
+        luv_px_to_husl(r == 255 && g == 255 && b == 255, !r && !g && !b,
+                       hsl_p, quality);
+    }
+}
 
-        if (r == 255 && g == 255 && b == 255) {
-            *(hsl_p++) = WHITE_HUE;
-            *(hsl_p++) = WHITE_SATURATION;
-            *(hsl_p++) = WHITE_LIGHTNESS;
-        } else if (!r && !g && !b) {
-            *(hsl_p++) = 0;
-            *(hsl_p++) = 0;
-            *(hsl_p++) = 0;
-        } else {
-            // This is the most expensive part of the RGB->HUSL pipeline
-            const double l = *hsl_p;
-            const double u = *(hsl_p+1);
-            const double v = *(hsl_p+2);
-            const double h = to_hue(u, v);
-            const double s = to_saturation(l, u, v, h);
-            *(hsl_p++) = h;
-            *(hsl_p++) = s;
-            *(hsl_p++) = l;
-        }
+
+// Convert a run of CIE-LUV to HUSL given the 16-bit RGB it came from
+static void rgbluv16_to_husl_run(
+        const uint16_t *restrict rgb, double *restrict luv_hsl,
+        int size, int quality) {
+    int i;
+    for (i = 0; i < size; i+=3) {
+        const uint16_t r = rgb[i], g = rgb[i+1], b = rgb[i+2];
+        luv_px_to_husl(r == 65535 && g == 65535 && b == 65535,
+                       !r && !g && !b, luv_hsl + i, quality);
+    }
+}
+
+
+// Convert one CIE-LUV triplet to HUSL in place. White and black pixels
+// (judged from RGB by the caller) get constant HUSL values.
+static inline void luv_px_to_husl(int white, int black,
+                                  double *restrict hsl_p, int quality) {
+    if (white) {
+        *(hsl_p++) = WHITE_HUE;
+        *(hsl_p++) = WHITE_SATURATION;
+        *(hsl_p++) = WHITE_LIGHTNESS;
+    } else if (black) {
+        *(hsl_p++) = 0;
+        *(hsl_p++) = 0;
+        *(hsl_p++) = 0;
+    } else {
+        // This is the most expensive part of the RGB->HUSL pipeline
+        const double l = *hsl_p;
+        const double u = *(hsl_p+1);
+        const double v = *(hsl_p+2);
+        const double h = to_hue(u, v, quality);
+        const double s = to_saturation(l, u, v, h, quality);
+        *(hsl_p++) = h;
+        *(hsl_p++) = s;
+        *(hsl_p++) = l;
     }
 }
 
@@ -228,22 +1362,65 @@ static void rgbluv_to_husl_nd(
 static const double DEG_PER_RAD = 180.0 / M_PI;
 
 
-///////////////////////////////////////////////////
-// Define a to_hue function based on compile flags
-///////////////////////////////////////////////////
+// Returns HUSL hue given U & V of CIE-LUV
+// The hue is the phase angle, in degrees, between U and V
+// Hue values are in the interval [0, 360]
+static inline double to_hue(double u, double v, int quality) {
+    if (quality == QUALITY_EXACT) {
+        return to_hue_exact(u, v);
+    } else if (quality == QUALITY_BALANCED) {
+        return to_hue_atan2f(u, v);
+    }
+    return to_hue_approx(u, v);
+}
+
+
+// Returns a saturation value from UV (of CIELUV), lightness, and hue.
+// Saturation magnitude (hypotenuse b/t U & V) is found via sqrt(U**2 + V**2),
+// then it's normalized by the max chroma, which is dictated by H and L.
+static inline double to_saturation(double l, double u, double v, double h,
+                                   int quality) {
+    const double saturation = 100 * sqrt(u*u + v*v) /
+                              max_chroma(l, h, quality);
+    return fmin(saturation, 100.0f);
+}
 
 
-#if defined(USE_HUE_ATAN2_APPROX)  // if compiled with -DUSE_HUE_ATAN2_APPROX
+// Returns max chroma given an L, H pair
+// This max chroma is used to scale the HUSL saturation value
+// so that it fits in [0, 100].
+static inline double max_chroma(double lightness, double hue, int quality) {
+    if (quality == QUALITY_EXACT) {
+        return max_chroma_exact(lightness, hue);
+    } else if (quality == QUALITY_BALANCED) {
+        return max_chroma_bilinear(lightness, hue);
+    }
+    return max_chroma_nearest(lightness, hue);
+}
+
+
+// Return a light value from a CIE-XYZ Y value.
+static inline double to_light(double y_value, int quality) {
+    if (quality == QUALITY_EXACT) {
+        return to_light_exact(y_value);
+    }
+    return to_light_lut(y_value);
+}
+
+
+//////////////////////////////////////////////////////////////
+// Variants of the expensive steps, picked by quality level.
+// The exact ones (and atan2f) aren't inlined into the run
+// loops: vectorizing calls to them would need glibc's libmvec.
+//////////////////////////////////////////////////////////////
 
 
 #define PI 3.141592653589793
 #define PIBY2 1.5707963267948966
 
 
-// Returns HUSL hue given U & V of CIE-LUV
-// The hue is the phase angle, in degrees, between U and V
-// Hue values are in the interval [0, 360]
-static double to_hue(double u, double v) {
+// Hue from a fast approximation of atan2
+static inline double to_hue_approx(double u, double v) {
     const double z = v/u;
     double hue;
     if (fabs(z) < 1.0) {
@@ -311,11 +1488,8 @@ static double atan2_approx(double y, double x) {
 }
 
 
-#else  // else use math.h's atan2
-
-
-// CIE-UV to HUSL hue with a more costly atan2 call
-static inline double to_hue(double u, double v) {
+// CIE-UV to HUSL hue with a more costly atan2f call
+static __attribute__((noinline)) double to_hue_atan2f(double u, double v) {
     double hue = atan2f(v, u) * DEG_PER_RAD;
     if (hue < 0) {
         hue += 360;
@@ -324,51 +1498,36 @@ static inline double to_hue(double u, double v) {
 }
 
 
-#endif  // End to_hue definition
-
-
-// Returns a saturation value from UV (of CIELUV), lightness, and hue.
-// Saturation magnitude (hypotenuse b/t U & V) is found via sqrt(U**2 + V**2),
-// then it's normalized by the max chroma, which is dictated by H and L.
-static inline double to_saturation(double l, double u, double v, double h) {
-    const double saturation = (100*CHROMA_SCALE) * sqrt(u*u + v*v) / max_chroma(l, h);
-    return fmin(saturation, 100.0f);
+// CIE-UV to HUSL hue with a double precision atan2 call
+static __attribute__((noinline)) double to_hue_exact(double u, double v) {
+    double hue = atan2(v, u) * DEG_PER_RAD;
+    if (hue < 0) {
+        hue += 360;
+    }
+    return hue;
 }
 
 
-///////////////////////////////////////////////////////
-// Define a max_chroma function based on compile flags
-///////////////////////////////////////////////////////
-
-
-#if defined(USE_CHROMA_LUT)  // if compiled to use chroma lookup table
-
-
-#if defined(INTERPOLATE_CHROMA)  // if compiled to use bilinear interpolation
-
-
-#define CH_MAX_IDX CH_TABLE_SIZE-2
-#define CL_MAX_IDX CL_TABLE_SIZE-2
-
 // Returns a maximum chroma given an L, H pair.
-// This max chroma is used to scale HUSL's saturation value.
 // Uses _chroma_lookup.c with bilinear interpolation.
 // This LUT approach is important, because finding the max chroma is
 // the most expensive operation in RGB -> HUSL conversion.
 // Reference (see Unit Square section):
 // https://en.wikipedia.org/wiki/Bilinear_interpolation
-static inline double max_chroma(double lightness, double hue) {
+static inline double max_chroma_bilinear(double lightness, double hue) {
     // Compute H-value indices (axis 0) and L-value indices (axis 1)
     const double h_idx = hue / H_IDX_STEP;
     const double l_idx = lightness / L_IDX_STEP;
-    const unsigned short h_idx_floor = fmax(0.0, fmin(CH_MAX_IDX, floorf(h_idx)));
-    const unsigned short l_idx_floor = fmax(0.0, fmin(CL_MAX_IDX, floorf(l_idx)));
+    const unsigned short h_idx_floor =
+        fmax(0.0, fmin(CH_TABLE_SIZE - 2, floorf(h_idx)));
+    const unsigned short l_idx_floor =
+        fmax(0.0, fmin(CL_TABLE_SIZE - 2, floorf(l_idx)));
 
     // Find four known f() values in the unit square bilinear interp. approach
-    const c_table_t chroma_00 = chroma_table[h_idx_floor][l_idx_floor];
-    const c_table_t chroma_10 = chroma_table[h_idx_floor+1][l_idx_floor];
-    const c_table_t chroma_01 = chroma_table[h_idx_floor][l_idx_floor+1];
-    const c_table_t chroma_11 = chroma_table[h_idx_floor+1][l_idx_floor+1];
+    const c_table_t chroma_00 = chroma_lut[h_idx_floor][l_idx_floor];
+    const c_table_t chroma_10 = chroma_lut[h_idx_floor+1][l_idx_floor];
+    const c_table_t chroma_01 = chroma_lut[h_idx_floor][l_idx_floor+1];
+    const c_table_t chroma_11 = chroma_lut[h_idx_floor+1][l_idx_floor+1];
 
     // Find *normalized* x, y, (1-x), and (1-y) values
     // It's a coordinate system where the four known chromas are at
@@ -383,52 +1542,34 @@ static inline double max_chroma(double lightness, double hue) {
                           chroma_10*h_norm*l_inv +
                           chroma_01*h_inv*l_norm +
                           chroma_11*h_norm*l_norm;
-    return fmax(1e-10f, chroma);
+    return fmax(1e-10f, chroma) / CHROMA_SCALE;
 }
 
 
-#else  // else just round, don't interpolate
-
-
-#define CH_MAX_IDX CH_TABLE_SIZE-1
-#define CL_MAX_IDX CL_TABLE_SIZE-1
-
-
 // Returns chroma directly from the chroma LUT, given a HUSL [L, H] pair
-// This makes RGB -> HUSL 5-10% faster
-static inline double max_chroma(double lightness, double hue) {
+// This makes RGB -> HUSL 5-10% faster than interpolating
+static inline double max_chroma_nearest(double lightness, double hue) {
     // Compute H-value indices (axis 0) and L-value indices (axis 1)
     const double h_scaled = hue / H_IDX_STEP;
     const double l_scaled = lightness / L_IDX_STEP;
-    const unsigned short h_idx = fmax(0.0, fmin(CH_MAX_IDX, roundf(h_scaled)));
-    const unsigned short l_idx = fmax(0.0, fmin(CL_MAX_IDX, roundf(l_scaled)));
-    return (double) fmax(1e-10, chroma_table[h_idx][l_idx]);
-}
-
-
-#endif  // end chroma LUT definition
-
-
-static inline double linear_interp_chroma(
-        double chroma_0, double chroma_1, double offset) {
-    return chroma_0 + offset*(chroma_1 - chroma_0);
+    const unsigned short h_idx =
+        fmax(0.0, fmin(CH_TABLE_SIZE - 1, roundf(h_scaled)));
+    const unsigned short l_idx =
+        fmax(0.0, fmin(CL_TABLE_SIZE - 1, roundf(l_scaled)));
+    return fmax(1e-10, chroma_lut[h_idx][l_idx]) / CHROMA_SCALE;
 }
 
 
-#else  // else define accurate-but-slow max_chroma
-
-
-// Returns max chroma given an L, H pair
-// This max chroma is used to scale the HUSL saturation value
-// so that it fits in [0, 100].
-static double max_chroma(double lightness, double hue) {
+// Returns max chroma given an L, H pair, accurate but slow
+static __attribute__((noinline)) double max_chroma_exact(
+        double lightness, double hue) {
     double sub1 = pow(lightness + 16.0, 3) / 1560896.0;
     double sub2 = sub1 > EPSILON ? sub1 : lightness / KAPPA;
     double top2 = SCALE_SUB2 * lightness * sub2;
     double top2_b = top2 - 769860.0*lightness;
     double theta = hue / 360.0 * M_PI * 2.0;  // hue in radians
-    double sintheta = sinf(theta);
-    double costheta = cosf(theta);
+    double sintheta = sin(theta);
+    double costheta = cos(theta);
     double len0, len1, len2;
     len0 = min_chroma_length(
         0, lightness, sub1, sub2,
@@ -466,23 +1607,12 @@ static inline double min_chroma_length(
 }
 
 
-#endif // end conditional max_chroma definition
-
-
-////////////////////////////////////////////////////////////////////////
-// Define a function that returns luminance from Y of the CIE-XYZ space
-////////////////////////////////////////////////////////////////////////
-
-
-#if defined(USE_LIGHT_LUT)  // if compiled with -DUSE_LIGHT_LUT
-
-
 // Return a light value from a CIE-XYZ Y value.
 // A light value lookup that accounts for a nonlinear
 // relationship between Y, the input, and L, the output.
 // The lookup table is combined from three smaller
 // tables, each with a different Y-value-to-L-value scale.
-static double to_light(double y_value) {
+static inline double to_light_lut(double y_value) {
     double idx;
     if (y_value < Y_THRESH_0) {
         idx = y_value/Y_IDX_STEP_0;
@@ -496,11 +1626,8 @@ static double to_light(double y_value) {
 }
 
 
-#else  // else define a to_light function with an expensive cube root
-
-
-// Return a light value from a CIE-XYZ Y value.
-static inline double to_light(double y_value) {
+// Return a light value from a CIE-XYZ Y value with an expensive cube root
+static __attribute__((noinline)) double to_light_exact(double y_value) {
     if (y_value > EPSILON) {
         return 116 * cbrt(y_value / REF_Y) - 16;
     } else {
@@ -509,9 +1636,6 @@ static inline double to_light(double y_value) {
 }
 
 
-#endif // end to_light conditional definition
-
-
 ///////////////////////////////////////////
 // Conversion in the HUSL -> RGB direction
 ///////////////////////////////////////////
@@ -1,6 +1,84 @@
 
+#include <stddef.h>
 #include <stdint.h>
 
 typedef double hsl_type;
-extern hsl_type *rgb_to_husl_nd(uint8_t* rgb, size_t size);
 
+// Kernel quality levels, from fastest to most accurate
+#define QUALITY_FAST 0
+#define QUALITY_BALANCED 1
+#define QUALITY_EXACT 2
+extern void set_default_quality(int quality);
+extern int set_thread_quality(int quality);
+extern int get_quality(void);
+
+// Returned by kernels that couldn't allocate their working memory
+#define KERNEL_NO_MEMORY -2
+
+// Pixels per run handed to a thread by the conversion passes. Runs are
+// also the unit of work for YUV input, whose RGB lives in a stack buffer.
+#define RUN_PIXELS 1024
+
+// OpenMP schedules of the conversion passes (the omp_sched_t values)
+#define SCHEDULE_STATIC 1
+#define SCHEDULE_DYNAMIC 2
+#define SCHEDULE_GUIDED 3
+extern void set_schedule(int kind, int chunk);
+extern int get_schedule(int *chunk);
+extern int set_thread_chunk(int chunk);
+
+// Threads of the conversion passes. Loops over at least
+// MIN_IMG_SIZE_THREADED values (e.g. 3 per RGB pixel) are parallelized
+// unless set_threaded_min_size changes it.
+#define MIN_IMG_SIZE_THREADED 30*30*3
+extern int set_thread_team(int threads);
+extern void set_threaded_min_size(size_t size);
+extern size_t get_threaded_min_size(void);
+
+// Channel orders of rgb_to_husl_format_nd input
+#define ORDER_RGB 0
+#define ORDER_BGR 1
+#define ORDER_RGBA 2
+#define ORDER_BGRA 3
+extern void rgb_to_husl_format_nd(const void *rgb, int depth, int order,
+                                  int planar_in, size_t pixels, int linear,
+                                  void *out, int out_depth, int planar_out);
+
+extern hsl_type *rgb_to_husl_nd(uint8_t* rgb, size_t size);
+extern void rgb_to_husl_nd_out(uint8_t* rgb, hsl_type *hsl, size_t size);
+extern hsl_type *rgb16_to_husl_nd(uint16_t* rgb, size_t size);
+extern void rgb16_to_husl_nd_out(uint16_t* rgb, hsl_type *hsl, size_t size);
+extern hsl_type *rgbf_to_husl_nd(const double *rgb, size_t size, int linear);
+extern void rgbf_to_husl_nd_out(const double *rgb, hsl_type *hsl,
+                                size_t size, int linear);
+extern hsl_type *rgbf32_to_husl_nd(const float *rgb, size_t size, int linear);
+extern void rgbf32_to_husl_nd_out(const float *rgb, hsl_type *hsl,
+                                  size_t size, int linear);
+extern int rgb_to_husl_hist_nd(
+    const void *rgb, int depth, size_t size, int linear,
+    const int32_t *bins, int n_hists, const int64_t *strides,
+    int64_t *hist, size_t hist_size);
+extern int rgb_to_husl_stats_nd(
+    const void *rgb, int depth, size_t size, int linear, const uint8_t *mask,
+    double *sums, int64_t *light_hist, int light_bins);
+extern void fill_hue_sin_table(void);
+extern void gray_to_husl_nd(const void *gray, int depth, size_t pixels,
+                            int linear, int lightness_only, hsl_type *out);
+extern void rgb_to_lightness_nd(const void *rgb, int depth, size_t pixels,
+                                int linear, hsl_type *light);
+extern void fill_gray_light_table(void);
+extern int use_hugepage_tables(int enable);
+extern void rgb_tiles_to_husl_nd(
+    const void *rgb, int depth, int rows, int cols, int tile,
+    const uint8_t *dirty, int linear, hsl_type *hsl);
+extern size_t gather_palette_nd(
+    const uint8_t *palette, size_t entry_bytes, size_t entries,
+    const void *indices, int index_bytes, size_t pixels, uint8_t *out);
+extern long rgb_dedupe_to_husl_nd(const uint8_t *rgb, size_t pixels,
+                                  size_t max_colors, hsl_type *hsl);
+extern void rgb_runs_to_husl_nd(const uint8_t *rgb, int rows, int cols,
+                                hsl_type *hsl);
+extern void yuv420_to_husl_nd(
+    const uint8_t *y, const uint8_t *u, const uint8_t *v, hsl_type *hsl,
+    int rows, int cols, size_t y_stride, size_t c_stride, size_t c_step,
+    const int32_t *coeffs);
@@ -0,0 +1,111 @@
+// Load and store steps of rgb_to_husl_format_nd for one value type.
+//
+// Not a normal header: _simd.c includes it once per value type, like a
+// template, with these parameters defined:
+//   FORMAT_TYPE: C type of the values (e.g. uint16_t)
+//   FORMAT_NAME(name): `name` with a suffix for the type (e.g. name##_u16)
+//   FORMAT_ALPHA(c, a): value `c` composited with alpha value `a`
+//   FORMAT_STORE(value, k): defined if HSL can be stored as FORMAT_TYPE,
+//     as the FORMAT_TYPE of channel `k` (0: H, 1: S, 2: L) `value`
+// Each inclusion instantiates
+//   FORMAT_NAME(load_run): RGB of a run of pixels in any channel order
+//   FORMAT_NAME(load_planes): the same for pixels in separate planes
+//   FORMAT_NAME(store_run): a run of HSL doubles stored as FORMAT_TYPE,
+//     interleaved or in planes
+// The parameters are undefined at the end, ready for the next type.
+// Callers pick the instantiation and channel order once per run of
+// pixels (see rgb_to_husl_format_nd), not once per conversion.
+
+
+// Copy the RGB of `pixels` pixels in channel order `order` (ORDER_*) at
+// `px` to interleaved RGB in `rgb`. Each order has its own loop with
+// constant channel offsets. Alpha is composited as in
+// transform.reshape_rgba_input.
+static void FORMAT_NAME(load_run)(const FORMAT_TYPE *restrict px, int order,
+                                  int pixels, FORMAT_TYPE *restrict rgb) {
+    int k;
+    switch (order) {
+    case ORDER_BGR:
+        for (k = 0; k < pixels; k++) {
+            rgb[3*k] = px[3*k + 2];
+            rgb[3*k + 1] = px[3*k + 1];
+            rgb[3*k + 2] = px[3*k];
+        }
+        break;
+    case ORDER_RGBA:
+        for (k = 0; k < pixels; k++) {
+            const FORMAT_TYPE a = px[4*k + 3];
+            rgb[3*k] = FORMAT_ALPHA(px[4*k], a);
+            rgb[3*k + 1] = FORMAT_ALPHA(px[4*k + 1], a);
+            rgb[3*k + 2] = FORMAT_ALPHA(px[4*k + 2], a);
+        }
+        break;
+    case ORDER_BGRA:
+        for (k = 0; k < pixels; k++) {
+            const FORMAT_TYPE a = px[4*k + 3];
+            rgb[3*k] = FORMAT_ALPHA(px[4*k + 2], a);
+            rgb[3*k + 1] = FORMAT_ALPHA(px[4*k + 1], a);
+            rgb[3*k + 2] = FORMAT_ALPHA(px[4*k], a);
+        }
+        break;
+    default:  // unused by rgb_to_husl_format_nd, which reads RGB in place
+        memcpy(rgb, px, (size_t) pixels*3*sizeof(FORMAT_TYPE));
+    }
+}
+
+
+// Like load_run, but for pixels whose channels are in planes of `plane`
+// values each, in the same order as the channels of `order`
+static void FORMAT_NAME(load_planes)(const FORMAT_TYPE *restrict px,
+                                     size_t plane, int order, int pixels,
+                                     FORMAT_TYPE *restrict rgb) {
+    const int bgr = order == ORDER_BGR || order == ORDER_BGRA;
+    const FORMAT_TYPE *restrict r = bgr ? px + 2*plane : px;
+    const FORMAT_TYPE *restrict g = px + plane;
+    const FORMAT_TYPE *restrict b = bgr ? px : px + 2*plane;
+    const FORMAT_TYPE *restrict alpha = px + 3*plane;
+    int k;
+    if (order == ORDER_RGBA || order == ORDER_BGRA) {
+        for (k = 0; k < pixels; k++) {
+            rgb[3*k] = FORMAT_ALPHA(r[k], alpha[k]);
+            rgb[3*k + 1] = FORMAT_ALPHA(g[k], alpha[k]);
+            rgb[3*k + 2] = FORMAT_ALPHA(b[k], alpha[k]);
+        }
+    } else {
+        for (k = 0; k < pixels; k++) {
+            rgb[3*k] = r[k];
+            rgb[3*k + 1] = g[k];
+            rgb[3*k + 2] = b[k];
+        }
+    }
+}
+
+
+#ifdef FORMAT_STORE
+// Store `pixels` HSL triplets of doubles as FORMAT_TYPE triplets, or in H,
+// S, and L planes of `plane` values each if `planar` is nonzero
+static void FORMAT_NAME(store_run)(const double *restrict hsl, int pixels,
+                                   int planar, size_t plane,
+                                   FORMAT_TYPE *restrict out) {
+    int k;
+    if (planar) {
+        for (k = 0; k < pixels; k++) {
+            out[k] = FORMAT_STORE(hsl[3*k], 0);
+            out[plane + k] = FORMAT_STORE(hsl[3*k + 1], 1);
+            out[2*plane + k] = FORMAT_STORE(hsl[3*k + 2], 2);
+        }
+    } else {
+        for (k = 0; k < pixels; k++) {
+            out[3*k] = FORMAT_STORE(hsl[3*k], 0);
+            out[3*k + 1] = FORMAT_STORE(hsl[3*k + 1], 1);
+            out[3*k + 2] = FORMAT_STORE(hsl[3*k + 2], 2);
+        }
+    }
+}
+#endif
+
+
+#undef FORMAT_TYPE
+#undef FORMAT_NAME
+#undef FORMAT_ALPHA
+#undef FORMAT_STORE
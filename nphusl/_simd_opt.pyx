@@ -3,6 +3,7 @@
 import numpy as np
 cimport numpy as np
 import cython
+from cython cimport view
 from libc.stdlib cimport free
 
 from . import transform
@@ -14,27 +15,565 @@ cdef size_t data_size = sizeof(hsl_t)
 
 
 cdef extern from "_simd.h":
-    hsl_t* rgb_to_husl_nd(np.uint8_t *rgb, size_t size)
+    int _RUN_PIXELS "RUN_PIXELS"
+    int _MIN_IMG_SIZE_THREADED "MIN_IMG_SIZE_THREADED"
+    hsl_t* rgb_to_husl_nd(np.uint8_t *rgb, size_t size) nogil
+    void rgb_to_husl_nd_out(np.uint8_t *rgb, hsl_t *hsl, size_t size) nogil
+    hsl_t* rgb16_to_husl_nd(np.uint16_t *rgb, size_t size) nogil
+    void rgb16_to_husl_nd_out(np.uint16_t *rgb, hsl_t *hsl, size_t size) nogil
+    hsl_t* rgbf_to_husl_nd(const double *rgb, size_t size, int linear) nogil
+    void rgbf_to_husl_nd_out(const double *rgb, hsl_t *hsl,
+                             size_t size, int linear) nogil
+    hsl_t* rgbf32_to_husl_nd(const float *rgb, size_t size, int linear) nogil
+    void rgbf32_to_husl_nd_out(const float *rgb, hsl_t *hsl,
+                               size_t size, int linear) nogil
+    void rgb_to_husl_format_nd(const void *rgb, int depth, int order,
+                               int planar_in, size_t pixels, int linear,
+                               void *out, int out_depth, int planar_out) nogil
+    int KERNEL_NO_MEMORY
+    int rgb_to_husl_hist_nd(
+        const void *rgb, int depth, size_t size, int linear,
+        const np.int32_t *bins, int n_hists, const np.int64_t *strides,
+        np.int64_t *hist, size_t hist_size) nogil
+    int rgb_to_husl_stats_nd(
+        const void *rgb, int depth, size_t size, int linear,
+        const np.uint8_t *mask, double *sums, np.int64_t *light_hist,
+        int light_bins) nogil
+    void fill_hue_sin_table()
+    void set_default_quality(int quality)
+    int set_thread_quality(int quality)
+    int get_quality()
+    void set_schedule(int kind, int chunk)
+    int get_schedule(int *chunk)
+    int set_thread_chunk(int chunk)
+    int set_thread_team(int threads)
+    void set_threaded_min_size(size_t size)
+    size_t get_threaded_min_size()
+    void gray_to_husl_nd(const void *gray, int depth, size_t pixels,
+                         int linear, int lightness_only, hsl_t *out) nogil
+    void rgb_to_lightness_nd(const void *rgb, int depth, size_t pixels,
+                             int linear, hsl_t *light) nogil
+    void fill_gray_light_table()
+    int use_hugepage_tables(int enable)
+    void rgb_tiles_to_husl_nd(
+        const void *rgb, int depth, int rows, int cols, int tile,
+        const np.uint8_t *dirty, int linear, hsl_t *hsl) nogil
+    size_t gather_palette_nd(
+        const np.uint8_t *palette, size_t entry_bytes, size_t entries,
+        const void *indices, int index_bytes, size_t pixels,
+        np.uint8_t *out) nogil
+    long rgb_dedupe_to_husl_nd(const np.uint8_t *rgb, size_t pixels,
+                               size_t max_colors, hsl_t *hsl) nogil
+    void rgb_runs_to_husl_nd(const np.uint8_t *rgb, int rows, int cols,
+                             hsl_t *hsl) nogil
+    void yuv420_to_husl_nd(
+        const np.uint8_t *y, const np.uint8_t *u, const np.uint8_t *v,
+        hsl_t *hsl, int rows, int cols, size_t y_stride,
+        size_t c_stride, size_t c_step, const np.int32_t *coeffs) nogil
 
 
-@transform.rgb_int_input
-def _rgb_to_husl(rgb):
+RUN_PIXELS = _RUN_PIXELS  # pixels per run of the conversion passes
+MIN_IMG_SIZE_THREADED = _MIN_IMG_SIZE_THREADED
+
+
+cdef extern from "_linear_lookup.h":
+    void fill_linear_table_16()
+fill_hue_sin_table()
+
+
+cdef extern from "_affinity.h":
+    int AFFINITY_MAX_CPUS
+    int AFFINITY_BAD_CPU
+    int set_affinity(const int *cpus, int n)
+    int get_affinity(int *cpus)
+
+
+cdef extern from "_tiles.h":
+    void husl_to_tiles_nd(const hsl_t *hsl, void *tiles,
+                          int rows, int cols, int tile, int bits) nogil
+    void tiles_to_husl_nd(const void *tiles, hsl_t *hsl,
+                          int rows, int cols, int tile, int bits) nogil
+    int diff_tiles_nd(np.uint8_t *prev, const np.uint8_t *frame,
+                      int rows, int cols, size_t pixel_bytes, int tile,
+                      np.uint8_t *dirty) nogil
+
+
+fill_linear_table_16()
+fill_gray_light_table()
+use_hugepage_tables(1)
+
+
+def _set_default_quality(int quality):
+    """Set the kernel quality level (0: fast, 1: balanced, 2: exact)"""
+    set_default_quality(quality)
+
+
+def _set_thread_quality(int quality):
+    """Set the kernel quality level of this thread's conversions only, or
+    go back to the default level with -1. Returns the previous setting."""
+    return set_thread_quality(quality)
+
+
+def _get_quality():
+    """Kernel quality level of this thread's conversions"""
+    return get_quality()
+
+
+def _set_schedule(int kind, int chunk):
+    """Set the OpenMP schedule of conversions (1: static, 2: dynamic,
+    3: guided) and its chunk size in runs of pixels (0: OpenMP's default)"""
+    set_schedule(kind, chunk)
+
+
+def _get_schedule():
+    """OpenMP schedule and chunk size of conversions"""
+    cdef int chunk
+    cdef int kind = get_schedule(&chunk)
+    return kind, chunk
+
+
+def _set_thread_chunk(int chunk):
+    """Set the schedule's chunk size of this thread's conversions only, or
+    go back to `_set_schedule`'s with 0. Returns the previous setting."""
+    return set_thread_chunk(chunk)
+
+
+def _set_thread_team(int threads):
+    """Set the number of OpenMP threads of this thread's conversions (C and
+    Cython), if `threads` is positive. Returns the previous number."""
+    return set_thread_team(threads)
+
+
+def _set_threaded_min_size(size_t size):
+    """Parallelize conversions of at least `size` values (3 per RGB pixel)"""
+    set_threaded_min_size(size)
+
+
+def _get_threaded_min_size():
+    """Min size of parallelized conversions, in values"""
+    return get_threaded_min_size()
+
+
+def _set_affinity(cpus):
+    """Pin the threads of later conversions to `cpus`, one thread per CPU,
+    or unpin them if `cpus` is empty. Returns 0, or (changing nothing) -1
+    if a CPU isn't available to the process and -2 if threads can't be
+    pinned."""
+    cdef np.ndarray[np.int32_t, ndim=1] cpu_array = np.ascontiguousarray(
+        cpus, dtype=np.int32).reshape(-1)
+    if len(cpu_array) > AFFINITY_MAX_CPUS:
+        return AFFINITY_BAD_CPU
+    return set_affinity(<const int*> cpu_array.data, len(cpu_array))
+
+
+def _get_affinity():
+    """CPUs set with `_set_affinity`"""
+    cpus = np.empty(AFFINITY_MAX_CPUS, dtype=np.int32)
+    cdef np.ndarray[np.int32_t, ndim=1] cpu_array = cpus
+    cdef int n = get_affinity(<int*> cpu_array.data)
+    return tuple(int(c) for c in cpus[:n])
+
+
+def _use_hugepage_tables(enable=True):
+    """Read the chroma LUT from a copy on huge pages, or from the original
+    table. Returns True if the copy is in use (it can't be without
+    transparent huge pages)."""
+    return bool(use_hugepage_tables(enable))
+
+
+def _rgb_to_husl(rgb, linear=False):
+    """Convert uint8, uint16, float32, or float64 RGB to HUSL. Float RGB
+    is in [0, 1], and it's linear (not sRGB encoded) if `linear` is set."""
+    rgb = np.ascontiguousarray(transform.ensure_rgb_native(rgb, linear))
     cdef size_t size = rgb.size
     cdef int pixels
+    cdef hsl_t *hsl_ptr
+    cdef view.array hsl_flat
+    if not size:
+        return np.empty(rgb.shape, dtype=hsl_type)
+    pixels = size / 3
+    rgb_flat = rgb.reshape((pixels, 3))
+    if rgb.dtype == np.float64:
+        hsl_ptr = _rgbf_to_husl_2d(rgb_flat, size, linear)
+    elif rgb.dtype == np.float32:
+        hsl_ptr = _rgbf32_to_husl_2d(rgb_flat, size, linear)
+    elif rgb.dtype == np.uint16:
+        hsl_ptr = _rgb16_to_husl_2d(rgb_flat, size)
+    else:
+        hsl_ptr = _rgb_to_husl_2d(rgb_flat, size)
+    if hsl_ptr == NULL:
+        raise MemoryError("Couldn't allocate {} bytes for HUSL".format(
+                          size * data_size))
+    # hand the C buffer to NumPy rather than copying it on this thread,
+    # which would move every page onto this thread's NUMA node
+    hsl_flat = view.array(shape=(size,), itemsize=data_size, format="d",
+                          mode="c", allocate_buffer=False)
+    hsl_flat.data = <char*> hsl_ptr
+    hsl_flat.callback_free_data = free
+    return np.asarray(hsl_flat).reshape(rgb.shape)
+
+
+cdef hsl_t* _rgb_to_husl_2d(np.uint8_t[:, ::1] rgb, size_t size):
+    cdef hsl_t *hsl_ptr
+    with nogil:  # let other Python threads (e.g. an event loop) run
+        hsl_ptr = rgb_to_husl_nd(&rgb[0, 0], size)
+    return hsl_ptr
+
+
+cdef hsl_t* _rgb16_to_husl_2d(np.uint16_t[:, ::1] rgb, size_t size):
+    cdef hsl_t *hsl_ptr
+    with nogil:
+        hsl_ptr = rgb16_to_husl_nd(&rgb[0, 0], size)
+    return hsl_ptr
+
+
+cdef hsl_t* _rgbf_to_husl_2d(const double[:, ::1] rgb, size_t size,
+                             bint linear):
+    cdef hsl_t *hsl_ptr
+    with nogil:
+        hsl_ptr = rgbf_to_husl_nd(&rgb[0, 0], size, linear)
+    return hsl_ptr
+
+
+cdef hsl_t* _rgbf32_to_husl_2d(const float[:, ::1] rgb, size_t size,
+                               bint linear):
+    cdef hsl_t *hsl_ptr
+    with nogil:
+        hsl_ptr = rgbf32_to_husl_nd(&rgb[0, 0], size, linear)
+    return hsl_ptr
+
+
+
+def _rgb_to_husl_out(rgb, out):
+    """Convert RGB to HUSL, writing directly into the C-contiguous
+    float64 array `out` (e.g. a band of an `np.memmap`)"""
+    rgb = transform.ensure_rgb_native(rgb)
+    cdef size_t size = rgb.size
+    cdef const np.uint8_t[::1] rgb_flat  # const: input may be read-only
+    cdef const np.uint16_t[::1] rgb16_flat
+    cdef const double[::1] rgbf_flat
+    cdef const float[::1] rgbf32_flat
     cdef hsl_t[::1] hsl_flat
-    cdef np.ndarray out
-    try:
-        pixels = size / 3
-        rgb_flat = rgb.reshape((pixels, 3))
-        hsl_flat = _rgb_to_husl_2d(rgb_flat, size)
-        out = np.asarray(hsl_flat, dtype=hsl_type).reshape(rgb.shape)
-        return out.copy()
-    finally:
-        free(<void*>&hsl_flat[0])
-
-
-cdef hsl_t[::1] _rgb_to_husl_2d(np.uint8_t[:, ::1] rgb, size_t size):
-    cdef hsl_t *hsl_ptr = rgb_to_husl_nd(&rgb[0, 0], size)
-    cdef hsl_t[::1] husl = <hsl_t[:size]> hsl_ptr
-    return husl
+    if not out.flags.c_contiguous:
+        raise ValueError("Output array must be C-contiguous")
+    if out.size != size:
+        raise ValueError("Output size {} doesn't match input size {}".format(
+                         out.size, size))
+    if not size:
+        return out
+    hsl_flat = out.reshape(-1)
+    if rgb.dtype == np.float64:
+        rgbf_flat = np.ascontiguousarray(rgb).reshape(-1)
+        with nogil:
+            rgbf_to_husl_nd_out(&rgbf_flat[0], &hsl_flat[0], size, 0)
+        return out
+    if rgb.dtype == np.float32:
+        rgbf32_flat = np.ascontiguousarray(rgb).reshape(-1)
+        with nogil:
+            rgbf32_to_husl_nd_out(&rgbf32_flat[0], &hsl_flat[0], size, 0)
+        return out
+    if rgb.dtype == np.uint16:
+        rgb16_flat = np.ascontiguousarray(rgb).reshape(-1)
+        with nogil:
+            rgb16_to_husl_nd_out(<np.uint16_t*> &rgb16_flat[0],
+                                 &hsl_flat[0], size)
+        return out
+    rgb_flat = np.ascontiguousarray(rgb).reshape(-1)
+    with nogil:
+        rgb_to_husl_nd_out(<np.uint8_t*> &rgb_flat[0], &hsl_flat[0], size)
+    return out
+
+
+# channel orders of rgb_to_husl_format_nd by (order, channels)
+_ORDERS = {("rgb", 3): 0, ("bgr", 3): 1, ("rgb", 4): 2, ("bgr", 4): 3}
+
+
+def _rgb_to_husl_format(rgb, linear=False, order="rgb", dtype=np.float64,
+                        layout="interleaved"):
+    """Convert RGB or BGR (with or without alpha) of any `_rgb_to_husl`
+    type to float32, float64, or 16-bit fixed point HUSL (see `to_husl`),
+    reordering channels, compositing
+    alpha, and narrowing the output run by run in the kernel. `rgb` may be
+    a `transform.from_planes` view, and with `layout="planar"` so is the
+    result."""
+    rgb = transform.ensure_rgb_native(rgb, linear)
+    cdef bint planar_in = transform.is_planar(rgb)
+    cdef bint planar_out = layout == "planar"
+    # the planes of a planar view, or interleaved pixels
+    src = np.moveaxis(rgb, -1, 0) if planar_in else np.ascontiguousarray(rgb)
+    cdef int code = _ORDERS[order, rgb.shape[-1]]
+    cdef const np.uint8_t[::1] rgb_bytes = src.reshape(-1).view(np.uint8)
+    cdef int depth = rgb.dtype.itemsize * 8
+    cdef size_t pixels = rgb.size // rgb.shape[-1]
+    cdef bint is_linear = linear
+    if planar_out:
+        out = np.empty((3,) + rgb.shape[:-1], dtype=dtype)
+        hsl = transform.from_planes(out)
+    else:
+        out = hsl = np.empty(rgb.shape[:-1] + (3,), dtype=dtype)
+    cdef np.uint8_t[::1] hsl_bytes = out.reshape(-1).view(np.uint8)
+    cdef int out_depth = out.dtype.itemsize * 8
+    if pixels:
+        with nogil:
+            rgb_to_husl_format_nd(&rgb_bytes[0], depth, code, planar_in,
+                                  pixels, is_linear, &hsl_bytes[0],
+                                  out_depth, planar_out)
+    return hsl
+
+
+def _husl_histogram(rgb, bins, strides, size_t size, linear=False):
+    """Count HUSL values of RGB into the flat histograms described by
+    `strides`, without making an HSL array"""
+    rgb = np.ascontiguousarray(transform.ensure_rgb_native(rgb, linear))
+    cdef const np.uint8_t[::1] rgb_bytes = rgb.reshape(-1).view(np.uint8)
+    cdef int depth = rgb.dtype.itemsize * 8  # 8, 16, 32 (float), 64
+    cdef const np.int32_t[::1] bins_view = np.ascontiguousarray(
+        bins, dtype=np.int32)
+    cdef const np.int64_t[:, ::1] strides_view = np.ascontiguousarray(
+        strides, dtype=np.int64)
+    cdef size_t rgb_size = rgb.size
+    cdef bint is_linear = linear
+    cdef int status = 0
+    hist = np.zeros(size, dtype=np.int64)
+    cdef np.int64_t[::1] hist_view = hist
+    if rgb_size and strides_view.shape[0]:
+        with nogil:
+            status = rgb_to_husl_hist_nd(
+                &rgb_bytes[0], depth, rgb_size, is_linear, &bins_view[0],
+                strides_view.shape[0], &strides_view[0, 0], &hist_view[0],
+                size)
+    if status == KERNEL_NO_MEMORY:
+        raise MemoryError("Couldn't allocate the threads' histograms")
+    return hist
+
+
+def _husl_stats(rgb, mask, int light_bins, linear=False):
+    """Reduce HUSL values of RGB to sums and a lightness sketch (see
+    rgb_to_husl_stats_nd), without making an HSL array"""
+    rgb = np.ascontiguousarray(transform.ensure_rgb_native(rgb, linear))
+    cdef const np.uint8_t[::1] rgb_bytes = rgb.reshape(-1).view(np.uint8)
+    cdef const np.uint8_t[::1] mask_bytes
+    cdef const np.uint8_t *mask_ptr = NULL
+    cdef int depth = rgb.dtype.itemsize * 8
+    cdef size_t rgb_size = rgb.size
+    cdef bint is_linear = linear
+    cdef int status = 0
+    sums = np.zeros(7, dtype=np.float64)
+    light_hist = np.zeros(light_bins, dtype=np.int64)
+    cdef double[::1] sums_view = sums
+    cdef np.int64_t[::1] hist_view = light_hist
+    if mask is not None and rgb_size:
+        mask_bytes = np.ascontiguousarray(mask, dtype=bool).reshape(
+            -1).view(np.uint8)
+        mask_ptr = &mask_bytes[0]
+    if rgb_size:
+        with nogil:
+            status = rgb_to_husl_stats_nd(
+                &rgb_bytes[0], depth, rgb_size, is_linear, mask_ptr,
+                &sums_view[0], &hist_view[0], light_bins)
+    if status == KERNEL_NO_MEMORY:
+        raise MemoryError("Couldn't allocate the threads' sketches")
+    return sums, light_hist
+
+
+def _gray_to_husl(gray, linear=False):
+    """Convert a grayscale image (any RGB type) to HUSL"""
+    return _gray_kernel(gray, linear, False)
+
+
+def _gray_to_lightness(gray, linear=False):
+    """Convert a grayscale image (any RGB type) to HUSL lightness"""
+    return _gray_kernel(gray, linear, True)
+
+
+cdef _gray_kernel(gray, linear, bint lightness_only):
+    gray = np.ascontiguousarray(transform.ensure_rgb_native(gray, linear))
+    cdef const np.uint8_t[::1] gray_bytes = gray.reshape(-1).view(np.uint8)
+    cdef int depth = gray.dtype.itemsize * 8
+    cdef size_t pixels = gray.size
+    cdef bint is_linear = linear
+    shape = gray.shape if lightness_only else gray.shape + (3,)
+    out = np.empty(shape, dtype=hsl_type)
+    cdef hsl_t[::1] out_flat = out.reshape(-1)
+    if pixels:
+        with nogil:
+            gray_to_husl_nd(&gray_bytes[0], depth, pixels, is_linear,
+                            lightness_only, &out_flat[0])
+    return out
+
+
+def _rgb_to_lightness(rgb, linear=False):
+    """Convert RGB (any type) to HUSL lightness, skipping chroma"""
+    rgb = np.ascontiguousarray(transform.ensure_rgb_native(rgb, linear))
+    cdef const np.uint8_t[::1] rgb_bytes = rgb.reshape(-1).view(np.uint8)
+    cdef int depth = rgb.dtype.itemsize * 8
+    cdef size_t pixels = rgb.size // 3
+    cdef bint is_linear = linear
+    light = np.empty(rgb.shape[:-1], dtype=hsl_type)
+    cdef hsl_t[::1] light_flat = light.reshape(-1)
+    if pixels:
+        with nogil:
+            rgb_to_lightness_nd(&rgb_bytes[0], depth, pixels, is_linear,
+                                &light_flat[0])
+    return light
+
+
+def _rgb_dedupe_to_husl(rgb, size_t max_colors):
+    """Convert 8-bit RGB to HUSL by converting each distinct color once.
+    Returns None if there are more than `max_colors` colors."""
+    rgb = np.ascontiguousarray(rgb, dtype=np.uint8)
+    cdef const np.uint8_t[::1] rgb_flat = rgb.reshape(-1)
+    cdef size_t pixels = rgb.size // 3
+    cdef long n_colors = 0
+    hsl = np.empty(rgb.shape, dtype=hsl_type)
+    cdef hsl_t[::1] hsl_flat = hsl.reshape(-1)
+    if pixels:
+        with nogil:
+            n_colors = rgb_dedupe_to_husl_nd(&rgb_flat[0], pixels,
+                                             max_colors, &hsl_flat[0])
+    if n_colors == KERNEL_NO_MEMORY:
+        raise MemoryError("Couldn't allocate the color table")
+    return None if n_colors < 0 else hsl
+
+
+def _rgb_runs_to_husl(rgb):
+    """Convert 8-bit RGB to HUSL by converting each horizontal run of
+    identical pixels once"""
+    rgb = np.ascontiguousarray(rgb, dtype=np.uint8)
+    cdef const np.uint8_t[::1] rgb_flat = rgb.reshape(-1)
+    cdef int cols = rgb.shape[-2] if rgb.ndim > 2 else rgb.size // 3
+    cdef int rows = rgb.size // 3 // cols if cols else 0
+    hsl = np.empty(rgb.shape, dtype=hsl_type)
+    cdef hsl_t[::1] hsl_flat = hsl.reshape(-1)
+    if rows:
+        with nogil:
+            rgb_runs_to_husl_nd(&rgb_flat[0], rows, cols, &hsl_flat[0])
+    return hsl
+
+
+def _gather_palette(palette, indices):
+    """Look up the rows of an (n, channels) `palette` for each index of an
+    array of ints"""
+    palette = np.ascontiguousarray(palette)
+    indices = np.ascontiguousarray(indices)
+    if indices.dtype.kind not in "iu":
+        raise TypeError("Expected integer indices, got {}".format(
+                        indices.dtype))
+    if indices.dtype.kind == "i" and indices.itemsize < 4:
+        indices = indices.astype(np.int32)
+    out = np.empty(indices.shape + palette.shape[1:], dtype=palette.dtype)
+    cdef const np.uint8_t[::1] palette_bytes = palette.reshape(-1).view(
+        np.uint8)
+    cdef const np.uint8_t[::1] index_bytes = indices.reshape(-1).view(
+        np.uint8)
+    cdef np.uint8_t[::1] out_bytes = out.reshape(-1).view(np.uint8)
+    cdef size_t entry_bytes = palette[0].nbytes if len(palette) else 0
+    cdef size_t entries = len(palette)
+    cdef int index_size = indices.itemsize
+    cdef size_t pixels = indices.size
+    cdef size_t bad = pixels
+    if pixels and entries:
+        with nogil:
+            bad = gather_palette_nd(&palette_bytes[0], entry_bytes, entries,
+                                    &index_bytes[0], index_size, pixels,
+                                    &out_bytes[0])
+    if pixels and bad:
+        raise IndexError("{} indices out of range for a palette of {} "
+                         "entries".format(bad, entries))
+    return out
+
+
+def _yuv_to_husl(y, u, v, coeffs):
+    """Convert Y, U, and V planes of a 4:2:0 frame to HUSL. U and V can be
+    strided views, e.g. the two halves of an NV12 UV plane."""
+    if y.dtype != np.uint8 or y.strides[1] != 1:  # rows can be padded
+        y = np.ascontiguousarray(y, dtype=np.uint8)
+    cdef const np.uint8_t[:, :] y_view = y
+    cdef const np.uint8_t[:, :] u_view = u
+    cdef const np.uint8_t[:, :] v_view = v
+    cdef const np.int32_t[::1] coeffs_view = np.ascontiguousarray(
+        coeffs, dtype=np.int32)
+    cdef int rows = y.shape[0]
+    cdef int cols = y.shape[1]
+    hsl = np.empty((rows, cols, 3), dtype=hsl_type)
+    cdef hsl_t[::1] hsl_flat = hsl.reshape(-1)
+    if u.strides != v.strides:
+        raise ValueError("U and V planes must have the same layout")
+    if rows and cols:
+        with nogil:
+            yuv420_to_husl_nd(
+                &y_view[0, 0], &u_view[0, 0], &v_view[0, 0], &hsl_flat[0],
+                rows, cols, y_view.strides[0], u_view.strides[0],
+                u_view.strides[1], &coeffs_view[0])
+    return hsl
+
+
+def _quantize_tiles(hsl, int tile, int bits):
+    """Quantize an HSL image into planar tiles of `bits`-bit ints"""
+    cdef int rows = hsl.shape[0]
+    cdef int cols = hsl.shape[1]
+    cdef const hsl_t[::1] hsl_flat = np.ascontiguousarray(
+        hsl, dtype=hsl_type).reshape(-1)
+    tiles = np.empty(hsl_flat.shape[0], dtype=_tile_dtype(bits))
+    cdef np.uint8_t[::1] tiles_bytes = tiles.view(np.uint8)
+    if hsl_flat.shape[0]:
+        with nogil:
+            husl_to_tiles_nd(&hsl_flat[0], &tiles_bytes[0],
+                             rows, cols, tile, bits)
+    return tiles
+
+
+def _dequantize_tiles(tiles, shape, int tile, int bits):
+    """Expand planar tiles of `bits`-bit ints into an HSL image"""
+    cdef int rows = shape[0]
+    cdef int cols = shape[1]
+    cdef const np.uint8_t[::1] tiles_bytes = np.ascontiguousarray(
+        tiles, dtype=_tile_dtype(bits)).view(np.uint8)
+    hsl = np.empty((rows, cols, 3), dtype=hsl_type)
+    cdef hsl_t[::1] hsl_flat = hsl.reshape(-1)
+    if hsl_flat.shape[0]:
+        with nogil:
+            tiles_to_husl_nd(&tiles_bytes[0], &hsl_flat[0],
+                             rows, cols, tile, bits)
+    return hsl
+
+
+def _diff_tiles(prev, frame, int tile, dirty):
+    """Flag the tiles of `frame` that differ from `prev` in `dirty` and
+    copy them into `prev`. Both are C-contiguous arrays of the same
+    shape and dtype. Returns the number of dirty tiles."""
+    cdef int rows = frame.shape[0]
+    cdef int cols = frame.shape[1]
+    cdef size_t pixel_bytes = frame[0, 0].nbytes if frame.size else 0
+    cdef np.uint8_t[::1] prev_bytes = prev.reshape(-1).view(np.uint8)
+    cdef const np.uint8_t[::1] frame_bytes = frame.reshape(-1).view(np.uint8)
+    cdef np.uint8_t[::1] dirty_bytes = dirty.reshape(-1).view(np.uint8)
+    cdef int n_dirty = 0
+    if pixel_bytes:
+        with nogil:
+            n_dirty = diff_tiles_nd(&prev_bytes[0], &frame_bytes[0], rows,
+                                    cols, pixel_bytes, tile, &dirty_bytes[0])
+    return n_dirty
+
+
+def _rgb_tiles_to_husl(rgb, int tile, dirty, hsl, linear=False):
+    """Convert the `dirty` tiles of a C-contiguous RGB image into the
+    same pixels of `hsl`, a C-contiguous float64 HSL image"""
+    cdef int rows = rgb.shape[0]
+    cdef int cols = rgb.shape[1]
+    cdef int depth = rgb.dtype.itemsize * 8
+    cdef bint is_linear = linear
+    cdef const np.uint8_t[::1] rgb_bytes = rgb.reshape(-1).view(np.uint8)
+    cdef const np.uint8_t[::1] dirty_bytes = dirty.reshape(-1).view(np.uint8)
+    cdef hsl_t[::1] hsl_flat = hsl.reshape(-1)
+    if rgb.size:
+        with nogil:
+            rgb_tiles_to_husl_nd(&rgb_bytes[0], depth, rows, cols, tile,
+                                 &dirty_bytes[0], is_linear, &hsl_flat[0])
+    return hsl
+
 
+def _tile_dtype(int bits):
+    if bits not in (8, 16):
+        raise ValueError("Tiles hold 8 or 16-bit ints, not {}".format(bits))
+    return np.uint8 if bits == 8 else np.uint16
@@ -0,0 +1,165 @@
+// Quantized, tiled HUSL planes with OpenMP
+//
+// Used by the tiled HUSL file format (see tiled.py) to pack interleaved
+// HSL doubles into 8 or 16-bit ints and back again. The image is cut into
+// `tile` x `tile` squares (clipped at the right and bottom edges), and the
+// tiles are stored one after another in row-major order. Each tile holds
+// separate H, S, and L planes.
+//
+// Important functions:
+// 1) husl_to_tiles_nd: interleaved HSL doubles -> quantized planar tiles
+// 2) tiles_to_husl_nd: quantized planar tiles -> interleaved HSL doubles
+// 3) diff_tiles_nd: flags the tiles of a frame that differ from the last
+
+
+#include <math.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <_tiles.h>
+
+
+// Max values of H, S, and L, which map to the largest quantized int
+static const double HSL_MAX[3] = {360.0, 100.0, 100.0};
+
+
+static inline size_t tile_offset(
+        int rows, int cols, int tile, int tile_y, int tile_x,
+        int *tile_rows, int *tile_cols);
+
+
+// Quantize a (rows x cols) image of interleaved HSL doubles into
+// planar tiles of 8-bit (uint8_t) or 16-bit (uint16_t) ints
+void husl_to_tiles_nd(const double *restrict hsl, void *restrict tiles,
+                      int rows, int cols, int tile, int bits) {
+    const int tiles_y = (rows + tile - 1) / tile;
+    const int tiles_x = (cols + tile - 1) / tile;
+    const double top = (double) ((1 << bits) - 1);
+    const double scale[3] = {
+        top / HSL_MAX[0], top / HSL_MAX[1], top / HSL_MAX[2]};
+    int t;
+
+#pragma omp parallel for schedule(dynamic) if (tiles_y*tiles_x > 1)
+    for (t = 0; t < tiles_y*tiles_x; t++) {
+        int tile_rows, tile_cols;
+        const int r0 = (t / tiles_x) * tile;
+        const int c0 = (t % tiles_x) * tile;
+        const size_t offset = tile_offset(
+            rows, cols, tile, t / tiles_x, t % tiles_x,
+            &tile_rows, &tile_cols);
+        const size_t plane = (size_t) tile_rows * tile_cols;
+        int r, c, k;
+        for (r = 0; r < tile_rows; r++) {
+            const double *src = hsl + ((size_t) (r0 + r)*cols + c0)*3;
+            const size_t dst = offset + (size_t) r*tile_cols;
+            for (c = 0; c < tile_cols; c++) {
+                for (k = 0; k < 3; k++) {
+                    const double q = fmin(top, fmax(0.0,
+                        src[c*3 + k]*scale[k] + 0.5));
+                    if (bits == 8) {
+                        ((uint8_t*) tiles)[dst + k*plane + c] = (uint8_t) q;
+                    } else {
+                        ((uint16_t*) tiles)[dst + k*plane + c] = (uint16_t) q;
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+// Expand planar tiles of 8-bit or 16-bit ints (the output of
+// husl_to_tiles_nd) into a (rows x cols) image of interleaved HSL doubles
+void tiles_to_husl_nd(const void *restrict tiles, double *restrict hsl,
+                      int rows, int cols, int tile, int bits) {
+    const int tiles_y = (rows + tile - 1) / tile;
+    const int tiles_x = (cols + tile - 1) / tile;
+    const double top = (double) ((1 << bits) - 1);
+    const double scale[3] = {
+        HSL_MAX[0] / top, HSL_MAX[1] / top, HSL_MAX[2] / top};
+    int t;
+
+#pragma omp parallel for schedule(dynamic) if (tiles_y*tiles_x > 1)
+    for (t = 0; t < tiles_y*tiles_x; t++) {
+        int tile_rows, tile_cols;
+        const int r0 = (t / tiles_x) * tile;
+        const int c0 = (t % tiles_x) * tile;
+        const size_t offset = tile_offset(
+            rows, cols, tile, t / tiles_x, t % tiles_x,
+            &tile_rows, &tile_cols);
+        const size_t plane = (size_t) tile_rows * tile_cols;
+        int r, c, k;
+        for (r = 0; r < tile_rows; r++) {
+            double *dst = hsl + ((size_t) (r0 + r)*cols + c0)*3;
+            const size_t src = offset + (size_t) r*tile_cols;
+            for (c = 0; c < tile_cols; c++) {
+                for (k = 0; k < 3; k++) {
+                    const double q = bits == 8 ?
+                        ((const uint8_t*) tiles)[src + k*plane + c] :
+                        ((const uint16_t*) tiles)[src + k*plane + c];
+                    dst[c*3 + k] = q*scale[k];
+                }
+            }
+        }
+    }
+}
+
+
+// Compare a (rows x cols) frame of `pixel_bytes`-byte pixels with the
+// previous frame in `prev`, one `tile` x `tile` square at a time. Sets
+// `dirty[t]` to 1 for each tile (in row-major tile order) with any
+// changed byte, else 0, and copies the changed rows of dirty tiles into
+// `prev`, so `prev` holds `frame` on return. A tile's rows are compared
+// with memcmp until the first difference, so clean tiles cost one pass
+// of reads and dirty tiles stop comparing early. Returns the number of
+// dirty tiles.
+int diff_tiles_nd(uint8_t *restrict prev, const uint8_t *restrict frame,
+                  int rows, int cols, size_t pixel_bytes, int tile,
+                  uint8_t *restrict dirty) {
+    const int tiles_y = (rows + tile - 1) / tile;
+    const int tiles_x = (cols + tile - 1) / tile;
+    const size_t row_bytes = (size_t) cols * pixel_bytes;
+    int n_dirty = 0;
+    int t;
+
+#pragma omp parallel for schedule(dynamic) reduction(+:n_dirty) \
+    if (tiles_y*tiles_x > 1)
+    for (t = 0; t < tiles_y*tiles_x; t++) {
+        const int r0 = (t / tiles_x) * tile;
+        const int c0 = (t % tiles_x) * tile;
+        const int tile_rows = rows - r0 < tile ? rows - r0 : tile;
+        const int tile_cols = cols - c0 < tile ? cols - c0 : tile;
+        const size_t span = (size_t) tile_cols * pixel_bytes;
+        size_t start = (size_t) r0*row_bytes + (size_t) c0*pixel_bytes;
+        int r = 0;
+        while (r < tile_rows && !memcmp(prev + start, frame + start, span)) {
+            start += row_bytes;
+            r++;
+        }
+        dirty[t] = r < tile_rows;
+        n_dirty += dirty[t];
+        for (; r < tile_rows; r++, start += row_bytes) {
+            memcpy(prev + start, frame + start, span);
+        }
+    }
+    return n_dirty;
+}
+
+
+// Returns the offset (in ints) of a tile's first value. Every tile row
+// above this tile spans the full image width, and every tile to its left
+// in the same tile row has the same height as this tile.
+static inline size_t tile_offset(
+        int rows, int cols, int tile, int tile_y, int tile_x,
+        int *tile_rows, int *tile_cols) {
+    const int r0 = tile_y * tile;
+    const int c0 = tile_x * tile;
+    *tile_rows = rows - r0 < tile ? rows - r0 : tile;
+    *tile_cols = cols - c0 < tile ? cols - c0 : tile;
+    return 3*((size_t) r0*cols + (size_t) c0*(*tile_rows));
+}
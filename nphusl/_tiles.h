@@ -0,0 +1,11 @@
+
+#include <stddef.h>
+#include <stdint.h>
+
+extern void husl_to_tiles_nd(const double *hsl, void *tiles,
+                             int rows, int cols, int tile, int bits);
+extern void tiles_to_husl_nd(const void *tiles, double *hsl,
+                             int rows, int cols, int tile, int bits);
+extern int diff_tiles_nd(uint8_t *prev, const uint8_t *frame,
+                         int rows, int cols, size_t pixel_bytes, int tile,
+                         uint8_t *dirty);
@@ -0,0 +1,120 @@
+"""
+asyncio versions of the HUSL <-> RGB conversion API:
+
+   * `to_husl`: `await aio.to_husl(rgb)` converts an RGB array to HUSL
+   * `to_hue`: `await aio.to_hue(rgb)` converts an RGB array to HUSL hues
+   * `to_rgb`: `await aio.to_rgb(hsl)` converts a HUSL array to RGB
+
+Conversions are queued for one dispatcher thread owned by this module.
+The C and Cython kernels release the GIL while they run, so the event
+loop keeps serving other tasks, and each kernel still gets the whole
+OpenMP team. Because every conversion starts from the same thread,
+OpenMP reuses that thread's team instead of building a new one for
+every executor thread, and concurrent requests never oversubscribe the
+cores. Results are handed back to the loop with
+`loop.call_soon_threadsafe`. Each conversion runs in a copy of the
+submitting task's `contextvars` context, so it uses the task's backend
+(see `nphusl.use_backend`).
+"""
+
+import asyncio
+import contextvars
+import queue
+import threading
+
+from numpy import ndarray
+from . import nphusl
+
+
+class _Dispatcher:
+    """Runs conversions one at a time on a daemon thread and resolves
+    asyncio futures with their results"""
+
+    def __init__(self):
+        self._jobs = queue.Queue()
+        self._thread = None
+        self._lock = threading.Lock()
+
+    def submit(self, fn_name: str, *args, **kwargs):
+        loop = asyncio.get_event_loop()
+        future = loop.create_future()
+        context = contextvars.copy_context()
+        self._start()
+        self._jobs.put((fn_name, args, kwargs, context, loop, future))
+        return future
+
+    def shutdown(self) -> None:
+        with self._lock:
+            if self._thread is not None:
+                self._jobs.put(None)
+                self._thread.join()
+                self._thread = None
+
+    def _start(self) -> None:
+        with self._lock:
+            if self._thread is None:
+                self._thread = threading.Thread(
+                    target=self._work, name="nphusl-aio", daemon=True)
+                self._thread.start()
+
+    def _work(self) -> None:
+        while True:
+            job = self._jobs.get()
+            if job is None:
+                return
+            fn_name, args, kwargs, context, loop, future = job
+            if future.cancelled():
+                continue
+            try:
+                result = context.run(getattr(nphusl, fn_name), *args,
+                                     **kwargs)
+            except BaseException as e:
+                _call_soon(loop, _set_exception, future, e)
+            else:
+                _call_soon(loop, _set_result, future, result)
+
+
+def _call_soon(loop, fn, future, value) -> None:
+    try:
+        loop.call_soon_threadsafe(fn, future, value)
+    except RuntimeError:  # the loop was closed while we were converting
+        pass
+
+
+def _set_result(future, result) -> None:
+    if not future.done():
+        future.set_result(result)
+
+
+def _set_exception(future, exception) -> None:
+    if not future.done():
+        future.set_exception(exception)
+
+
+_dispatcher = _Dispatcher()
+
+
+async def to_hue(rgb_img: ndarray, chunksize: int = None,
+                 out: ndarray = None, backend: str = None) -> ndarray:
+    """Convert an RGB image of integers to a 2D array of HUSL hues"""
+    return await _dispatcher.submit("to_hue", rgb_img, chunksize, out,
+                                    backend=backend)
+
+
+async def to_rgb(husl_img: ndarray, chunksize: int = None,
+                 out: ndarray = None, backend: str = None) -> ndarray:
+    """Convert a 3D HUSL array of floats to a 3D RGB array of integers"""
+    return await _dispatcher.submit("to_rgb", husl_img, chunksize, out,
+                                    backend=backend)
+
+
+async def to_husl(rgb_img: ndarray, chunksize: int = None,
+                  out: ndarray = None, backend: str = None) -> ndarray:
+    """Convert an RGB image of integers to a 3D array of HSL values"""
+    return await _dispatcher.submit("to_husl", rgb_img, chunksize, out,
+                                    backend=backend)
+
+
+def shutdown() -> None:
+    """Stop the dispatcher thread. It restarts on the next conversion."""
+    _dispatcher.shutdown()
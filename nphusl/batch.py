@@ -0,0 +1,148 @@
+"""
+Batched HUSL conversion of many small requests. Found in this module:
+
+1. `BatchingConverter`: converts single colors and small swatches
+   submitted from any number of threads, many at a time
+
+Every call to `to_husl` pays for its decorators, dispatch, and a kernel
+launch, which dwarfs the conversion of a few pixels. A converter queues
+requests for one worker thread instead. The worker waits up to `window`
+seconds after the first request of a batch for more to arrive (or until
+`max_pixels` are waiting), copies their pixels into one contiguous buffer
+per dtype, converts each buffer with a single `to_husl` call, and resolves
+each request's future with its share of the result.
+"""
+
+import queue
+import threading
+import time
+
+from concurrent.futures import Future
+
+import numpy as np
+
+from numpy import ndarray
+from . import nphusl
+from . import transform
+
+
+DEFAULT_WINDOW = 0.0005        # seconds to wait for more requests
+DEFAULT_MAX_PIXELS = 1 << 16   # pixels converted by one kernel call
+
+# Dtypes that ensure_rgb_native passes through unless converting linear RGB
+_NATIVE_DTYPES = frozenset(np.dtype(t) for t in (
+    np.uint8, np.uint16, np.float32, np.float64))
+
+
+class BatchingConverter:
+    """Converts RGB colors and swatches (any shape ending in 3 channels)
+    to HUSL in batches. `submit` returns a `concurrent.futures.Future` of
+    an HSL array with the request's shape; `convert` waits for it. All
+    requests use this converter's `linear` and `quality` (see `to_husl`).
+    They use its `backend` too, or if that's None, the backend of the
+    submitting thread or task (see `use_backend`). Use it as a context
+    manager, or call `close`."""
+
+    def __init__(self, window: float = DEFAULT_WINDOW,
+                 max_pixels: int = DEFAULT_MAX_PIXELS,
+                 linear: bool = False, quality: str = None,
+                 backend: str = None):
+        if window < 0:
+            raise ValueError("Expected a window of at least 0 s, got "
+                             "{}".format(window))
+        if max_pixels < 1:
+            raise ValueError("Expected a positive max_pixels, got "
+                             "{}".format(max_pixels))
+        if quality is not None:
+            nphusl._quality_level(quality)  # fail here, not in the worker
+        if backend is not None:
+            nphusl._check_backend(backend)
+        self.window = window
+        self.max_pixels = int(max_pixels)
+        self.linear = linear
+        self.quality = quality
+        self.backend = backend
+        self._requests = queue.Queue()
+        self._lock = threading.Lock()
+        self._closed = False
+        self._thread = threading.Thread(
+            target=self._work, name="nphusl-batch", daemon=True)
+        self._thread.start()
+
+    def submit(self, rgb) -> Future:
+        """Queue an RGB color or swatch for conversion"""
+        rgb = np.asarray(rgb)
+        if rgb.dtype not in _NATIVE_DTYPES or self.linear:
+            rgb = transform.ensure_rgb_native(rgb, self.linear)
+        if rgb.ndim == 0 or rgb.shape[-1] != 3:
+            raise ValueError("Expected RGB triplets, got shape {}".format(
+                             rgb.shape))
+        backend = self.backend or nphusl.get_backend()
+        future = Future()
+        with self._lock:
+            if self._closed:
+                raise RuntimeError("The converter is closed")
+            self._requests.put((rgb, backend, future))
+        return future
+
+    def convert(self, rgb) -> ndarray:
+        """Convert an RGB color or swatch, waiting for its batch"""
+        return self.submit(rgb).result()
+
+    def close(self) -> None:
+        """Convert the requests already submitted, then stop the worker"""
+        with self._lock:
+            if self._closed:
+                return
+            self._closed = True
+            self._requests.put(None)
+        self._thread.join()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc_info):
+        self.close()
+
+    def _work(self) -> None:
+        done = False
+        while not done:
+            first = self._requests.get()
+            if first is None:
+                return
+            batch, pixels = [first], first[0].size // 3
+            deadline = time.perf_counter() + self.window
+            while pixels < self.max_pixels:
+                try:
+                    request = self._requests.get(
+                        timeout=max(0, deadline - time.perf_counter()))
+                except queue.Empty:
+                    break
+                if request is None:
+                    done = True
+                    break
+                batch.append(request)
+                pixels += request[0].size // 3
+            self._convert(batch)
+
+    def _convert(self, batch: list) -> None:
+        groups = {}  # (dtype, backend) -> requests for one to_husl call
+        for rgb, backend, future in batch:
+            if future.set_running_or_notify_cancel():
+                groups.setdefault((rgb.dtype, backend), []).append(
+                    (rgb, future))
+        for (_, backend), requests in groups.items():
+            try:
+                buffer = np.concatenate(
+                    [rgb.reshape((-1, 3)) for rgb, _ in requests])
+                hsl = nphusl.to_husl(
+                    buffer, linear=self.linear, quality=self.quality,
+                    backend=backend).reshape((-1, 3))
+            except BaseException as e:
+                for _, future in requests:
+                    future.set_exception(e)
+                continue
+            end = 0
+            for rgb, future in requests:
+                start, end = end, end + rgb.size // 3
+                future.set_result(hsl[start: end].reshape(rgb.shape))
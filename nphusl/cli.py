@@ -0,0 +1,343 @@
+"""
+Command line batch converter, run with `python -m nphusl`:
+
+   * `to-husl`: convert RGB images or arrays to HUSL arrays
+   * `to-hue`: convert RGB images or arrays to HUSL hue arrays
+   * `to-rgb`: convert HUSL arrays to RGB images or arrays
+   * `bench`: time each available implementation
+
+Inputs can be `.npy` files, raw C-ordered arrays (with `--shape` and
+`--dtype`), or image files (requires the optional `imageio` package).
+Files are converted concurrently by a pool of worker processes. A job only
+starts once its estimated footprint fits under `--max-memory`, and
+`.npy`/raw files are streamed through `stream.convert_file` in bands, so
+even huge inputs stay inside their share of the memory ceiling.
+"""
+
+import argparse
+import itertools
+import os
+import sys
+import time
+import timeit
+import multiprocessing
+
+from collections import deque, namedtuple
+from concurrent.futures import ProcessPoolExecutor, wait, FIRST_COMPLETED
+
+import numpy as np
+
+import nphusl
+from . import stream
+
+
+IMAGE_EXTS = {".png", ".jpg", ".jpeg", ".tif", ".tiff",
+              ".bmp", ".gif", ".webp"}
+BACKENDS = ["simd", "cython", "numexpr", "numpy"]
+
+# command -> (stream.convert_file conversion, public API function name,
+#             default output suffix, default input dtype, output pixel bytes)
+Command = namedtuple("Command", "conversion fn suffix dtype out_bytes")
+COMMANDS = {
+    "to-husl": Command("husl", "to_husl", ".hsl.npy", "uint8", 24),
+    "to-hue": Command("hue", "to_hue", ".hue.npy", "uint8", 8),
+    "to-rgb": Command("rgb", "to_rgb", ".png", "float64", 3),
+}
+
+Job = namedtuple("Job", "command in_path out_path shape dtype "
+                        "max_memory footprint")
+Result = namedtuple("Result", "path pixels seconds nbytes error")
+
+
+def main(argv: list = None) -> int:
+    args = _parser().parse_args(argv)
+    if args.command is None:
+        _parser().print_help()
+        return 2
+    if args.command == "bench":
+        return _bench(args)
+    return _convert_all(args)
+
+
+def _parser() -> argparse.ArgumentParser:
+    parser = argparse.ArgumentParser(
+        prog="python -m nphusl",
+        description="Batch HUSL <-> RGB conversion")
+    sub = parser.add_subparsers(dest="command")
+    for name in COMMANDS:
+        cmd = sub.add_parser(name)
+        cmd.add_argument("files", nargs="+")
+        cmd.add_argument("-o", "--output-dir", default=None,
+                         help="directory for outputs (default: next to "
+                              "each input)")
+        cmd.add_argument("-e", "--ext", default=COMMANDS[name].suffix,
+                         help="output suffix; .npy, an image format, or "
+                              "anything else for raw (default: %(default)s)")
+        cmd.add_argument("-j", "--jobs", type=int, default=os.cpu_count(),
+                         help="concurrent worker processes")
+        cmd.add_argument("-m", "--max-memory", type=_parse_size,
+                         default=_parse_size("1G"),
+                         help="memory ceiling shared by all workers, "
+                              "e.g. 512M or 4G (default: 1G)")
+        cmd.add_argument("-s", "--shape", type=_parse_shape, default=None,
+                         help="shape of raw inputs, e.g. 1080x1920x3")
+        cmd.add_argument("-d", "--dtype", default=COMMANDS[name].dtype,
+                         help="dtype of raw inputs (default: %(default)s)")
+        cmd.add_argument("-b", "--backend", choices=BACKENDS, default=None)
+    bench = sub.add_parser("bench")
+    bench.add_argument("files", nargs="*",
+                       help="images to time (default: a random image)")
+    bench.add_argument("--size", default="1920x1080",
+                       help="WIDTHxHEIGHT of the random image")
+    bench.add_argument("-i", "--iters", type=int, default=3)
+    bench.add_argument("-b", "--backend", choices=BACKENDS, nargs="+",
+                       default=BACKENDS)
+    return parser
+
+
+def _parse_shape(text: str) -> tuple:
+    try:
+        return tuple(int(n) for n in text.lower().replace(",", "x").split("x"))
+    except ValueError:
+        raise argparse.ArgumentTypeError("Bad shape: {!r}".format(text))
+
+
+def _parse_size(text: str) -> int:
+    units = {"K": 1 << 10, "M": 1 << 20, "G": 1 << 30, "T": 1 << 40}
+    text = text.strip().upper().rstrip("B")
+    scale = units.get(text[-1:], 1)
+    number = text[:-1] if text[-1:] in units else text
+    try:
+        return int(float(number) * scale)
+    except ValueError:
+        raise argparse.ArgumentTypeError("Bad size: {!r}".format(text))
+
+
+### Batch conversion
+
+def _convert_all(args) -> int:
+    workers = max(1, min(args.jobs or 1, len(args.files)))
+    share = max(1, args.max_memory // workers)
+    jobs = [_make_job(args, path, share) for path in args.files]
+    jobs, rejected = _check_outputs(jobs)
+
+    start = time.perf_counter()
+    total_pixels = total_bytes = failures = 0
+    results = _run(jobs, workers, args.max_memory, args.backend)
+    for result in itertools.chain(rejected, results):
+        if result.error:
+            failures += 1
+            print("{}: failed: {}".format(result.path, result.error),
+                  file=sys.stderr)
+            continue
+        total_pixels += result.pixels
+        total_bytes += result.nbytes
+        print("{}: {:.2f} Mpx in {:.3f} s ({:.1f} Mpx/s)".format(
+              result.path, result.pixels / 1e6, result.seconds,
+              result.pixels / 1e6 / max(result.seconds, 1e-9)))
+    wall = max(time.perf_counter() - start, 1e-9)
+    print("{} files ({} failed), {:.2f} Mpx in {:.3f} s with {} workers: "
+          "{:.1f} Mpx/s, {:.1f} MB/s".format(
+          len(args.files), failures, total_pixels / 1e6, wall, workers,
+          total_pixels / 1e6 / wall, total_bytes / 1e6 / wall))
+    return 1 if failures else 0
+
+
+def _check_outputs(jobs: list) -> tuple:
+    """Split `jobs` into those that can run and a failed `Result` for each
+    job that would write over an input or another job's output"""
+    inputs = {os.path.realpath(job.in_path) for job in jobs}
+    outputs = {}
+    for job in jobs:
+        out_path = os.path.realpath(job.out_path)
+        outputs[out_path] = outputs.get(out_path, 0) + 1
+    ok, rejected = [], []
+    for job in jobs:
+        out_path = os.path.realpath(job.out_path)
+        if out_path in inputs:
+            error = "output {} is an input".format(job.out_path)
+        elif outputs[out_path] > 1:
+            error = "output {} is shared with another input".format(
+                    job.out_path)
+        else:
+            ok.append(job)
+            continue
+        rejected.append(Result(job.in_path, 0, 0, 0, ValueError(error)))
+    return ok, rejected
+
+
+def _make_job(args, in_path: str, share: int) -> Job:
+    command = COMMANDS[args.command]
+    out_dir = args.output_dir or os.path.dirname(in_path)
+    out_path = os.path.join(out_dir, _stem(in_path) + args.ext)
+    try:
+        pixels, in_bytes = _estimate_input(in_path, args.shape, args.dtype)
+    except (OSError, ValueError):  # reported when the job runs
+        pixels = in_bytes = 0
+    footprint = pixels * (in_bytes + command.out_bytes +
+                          nphusl.nphusl.PEAK_BYTES_PER_PIXEL[command.fn])
+    if _streamable(in_path, out_path):
+        footprint = min(footprint, share)
+    return Job(args.command, in_path, out_path, args.shape, args.dtype,
+               share, footprint)
+
+
+def _run(jobs: list, workers: int, max_memory: int, backend: str):
+    """Run `jobs` on `workers` processes, yielding a `Result` as each job
+    finishes. A job is only started if its footprint fits beside the jobs
+    already running (or if nothing else is running)."""
+    if workers == 1:
+        for job in jobs:  # leaves the caller's default backend alone
+            with nphusl.use_backend(backend):
+                result = _convert(job)
+            yield result
+        return
+    pending = deque(jobs)
+    running = {}
+    in_use = 0
+    # give each worker its share of the cores for OpenMP threads
+    threads = max(1, (os.cpu_count() or 1) // workers)
+    context = multiprocessing.get_context("spawn")  # fork + OpenMP hangs
+    with ProcessPoolExecutor(workers, mp_context=context,
+                             initializer=_init_worker,
+                             initargs=(backend, threads)) as pool:
+        while pending or running:
+            while (pending and len(running) < workers and
+                   (not running or
+                    in_use + pending[0].footprint <= max_memory)):
+                job = pending.popleft()
+                running[pool.submit(_convert, job)] = job
+                in_use += job.footprint
+            done, _ = wait(running, return_when=FIRST_COMPLETED)
+            for future in done:
+                job = running.pop(future)
+                in_use -= job.footprint
+                try:
+                    yield future.result()
+                except Exception as e:
+                    yield Result(job.in_path, 0, 0, 0, e)
+
+
+def _init_worker(backend: str, threads: int = 0) -> None:
+    if backend:  # a spawned worker's own process
+        nphusl.set_backend(backend)
+    simd = nphusl.nphusl.simd
+    if threads and simd:  # OpenMP team of the thread running the jobs
+        simd._set_thread_team(threads)
+
+
+def _convert(job: Job) -> Result:
+    command = COMMANDS[job.command]
+    start = time.perf_counter()
+    try:
+        if _streamable(job.in_path, job.out_path):
+            pixels, pixel_bytes = _estimate_input(
+                job.in_path, job.shape, job.dtype)
+            out = stream.convert_file(
+                job.in_path, job.out_path, job.shape, job.dtype,
+                command.conversion, job.max_memory)
+            nbytes = pixels * pixel_bytes + out.nbytes
+            del out  # unmap the output
+        else:
+            src = _read(job.in_path, job.shape, job.dtype)
+            out = getattr(nphusl, command.fn)(src)
+            _write(job.out_path, out)
+            pixels = src.size // 3
+            nbytes = src.nbytes + out.nbytes
+    except Exception as e:
+        return Result(job.in_path, 0, 0, 0, e)
+    return Result(job.in_path, pixels, time.perf_counter() - start,
+                  nbytes, None)
+
+
+### File handling
+
+def _kind(path: str) -> str:
+    ext = os.path.splitext(path)[1].lower()
+    if ext == ".npy":
+        return "npy"
+    return "image" if ext in IMAGE_EXTS else "raw"
+
+
+def _streamable(in_path: str, out_path: str) -> bool:
+    return "image" not in (_kind(in_path), _kind(out_path))
+
+
+def _stem(path: str) -> str:
+    return os.path.splitext(os.path.basename(path))[0]
+
+
+def _estimate_input(path: str, shape: list, dtype: str) -> tuple:
+    """Return (pixels, bytes per pixel) of an input file without reading
+    all of it"""
+    kind = _kind(path)
+    if kind == "npy":
+        arr = np.load(path, mmap_mode="r")
+        return arr.size // 3, arr.itemsize * 3
+    if kind == "raw":
+        itemsize = np.dtype(dtype).itemsize
+        return os.path.getsize(path) // (itemsize * 3), itemsize * 3
+    try:
+        from imageio import v3
+        img_shape = v3.improps(path).shape
+        return int(np.prod(img_shape[:2])), 3
+    except Exception:  # old imageio or an unusual format: assume 10:1
+        return os.path.getsize(path) * 10 // 3, 3
+
+
+def _read(path: str, shape: list, dtype: str) -> np.ndarray:
+    kind = _kind(path)
+    if kind == "npy":
+        return np.load(path)
+    if kind == "raw":
+        if not shape:
+            raise ValueError("--shape is required for raw inputs")
+        return np.fromfile(path, dtype=dtype).reshape(shape)
+    return _imageio().imread(path)
+
+
+def _write(path: str, arr: np.ndarray) -> None:
+    kind = _kind(path)
+    if kind == "npy":
+        np.save(path, arr)
+    elif kind == "raw":
+        arr.tofile(path)
+    else:
+        _imageio().imwrite(path, arr)
+
+
+def _imageio():
+    try:
+        import imageio
+    except ImportError:
+        raise RuntimeError("Reading and writing image files requires "
+                           "imageio (pip install imageio)")
+    return imageio
+
+
+### Benchmarks
+
+def _bench(args) -> int:
+    if args.files:
+        imgs = [(path, _read(path, None, "uint8")) for path in args.files]
+    else:
+        width, height = (int(n) for n in args.size.lower().split("x"))
+        rgb = (np.random.rand(height, width, 3) * 255).astype(np.uint8)
+        imgs = [("random {}".format(args.size), rgb)]
+    for name, rgb in imgs:
+        hsl = nphusl.to_husl(rgb)
+        pixels = rgb.size // 3
+        print("{} ({:.2f} Mpx), best of {}".format(
+              name, pixels / 1e6, args.iters))
+        for backend in args.backend:
+            if backend != "numpy" and not getattr(nphusl, backend.upper()):
+                print("  {:8s} not available".format(backend))
+                continue
+            for fn, arg in (("to_husl", rgb), ("to_hue", rgb),
+                            ("to_rgb", hsl)):
+                best = min(timeit.repeat(
+                    lambda: getattr(nphusl, fn)(arg, backend=backend),
+                    repeat=args.iters, number=1))
+                print("  {:8s} {:8s} {:9.4f} s {:9.1f} Mpx/s".format(
+                      backend, fn, best, pixels / 1e6 / best))
+    return 0
@@ -20,3 +20,19 @@ REF_V = 0.46831999493879
 KAPPA = 903.2962962
 EPSILON = 0.0088564516
 
+# HUSL hue of white, which every gray shares (black's hue is 0)
+WHITE_HUE = 19.916405993809086
+
+
+# YUV (Y'CbCr) luma coefficients (Kr, Kb) of each ITU-R matrix
+YUV_MATRICES = {
+    "bt601": (0.299, 0.114),
+    "bt709": (0.2126, 0.0722),
+    "bt2020": (0.2627, 0.0593),
+}
+
+# 8-bit YUV ranges: (Y offset, Y span, Cb/Cr span)
+YUV_RANGES = {
+    "limited": (16.0, 219.0, 224.0),
+    "full": (0.0, 255.0, 255.0),
+}
@@ -0,0 +1,81 @@
+"""
+Incremental HUSL conversion of video from fixed cameras. Found in this
+module:
+
+1. `DeltaConverter`: converts consecutive frames to HUSL, reconverting
+   only the tiles that changed since the previous frame
+
+Each frame is cut into `tile` x `tile` squares (clipped at the right and
+bottom edges). A C kernel compares the rows of each tile with the previous
+frame using memcmp, stopping at the first difference, and copies the tiles
+that changed into its copy of the previous frame. Only those dirty tiles
+go through the conversion kernel, which writes straight into a persistent
+HSL buffer. The dirty tiles are reported, so later stages can be
+incremental too.
+"""
+
+import numpy as np
+
+from numpy import ndarray
+from . import nphusl
+from . import transform
+
+
+DEFAULT_TILE = 64
+
+
+class DeltaConverter:
+    """Converts consecutive (rows, cols, 3) RGB frames to HUSL. `convert`
+    updates and returns the same HSL buffer for each frame, so copy it to
+    keep an earlier frame's HSL. A frame with a new shape or dtype (or the
+    first frame) is converted in full."""
+
+    def __init__(self, tile: int = DEFAULT_TILE, linear: bool = False):
+        if tile < 1:
+            raise ValueError("Expected a positive tile size, got {}".format(
+                             tile))
+        self.tile = int(tile)
+        self.linear = linear
+        self.reset()
+
+    def reset(self) -> None:
+        """Forget the previous frame, so the next one is converted in full"""
+        self._prev = None
+        self.hsl = None    # HSL of the last frame
+        self.dirty = None  # bool per tile: True if it changed in the last frame
+
+    def convert(self, frame: ndarray) -> ndarray:
+        """Convert an RGB frame (uint8, uint16, or float in [0, 1]) and
+        return the HSL buffer. Afterwards, `dirty` flags the tiles that
+        were reconverted."""
+        frame = np.ascontiguousarray(
+            transform.ensure_rgb_native(np.asarray(frame), self.linear))
+        if frame.ndim != 3 or frame.shape[-1] != 3:
+            raise ValueError("Expected a (rows, cols, 3) RGB frame, got "
+                             "shape {}".format(frame.shape))
+        prev = self._prev
+        if prev is None or prev.shape != frame.shape \
+                or prev.dtype != frame.dtype:
+            self._start(frame)
+        else:
+            nphusl._diff_tiles(prev, frame, self.tile, self.dirty)
+        nphusl._rgb_tiles_to_husl(frame, self.tile, self.dirty, self.hsl,
+                                  self.linear)
+        return self.hsl
+
+    def dirty_regions(self) -> list:
+        """Return (row slice, col slice) for each tile reconverted by the
+        last call to `convert`, e.g. to update `hsl[rows, cols]` elsewhere"""
+        if self.dirty is None:
+            return []
+        bounds = nphusl._tile_bounds(self.hsl.shape, self.tile)
+        return [(slice(r0, r1), slice(c0, c1))
+                for (r0, r1, c0, c1), is_dirty
+                in zip(bounds, self.dirty.ravel()) if is_dirty]
+
+    def _start(self, frame: ndarray) -> None:
+        rows, cols = frame.shape[:2]
+        tiles = (-(-rows // self.tile), -(-cols // self.tile))
+        self._prev = frame.copy()
+        self.hsl = np.empty(frame.shape, dtype=np.float64)
+        self.dirty = np.ones(tiles, dtype=bool)
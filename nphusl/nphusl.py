@@ -6,16 +6,31 @@ color conversion. Found in this module:
    a. `to_husl`: converts an RGB array to a HUSL array
    b. `to_rgb`: converts a HUSL array to and RGB array
    c. `to_hue`: converts an RGB array to an array of HUSL hue values
+   d. `husl_histogram`: counts an RGB array's HUSL values into histograms
+   e. `husl_stats`: summarizes an RGB array's HUSL values
+   f. `to_lightness`: converts an RGB array to an array of HUSL lightness
+   g. `to_husl_indexed`, `to_rgb_indexed`: convert indexed-color images
+   h. `set_quality`, `get_quality`: choose the C kernels' speed/accuracy
+   i. `use_backend`, `set_backend`, `get_backend`: choose implementations
+   j. `set_memory_budget`, `get_memory_budget`: bound working memory
 2. The NumPy implementation of these conversions. Functions with
    alternative implementations in C, Cython, or NumExpr
-   are flagged with the `@optimized` decorator, and they can be enabled with
-   the context managers (e.g. `with simd_enabled: ...`) in `__init__`.
+   are flagged with the `@optimized` decorator, which picks one for each
+   call: the backend of the calling context (see `use_backend`, or the
+   `backend` argument of the API), or else the process-wide default.
    By default, C functions are used if they're available.
 """
 
+import bisect
 import math
+import os
 import warnings
 
+from collections import namedtuple
+from contextlib import contextmanager
+from contextvars import ContextVar
+from functools import partial, wraps
+
 import numpy as np
 
 from numpy import ndarray
@@ -23,35 +38,543 @@ from . import constants
 from . import transform
 
 
+### Backend selection
+
+BACKENDS = ("best", "simd", "cython", "numexpr", "numpy")
+_default_backend = "best"  # set_backend; "best" prefers SIMD, then Cython...
+_backend = ContextVar("nphusl_backend", default=None)  # use_backend
+
+
+def set_backend(backend: str = "best") -> None:
+    """Choose the implementation of conversions for the whole process, in
+    contexts that haven't chosen their own with `use_backend`: "simd",
+    "cython", "numexpr", "numpy", or "best" (the fastest available; the
+    default). Steps without an implementation in the chosen backend use
+    NumPy's."""
+    global _default_backend
+    _default_backend = _check_backend(backend)
+
+
+def get_backend() -> str:
+    """The backend of conversions in the calling context"""
+    return _backend.get() or _default_backend
+
+
+@contextmanager
+def use_backend(backend: str = None):
+    """Use `backend` (see `set_backend`) for conversions within the context,
+    if it isn't None. The choice is context-local (a `contextvars` variable),
+    so other threads and asyncio tasks keep their own."""
+    if backend is None:
+        yield
+        return
+    token = _backend.set(_check_backend(backend))
+    try:
+        yield
+    finally:
+        _backend.reset(token)
+
+
+def _check_backend(backend: str) -> str:
+    if backend not in BACKENDS:
+        raise ValueError("Expected backend to be one of {}, got {!r}".format(
+                         ", ".join(map(repr, BACKENDS)), backend))
+    if backend not in ("best", "numpy") and not _IMPLEMENTATIONS[backend]:
+        raise ValueError("The {} implementation isn't available".format(
+                         backend))
+    return backend
+
+
+def _selects_backend(fn):
+    """Decorator for API functions: adds a `backend` keyword argument that
+    picks the implementation (see `use_backend`) for the call. Calls with
+    the "best" backend follow `calibrate`'s choices for the function and
+    size of input, if there are any (see `tuning`)."""
+    name = fn.__name__
+
+    @wraps(fn)
+    def with_backend(*args, backend: str = None, **kwargs):
+        if _tuning is None:
+            _load_tuning()
+        if args and name in _tuning and (backend or get_backend()) == "best":
+            with _tuned(name, args[0]):
+                return fn(*args, **kwargs)
+        if backend is None:
+            return fn(*args, **kwargs)
+        token = _backend.set(_check_backend(backend))
+        try:
+            return fn(*args, **kwargs)
+        finally:
+            _backend.reset(token)
+    return with_backend
+
+
+# Choices of `tuning.calibrate` by API function name: the upper bounds of
+# its size buckets (in pixels), and a `Tuned` for each bucket. None until
+# `_load_tuning` reads the cache file, on first use.
+Tuned = namedtuple("Tuned", "backend threads chunk")
+_tuning = None
+
+
+def _load_tuning() -> None:
+    from . import tuning  # imports this module
+    tuning.load()
+
+
+@contextmanager
+def _tuned(name: str, img) -> None:
+    """Convert `img` with the backend, number of threads, and schedule
+    chunk size chosen for `name` and the size of `img` (0: unchanged)"""
+    bounds, choices = _tuning[name]
+    choice = choices[bisect.bisect(bounds, np.size(img) // 3)]
+    token = _backend.set(choice.backend)
+    team = simd._set_thread_team(choice.threads) if choice.threads else 0
+    chunk = simd._set_thread_chunk(choice.chunk) if choice.chunk else 0
+    try:
+        yield
+    finally:
+        _backend.reset(token)
+        if choice.threads:
+            simd._set_thread_team(team)
+        if choice.chunk:
+            simd._set_thread_chunk(chunk)
+
+
 ### The API
-### From RGB: to_husl, to_hue
+### From RGB: to_husl, to_hue, to_lightness
 ### From HUSL: to_rgb
+### Indexed color: to_husl_indexed, to_rgb_indexed
 
+@_selects_backend
 @transform.squeeze_output
 @transform.reshape_image_input
 @transform.reshape_rgba_input
 def to_hue(rgb_img: ndarray, chunksize: int = None,
-           out: ndarray = None) -> ndarray:
-    """Convert an RGB image of integers to a 2D array of HUSL hues"""
-    return transform.in_chunks(rgb_img, _rgb_to_hue, chunksize, out)
+           out: ndarray = None, linear: bool = False,
+           memory_budget: int = None) -> ndarray:
+    """Convert an RGB image of integers to a 2D array of HUSL hues.
+    See `to_husl` for float and `linear` RGB, and `memory_budget`."""
+    fn = partial(_image_to_hue, linear=linear)
+    return _within_budget("to_hue", rgb_img, fn, chunksize, out,
+                          memory_budget)
 
 
+@_selects_backend
+@transform.squeeze_output
+@transform.reshape_image_input
+@transform.reshape_rgba_input
+def to_lightness(rgb_img: ndarray, chunksize: int = None,
+                 out: ndarray = None, linear: bool = False,
+                 memory_budget: int = None) -> ndarray:
+    """Convert an RGB image to a 2D array of HUSL lightness values.
+    Lightness depends on luminance alone, so no chroma math is done.
+    See `to_husl` for `memory_budget`."""
+    fn = partial(_image_to_lightness, linear=linear)
+    return _within_budget("to_lightness", rgb_img, fn, chunksize, out,
+                          memory_budget)
+
+
+@_selects_backend
 @transform.squeeze_output
 @transform.reshape_husl_input
-@transform.rgb_int_output
 def to_rgb(husl_img: ndarray, chunksize: int = None,
-           out: ndarray = None) -> ndarray:
-    """Convert a 3D HUSL array of floats to a 3D RGB array of integers"""
-    return transform.in_chunks(husl_img, _husl_to_rgb, chunksize, out)
-
-
+           out: ndarray = None, dtype=np.uint8, palette: bool = False,
+           memory_budget: int = None):
+    """Convert a 3D HUSL array of floats to a 3D RGB array of integers.
+    `dtype` is np.uint8 (the default) or np.uint16 for 16-bit RGB.
+    If `palette` is set, return an indexed-color image instead:
+    (indices, palette), where `palette` holds the image's distinct RGB
+    colors and `indices` (uint8 for up to 256 colors) has the
+    image's shape, minus the channels. See `to_husl` for
+    `memory_budget`."""
+    rgb = _within_budget("to_rgb", husl_img, _husl_to_rgb, chunksize, out,
+                         memory_budget)
+    rgb = transform.to_rgb_dtype(rgb, dtype)
+    return transform.to_palette(rgb) if palette else rgb
+
+
+@_selects_backend
+def to_husl_indexed(indices: ndarray, palette: ndarray,
+                    linear: bool = False) -> ndarray:
+    """Convert an indexed-color image (e.g. a GIF) to a HUSL array.
+    `indices` is an array of ints indexing the rows of `palette`, an
+    (n, 3) RGB array. Only the palette is converted; each pixel then
+    gathers its palette entry's HSL triplet."""
+    hsl_palette = to_husl(transform.palette_image(palette), linear=linear)
+    return _gather_palette(hsl_palette.reshape((-1, 3)), indices)
+
+
+@_selects_backend
+def to_rgb_indexed(indices: ndarray, husl_palette: ndarray,
+                   dtype=np.uint8) -> ndarray:
+    """Convert an image of indices into an (n, 3) palette of HSL
+    triplets to an RGB array, converting only the palette"""
+    rgb_palette = to_rgb(transform.palette_image(husl_palette), dtype=dtype)
+    return _gather_palette(rgb_palette.reshape((-1, 3)), indices)
+
+
+@_selects_backend
 @transform.squeeze_output
 @transform.reshape_image_input
-@transform.reshape_rgba_input
+@transform.alert_rgba_input
 def to_husl(rgb_img: ndarray, chunksize: int = None,
-            out: ndarray = None) -> ndarray:
-    """Convert an RGB image of integers to a 3D array of HSL values"""
-    return transform.in_chunks(rgb_img, _rgb_to_husl, chunksize, out)
+            out: ndarray = None, linear: bool = False,
+            dedupe=False, runs: bool = False,
+            quality: str = None, order: str = "rgb",
+            dtype=np.float64, layout: str = "interleaved",
+            memory_budget: int = None) -> ndarray:
+    """Convert an RGB image of integers to a 3D array of HSL values.
+    Float RGB (float32 or float64) should be in [0, 1]. If `linear` is
+    set, the RGB is linear light (e.g. a render) rather than sRGB, and
+    the sRGB transfer function is skipped. A 2D image of integers, or
+    a `transform.from_grayscale` view, is converted as grayscale, which
+    skips the chroma math: S is 0 and H is the constant hue of white.
+    With `dedupe`, 8-bit sRGB is converted one distinct color at a time
+    and scattered to the pixels, which pays off for images with few
+    colors (logos, charts, flat renders). `dedupe="auto"` estimates the
+    number of colors from a sample of pixels first, and converts every
+    pixel if there are too many. With `runs`, 8-bit sRGB is converted
+    once for each horizontal run of identical pixels, which pays off for
+    scanned documents and screen captures. `quality` overrides the
+    `set_quality` level for this call. `order` is the channel order of
+    the input, "rgb" or "bgr" (e.g. OpenCV frames), and a fourth channel
+    is alpha. `dtype` is the type of the HSL output: float64, float32,
+    or uint16, which is fixed point (H * 65535/360, S and L * 65535/100,
+    rounded; `from_fixed16` scales it back).
+    With `layout="planar"`, H, S, and L are stored in separate contiguous
+    planes (see `transform.from_planes`), so `hsl[..., 0]` isn't strided.
+    Channel-first input (e.g. CHW) is read in place through a
+    `transform.from_planes` view. The C implementation reorders,
+    composites alpha, narrows the output, and reads and writes planes as
+    it converts, so none of these makes an extra copy. `memory_budget`
+    overrides the `set_memory_budget` budget (in bytes) for this call:
+    the image is converted in bands of rows whose temporaries fit in it.
+    Images too big to convert whole are converted in bands anyway."""
+    if dedupe not in (False, True, "auto"):
+        raise ValueError("Expected dedupe=False, True, or \"auto\", got "
+                         "{!r}".format(dedupe))
+    if order not in ("rgb", "bgr"):
+        raise ValueError("Expected order=\"rgb\" or \"bgr\", got "
+                         "{!r}".format(order))
+    dtype = np.dtype(dtype)
+    if dtype not in (np.float32, np.float64, np.uint16):
+        raise ValueError("HUSL output must be float32, float64, or uint16, "
+                         "not {}".format(dtype))
+    if layout not in ("interleaved", "planar"):
+        raise ValueError("Expected layout=\"interleaved\" or \"planar\", "
+                         "got {!r}".format(layout))
+    fn = partial(_image_to_husl, linear=linear, dedupe=dedupe, runs=runs,
+                 order=order, dtype=dtype, layout=layout)
+    with _quality_override(quality):
+        return _within_budget("to_husl", rgb_img, fn, chunksize, out,
+                              memory_budget)
+
+
+QUALITY_LEVELS = ("fast", "balanced", "exact")
+_quality = QUALITY_LEVELS[0]
+
+
+def set_quality(quality: str) -> None:
+    """Choose the variant of the C kernels that converts RGB to HUSL:
+    "fast" (lightness and max chroma from the nearest lookup table entries,
+    and an approximate hue; the default), "balanced" (interpolated max
+    chroma and a single precision atan2), or "exact" (no lookup tables or
+    approximations). All variants are built, so this takes effect at once.
+    The other implementations are always exact."""
+    global _quality
+    level = _quality_level(quality)
+    if simd is not None:
+        simd._set_default_quality(level)
+    _quality = QUALITY_LEVELS[level]
+
+
+def get_quality() -> str:
+    """The quality level chosen with `set_quality`"""
+    return _quality
+
+
+def _quality_level(quality: str) -> int:
+    if quality not in QUALITY_LEVELS:
+        raise ValueError("Expected quality to be one of {}, got {!r}".format(
+                         ", ".join(map(repr, QUALITY_LEVELS)), quality))
+    return QUALITY_LEVELS.index(quality)
+
+
+@contextmanager
+def _quality_override(quality: str = None):
+    """Use the C kernels of `quality` for conversions started from this
+    thread within the context (if `quality` isn't None)"""
+    if quality is None:
+        yield
+        return
+    level = _quality_level(quality)
+    if simd is None:
+        yield
+        return
+    previous = simd._set_thread_quality(level)
+    try:
+        yield
+    finally:
+        simd._set_thread_quality(previous)
+
+
+# Peak bytes of working memory per pixel, the result included, of each
+# conversion in its hungriest implementation (NumPy's temporaries; the C
+# kernels allocate little more than their results), measured with
+# tracemalloc. Bands for a memory budget are sized with these.
+PEAK_BYTES_PER_PIXEL = {"to_husl": 200, "to_rgb": 150, "to_hue": 200,
+                        "to_lightness": 100}
+STREAM_BUDGET = 1 << 26  # bytes per band after running out of memory
+_memory_budget = None
+
+
+def set_memory_budget(budget: int = None) -> None:
+    """Convert images in bands of rows small enough that a conversion's
+    working memory (its temporaries and the band being converted; not the
+    input or the whole result) stays under `budget` bytes, in calls that
+    don't pass their own `memory_budget`. None (the default) converts
+    images whole, and again in bands if that runs out of memory."""
+    global _memory_budget
+    _memory_budget = _check_memory_budget(budget)
+
+
+def get_memory_budget() -> int:
+    """The budget set with `set_memory_budget`, in bytes"""
+    return _memory_budget
+
+
+def _check_memory_budget(budget: int = None) -> int:
+    if budget is not None and budget < 1:
+        raise ValueError("Expected a positive memory budget (bytes) or "
+                         "None, got {}".format(budget))
+    return budget
+
+
+def _within_budget(name: str, img: ndarray, fn, chunksize: int = None,
+                   out: ndarray = None, budget: int = None) -> ndarray:
+    """Apply the conversion `fn` of API function `name` to `img` in square
+    chunks of `chunksize`, or in bands of rows that fit `budget` (or the
+    default budget), or whole. A whole image that runs out of memory is
+    converted again in bands of STREAM_BUDGET bytes, so that only the
+    result has to fit."""
+    if chunksize:
+        return transform.in_chunks(img, fn, chunksize, out)
+    budget = _check_memory_budget(budget)
+    if budget is None:
+        budget = _memory_budget
+    if budget is not None:
+        return transform.in_bands(img, fn, _band_rows(name, img, budget), out)
+    try:
+        return transform.in_chunks(img, fn, out=out)
+    except MemoryError:
+        rows = _band_rows(name, img, STREAM_BUDGET)
+        if rows >= len(img):
+            raise
+    warnings.warn("Out of memory converting {} pixels with {}; converting "
+                  "them {} rows at a time".format(
+                  len(img) * _row_pixels(img), name, rows))
+    return transform.in_bands(img, fn, rows, out)
+
+
+def _band_rows(name: str, img: ndarray, budget: int) -> int:
+    """Rows of `img` per band whose working memory fits in `budget` bytes
+    (at least one)"""
+    row_bytes = PEAK_BYTES_PER_PIXEL[name] * max(1, _row_pixels(img))
+    return max(1, budget // row_bytes)
+
+
+def _row_pixels(img: ndarray) -> int:
+    """Pixels in a row of an image with channels, e.g. (rows, cols, 3) or
+    (pixels, 3), or of a 2D grayscale image"""
+    channels = img.shape[-1] if img.ndim > 2 or img.shape[-1] in (3, 4) \
+        else 1
+    return img[:1].size // channels
+
+
+SCHEDULES = ("static", "dynamic", "guided")
+_schedule = ("dynamic", 4)
+
+
+def set_schedule(schedule: str = "dynamic", chunk: int = 4) -> None:
+    """Choose how the C kernels split an image's runs of 1024 pixels among
+    OpenMP threads: "static" (equal shares, or `chunk` runs at a time in
+    turn), "dynamic" (`chunk` runs at a time to whichever thread is free;
+    the default), or "guided" (shrinking shares, at least `chunk` runs).
+    White and black pixels are much cheaper to convert than colorful ones,
+    so images with large blown-out or dark regions balance better with
+    "dynamic" or "guided". A `chunk` of 0 is OpenMP's default."""
+    global _schedule
+    if schedule not in SCHEDULES:
+        raise ValueError("Expected schedule to be one of {}, got {!r}".format(
+                         ", ".join(map(repr, SCHEDULES)), schedule))
+    if chunk < 0:
+        raise ValueError("Expected a chunk size of at least 0, got {}".format(
+                         chunk))
+    if simd is not None:
+        simd._set_schedule(SCHEDULES.index(schedule) + 1, int(chunk))
+    _schedule = (schedule, int(chunk))
+
+
+def get_schedule() -> tuple:
+    """The (schedule, chunk) chosen with `set_schedule`"""
+    return _schedule
+
+
+def set_affinity(cpus=None) -> None:
+    """Confine the C kernels' conversions to the CPUs numbered in `cpus`,
+    with one OpenMP thread pinned to each, so they don't migrate away from
+    their cached lookup tables or onto cores kept for other services. The
+    calling thread runs a share too; it's confined to `cpus` during each
+    conversion and given back its own CPUs afterwards. `None` (or no CPUs)
+    unpins the threads again. Raises ValueError for CPUs that the process
+    can't run on, and OSError where threads can't be pinned."""
+    cpus = () if cpus is None else tuple(int(c) for c in cpus)
+    if len(set(cpus)) != len(cpus):
+        raise ValueError("Expected distinct CPUs, got {}".format(cpus))
+    error = simd._set_affinity(cpus) if simd is not None else -2
+    if error == -1:
+        raise ValueError("Expected CPUs among {}, got {}".format(
+                         sorted(os.sched_getaffinity(0)), cpus))
+    elif error:
+        raise OSError("Can't pin threads without sched_setaffinity and the "
+                      "C (SIMD) implementation")
+
+
+def get_affinity() -> tuple:
+    """The CPUs chosen with `set_affinity`, or () if threads aren't pinned"""
+    return simd._get_affinity() if simd is not None else ()
+
+
+@_selects_backend
+@transform.reshape_image_input
+@transform.reshape_rgba_input
+def husl_histogram(rgb_img: ndarray, bins: tuple = (36, 10, 10),
+                   channels="hsl", linear: bool = False):
+    """Count the HUSL values of an RGB image into histograms without
+    making an HSL array. `bins` is the number of (H, S, L) bins over
+    H in [0, 360] and S, L in [0, 100]. `channels` names the channels of a
+    histogram, e.g. "hl" for a 2D hue x lightness histogram, or it's a
+    sequence of names, e.g. ("hl", "s"), for several histograms from one
+    pass. Returns an int64 array of counts for each name."""
+    names = [channels] if isinstance(channels, str) else list(channels)
+    bins = tuple(int(n) for n in bins)
+    shapes, strides, size = transform.histogram_layout(bins, names)
+    counts = _husl_histogram(rgb_img, np.asarray(bins, dtype=np.int32),
+                             strides, size, linear)
+    hists = tuple(counts[offset: offset + int(np.prod(shape))].reshape(shape)
+                  for shape, offset in zip(shapes, strides[:, 0]))
+    return hists[0] if isinstance(channels, str) else hists
+
+
+HuslStats = namedtuple("HuslStats", [
+    "pixels",                 # number of pixels summarized
+    "hue_mean",               # circular mean of H, weighted by S
+    "hue_concentration",      # length of the S-weighted mean hue vector
+                              # over mean S: 1 for one hue, ~0 for many
+    "saturation_mean", "saturation_std",
+    "lightness_mean", "lightness_std",
+    "lightness_percentiles",  # approximate, one for each of `percentiles`
+])
+
+STATS_LIGHT_BINS = 1000  # resolution (0.1) of lightness percentiles
+
+
+@_selects_backend
+@transform.reshape_image_input
+@transform.reshape_rgba_input
+def husl_stats(rgb_img: ndarray, mask: ndarray = None,
+               percentiles: tuple = (5, 50, 95),
+               linear: bool = False) -> HuslStats:
+    """Summarize the HUSL values of an RGB image (see `HuslStats`)
+    without making an HSL array. Only pixels where `mask` (an array of
+    bools with the image's shape, minus the channels) is true are
+    counted. Statistics of zero pixels are NaN."""
+    if mask is not None:
+        mask = np.asarray(mask, dtype=bool)
+        if mask.shape != rgb_img.shape[:-1]:
+            raise ValueError("Expected a {} mask, got {}".format(
+                             rgb_img.shape[:-1], mask.shape))
+    sums, light_hist = _husl_stats(rgb_img, mask, STATS_LIGHT_BINS, linear)
+    return _summarize(sums, light_hist, percentiles)
+
+
+def _summarize(sums: ndarray, light_hist: ndarray,
+               percentiles: tuple) -> HuslStats:
+    n, s_cos, s_sin, s_sum, s_sq, l_sum, l_sq = (float(x) for x in sums)
+    nan = float("nan")
+    mean = lambda total: total / n if n else nan
+    std = lambda total, sq: math.sqrt(max(0.0, mean(sq) - mean(total)**2))
+    if s_sum:
+        hue_mean = math.degrees(math.atan2(s_sin, s_cos)) % 360.0
+        hue_concentration = math.hypot(s_cos, s_sin) / s_sum
+    else:
+        hue_mean = hue_concentration = nan
+    return HuslStats(
+        int(n), hue_mean, hue_concentration,
+        mean(s_sum), std(s_sum, s_sq), mean(l_sum), std(l_sum, l_sq),
+        _sketch_percentiles(light_hist, percentiles, 100.0))
+
+
+def _sketch_percentiles(hist: ndarray, percentiles: tuple,
+                        top: float) -> ndarray:
+    """Interpolate percentiles of values counted in equal bins over
+    [0, `top`]"""
+    cdf = np.concatenate(([0], np.cumsum(hist)))
+    if not cdf[-1]:
+        return np.full(len(percentiles), np.nan)
+    edges = np.linspace(0, top, len(hist) + 1)
+    targets = np.asarray(percentiles, dtype=float) / 100 * cdf[-1]
+    return np.interp(targets, cdf, edges)
+
+
+@_selects_backend
+def to_husl_from_yuv(y: ndarray, u: ndarray, v: ndarray = None,
+                     matrix: str = "bt709", range: str = "limited") -> ndarray:
+    """Convert a YUV 4:2:0 video frame to a 3D array of HSL values.
+    Pass separate `u` and `v` planes (I420), or an interleaved UV plane
+    as `u` with `v=None` (NV12). `matrix` is one of "bt601", "bt709", or
+    "bt2020", and `range` is "limited" (16-235) or "full" (0-255)."""
+    y, u, v = transform.yuv_planes(y, u, v)
+    coeffs = transform.yuv_to_rgb_coefficients(matrix, range)
+    return _yuv_to_husl(y, u, v, coeffs)
+
+
+@_selects_backend
+def to_yuv(husl_img: ndarray, matrix: str = "bt709", range: str = "limited",
+           layout: str = "i420") -> tuple:
+    """Convert a 3D HUSL array to a YUV 4:2:0 frame. Returns (Y, U, V)
+    planes for `layout="i420"` or (Y, UV) for `layout="nv12"`. Chroma is
+    the average of each 2x2 block of pixels."""
+    if layout not in ("i420", "nv12"):
+        raise ValueError("Unknown YUV layout {!r} (choose from i420, "
+                         "nv12)".format(layout))
+    kr, kb, y_offset, y_span, c_span = transform.yuv_spec(matrix, range)
+    rgb = to_rgb(husl_img).astype(np.float64)
+    if rgb.ndim != 3:
+        raise ValueError("Expected a 3D HUSL image, got shape {}".format(
+                         np.shape(husl_img)))
+    R, G, B = np.moveaxis(rgb, -1, 0)  # (`range` shadows the builtin)
+    luma = kr*R + (1 - kr - kb)*G + kb*B
+    y = y_offset + luma * (y_span / 255.0)
+
+    # average each 2x2 block (repeating the last row/column of odd frames)
+    rows, cols = luma.shape
+    pad = ((0, rows % 2), (0, cols % 2), (0, 0))
+    rgb = np.pad(rgb, pad, mode="edge") if rows % 2 or cols % 2 else rgb
+    blocks = (rgb[::2, ::2] + rgb[1::2, ::2] +
+              rgb[::2, 1::2] + rgb[1::2, 1::2]) / 4
+    R, G, B = np.moveaxis(blocks, -1, 0)
+    luma = kr*R + (1 - kr - kb)*G + kb*B
+    c_scale = c_span / 255.0
+    u = 128 + (B - luma) * (c_scale / (2 * (1 - kb)))
+    v = 128 + (R - luma) * (c_scale / (2 * (1 - kr)))
+
+    y, u, v = (np.clip(np.round(p), 0, 255).astype(np.uint8)
+               for p in (y, u, v))
+    if layout == "nv12":
+        uv = np.stack((u, v), axis=-1).reshape((u.shape[0], -1))
+        return y, uv
+    return y, u, v
 
 
 ### Optimization selection
@@ -81,24 +604,36 @@ CYTHON = {}  # cython extension fns
 SIMD = {}  # cython-wrapped C SIMD parallelization
 
 
+_IMPLEMENTATIONS = {"simd": SIMD, "cython": CYTHON, "numexpr": NUMEXPR,
+                    "numpy": NUMPY}
+
+
 def optimized(fn):
     """Decorator for functions with multiple implementations.
-    Registers the function in optimization dictionaries and chooses
-    the fastest available implementation. Alternate implementations can
-    be enabled by the user at runtime (e.g. for unit testing)."""
-    NUMPY[fn.__name__] = fn
-    expr_fn = getattr(expr, fn.__name__, None) if _NUMEXPR_ENABLED else None
-    cython_fn = getattr(cyth, fn.__name__, None) if _CYTHON_ENABLED else None
-    simd_fn = getattr(simd, fn.__name__, None) if _SIMD_ENABLED else None
-    opt_fn = simd_fn or cython_fn or expr_fn  # prefer SIMD
+    Registers the function in optimization dictionaries and returns a
+    function that calls the implementation of the calling context's
+    backend (see `use_backend`) each time, so threads and tasks can use
+    different implementations at once."""
+    name = fn.__name__
+    NUMPY[name] = fn
+    expr_fn = getattr(expr, name, None) if _NUMEXPR_ENABLED else None
+    cython_fn = getattr(cyth, name, None) if _CYTHON_ENABLED else None
+    simd_fn = getattr(simd, name, None) if _SIMD_ENABLED else None
     if simd_fn:
-        SIMD[fn.__name__] = simd_fn
+        SIMD[name] = simd_fn
     if cython_fn:
-        CYTHON[fn.__name__] = cython_fn
+        CYTHON[name] = cython_fn
     if expr_fn:
-        NUMEXPR[fn.__name__] = expr_fn
-    result_fn = opt_fn or fn
-    return result_fn
+        NUMEXPR[name] = expr_fn
+    best_fn = simd_fn or cython_fn or expr_fn or fn  # prefer SIMD
+
+    @wraps(fn)
+    def dispatch(*args, **kwargs):
+        backend = _backend.get() or _default_backend
+        if backend == "best":
+            return best_fn(*args, **kwargs)
+        return _IMPLEMENTATIONS[backend].get(name, fn)(*args, **kwargs)
+    return dispatch
 
 
 ### Conversions in the direction of RGB -> HUSL
@@ -109,27 +644,208 @@ L_MIN =  0.01
 
 @optimized
 @transform.rgb_float_input
-def _rgb_to_husl(rgb_nd: ndarray) -> ndarray:
+def _rgb_to_husl(rgb_nd: ndarray, linear: bool = False) -> ndarray:
     """Convert a float (0 <= i <= 1.0) RGB image to an `ndarray`
     of HUSL values"""
-    return _lch_to_husl(_rgb_to_lch(rgb_nd))
+    return _lch_to_husl(_rgb_to_lch(_clamp_unit(rgb_nd), linear))
+
+
+DEDUPE_SAMPLES = 4096           # pixels sampled by `dedupe="auto"`
+DEDUPE_MAX_COLORS = 1 << 16     # most colors `dedupe="auto"` converts
+DEDUPE_PIXELS_PER_COLOR = 4     # fewest pixels per color for "auto"
+
+
+def _image_to_husl(rgb: ndarray, linear: bool = False,
+                   dedupe=False, runs: bool = False, order: str = "rgb",
+                   dtype=np.float64, layout: str = "interleaved") -> ndarray:
+    """`_rgb_to_husl`, or `_gray_to_husl` for grayscale views, or
+    `_rgb_runs_to_husl` / `_rgb_dedupe_to_husl` for 8-bit RGB with long
+    runs / few colors, or `_rgb_to_husl_format` for other channel orders,
+    output types, and layouts"""
+    if transform.is_grayscale(rgb):
+        hsl = _hsl_as(_gray_to_husl(rgb[..., 0], linear), dtype)
+        return transform.to_layout(hsl, layout)
+    if (runs or dedupe) and (order != "rgb" or transform.is_rgba(rgb)):
+        rgb = transform.to_rgb_order(rgb, order)
+        order = "rgb"
+    hsl = None
+    if runs and rgb.dtype == np.uint8 and not linear:
+        hsl = _rgb_runs_to_husl(rgb)
+    elif dedupe == "auto" and rgb.dtype == np.uint8 and not linear:
+        max_colors = min(DEDUPE_MAX_COLORS,
+                         rgb.size // 3 // DEDUPE_PIXELS_PER_COLOR)
+        if transform.estimate_colors(rgb, DEDUPE_SAMPLES) <= max_colors:
+            hsl = _rgb_dedupe_to_husl(rgb, max_colors)
+    elif dedupe and rgb.dtype == np.uint8 and not linear:
+        # the color table's size follows `max_colors`, so start small
+        max_colors = DEDUPE_MAX_COLORS
+        while hsl is None:
+            hsl = _rgb_dedupe_to_husl(rgb, max_colors)
+            max_colors *= 4
+    if hsl is not None:
+        return transform.to_layout(_hsl_as(hsl, dtype), layout)
+    if order == "rgb" and rgb.shape[-1] == 3 and dtype == np.float64 and \
+            layout == "interleaved" and not transform.is_planar(rgb):
+        return _rgb_to_husl(rgb, linear)
+    return _rgb_to_husl_format(rgb, linear, order, dtype, layout)
+
+
+@optimized
+def _rgb_to_husl_format(rgb: ndarray, linear: bool = False,
+                        order: str = "rgb", dtype=np.float64,
+                        layout: str = "interleaved") -> ndarray:
+    """`_rgb_to_husl` of RGB or BGR, with or without alpha, as `dtype` HSL
+    in `layout`"""
+    hsl = _rgb_to_husl(transform.to_rgb_order(rgb, order), linear)
+    hsl = _hsl_as(hsl.reshape(rgb.shape[:-1] + (3,)), dtype)
+    return transform.to_layout(hsl, layout)
+
+
+def _image_to_hue(rgb: ndarray, linear: bool = False) -> ndarray:
+    if transform.is_grayscale(rgb):
+        return _channel(_gray_to_husl(rgb[..., 0], linear), 0)
+    return _rgb_to_hue(rgb, linear)
+
+
+def _image_to_lightness(rgb: ndarray, linear: bool = False) -> ndarray:
+    if transform.is_grayscale(rgb):
+        return _gray_to_lightness(rgb[..., 0], linear)
+    return _rgb_to_lightness(rgb, linear)
 
 
-def _rgb_to_lch(rgb: ndarray) -> ndarray:
-    return _luv_to_lch(_xyz_to_luv(_rgb_to_xyz(rgb)))
+@optimized
+@transform.rgb_float_input
+def _gray_to_lightness(gray: ndarray, linear: bool = False) -> ndarray:
+    """HUSL lightness of a float grayscale image. A gray's luminance
+    is its linear value, since the rows of M_INV's Y sum to 1."""
+    gray = _clamp_unit(gray)
+    return _to_light(gray if linear else _to_linear(gray))
+
+
+@optimized
+def _gray_to_husl(gray: ndarray, linear: bool = False) -> ndarray:
+    """HUSL of a grayscale image: (hue of white, 0, lightness)"""
+    light = _gray_to_lightness(gray, linear)
+    hsl = np.zeros(light.shape + (3,), dtype=np.float64)
+    hsl[..., 0] = np.where(light > 0, constants.WHITE_HUE, 0.0)
+    hsl[..., 2] = light
+    return hsl
 
 
 @optimized
 @transform.rgb_float_input
-def _rgb_to_hue(rgb: ndarray) -> ndarray:
+def _rgb_to_lightness(rgb: ndarray, linear: bool = False) -> ndarray:
+    y = _channel(_rgb_to_xyz(_clamp_unit(rgb), linear), 1)
+    return _to_light(y).reshape(rgb.shape[:-1])
+
+
+@optimized
+def _rgb_dedupe_to_husl(rgb: ndarray, max_colors: int) -> ndarray:
+    """Convert 8-bit RGB to HUSL by converting each distinct color once.
+    Returns None if there are more than `max_colors` colors."""
+    indices, palette = transform.to_palette(rgb)
+    if len(palette) > max_colors:
+        return None
+    return _rgb_to_husl(palette).reshape((-1, 3))[indices]
+
+
+@optimized
+def _rgb_runs_to_husl(rgb: ndarray) -> ndarray:
+    """Convert 8-bit RGB to HUSL by converting each horizontal run of
+    identical pixels once"""
+    rows = rgb.reshape((-1, rgb.shape[-2] if rgb.ndim > 2 else len(rgb), 3))
+    starts = np.ones(rows.shape[:2], dtype=bool)
+    starts[:, 1:] = np.any(rows[:, 1:] != rows[:, :-1], axis=-1)
+    heads = np.flatnonzero(starts)
+    lengths = np.diff(np.append(heads, starts.size))
+    flat = rows.reshape((-1, 3))
+    hsl = _rgb_to_husl(flat[heads]).reshape((-1, 3))
+    return np.repeat(hsl, lengths, axis=0).reshape(rgb.shape)
+
+
+@optimized
+def _gather_palette(palette: ndarray, indices: ndarray) -> ndarray:
+    """Look up the rows of an (n, channels) `palette` for each index"""
+    indices = np.asarray(indices)
+    if indices.dtype.kind not in "iu":
+        raise TypeError("Expected integer indices, got {}".format(
+                        indices.dtype))
+    if indices.size and (indices.min() < 0 or indices.max() >= len(palette)):
+        raise IndexError("Indices out of range for a palette of {} "
+                         "entries".format(len(palette)))
+    return np.take(palette, indices, axis=0)
+
+
+@optimized
+def _rgb_to_husl_out(rgb_nd: ndarray, out: ndarray) -> ndarray:
+    """Convert an RGB image to HUSL and place the result in `out`"""
+    out[...] = _rgb_to_husl(rgb_nd)
+    return out
+
+
+@optimized
+def _yuv_to_husl(y: ndarray, u: ndarray, v: ndarray,
+                 coeffs: ndarray) -> ndarray:
+    y_offset, y_scale, r_v, g_u, g_v, b_u = coeffs.astype(np.int64)
+    rows, cols = y.shape
+    upsample = lambda c: np.repeat(np.repeat(c, 2, 0), 2, 1)[:rows, :cols]
+    cb = upsample(u).astype(np.int64) - 128
+    cr = upsample(v).astype(np.int64) - 128
+    luma = y_scale * (y.astype(np.int64) - y_offset)
+    rgb = np.empty((rows, cols, 3), dtype=np.int64)
+    R, G, B = (_channel(rgb, n) for n in range(3))
+    R[:] = luma + r_v*cr
+    G[:] = luma + g_u*cb + g_v*cr
+    B[:] = luma + b_u*cb
+    bits = transform.YUV_FRACTION_BITS
+    rgb = (rgb + (1 << (bits - 1))) >> bits  # fixed point to integer
+    return _rgb_to_husl(np.clip(rgb, 0, 255).astype(np.uint8))
+
+
+@optimized
+def _husl_histogram(rgb: ndarray, bins: ndarray, strides: ndarray,
+                    size: int, linear: bool = False) -> ndarray:
+    """Count HUSL values of RGB into the flat histograms described by
+    `strides` (see `transform.histogram_layout`)"""
+    hsl = _rgb_to_husl(rgb, linear).reshape((-1, 3))
+    scale = bins / np.asarray(transform.HUSL_MAX)
+    index = np.clip((hsl * scale).astype(np.int64), 0, bins - 1)
+    flat = strides[:, 0] + index @ strides[:, 1:].T
+    return np.bincount(flat.ravel(), minlength=size).astype(np.int64)
+
+
+@optimized
+def _husl_stats(rgb: ndarray, mask: ndarray, light_bins: int,
+                linear: bool = False) -> tuple:
+    """Return the sums and lightness sketch summarized by `husl_stats`:
+    ([n, sum(S*cos(H)), sum(S*sin(H)), sum(S), sum(S^2), sum(L), sum(L^2)],
+    counts of L in `light_bins` equal bins over [0, 100])"""
+    hsl = _rgb_to_husl(rgb, linear).reshape((-1, 3))
+    if mask is not None:
+        hsl = hsl[mask.ravel()]
+    H, S, L = np.radians(hsl[:, 0]), hsl[:, 1], hsl[:, 2]
+    sums = np.asarray([len(hsl), (S * np.cos(H)).sum(), (S * np.sin(H)).sum(),
+                       S.sum(), (S * S).sum(), L.sum(), (L * L).sum()])
+    bins = np.clip((L * (light_bins / 100.0)).astype(np.int64),
+                   0, light_bins - 1)
+    return sums, np.bincount(bins, minlength=light_bins).astype(np.int64)
+
+
+def _rgb_to_lch(rgb: ndarray, linear: bool = False) -> ndarray:
+    return _luv_to_lch(_xyz_to_luv(_rgb_to_xyz(rgb, linear)))
+
+
+@optimized
+@transform.rgb_float_input
+def _rgb_to_hue(rgb: ndarray, linear: bool = False) -> ndarray:
     """Convenience function to return JUST the HUSL hue values
     for a given RGB image"""
-    hsl = _rgb_to_husl(rgb)
+    hsl = _rgb_to_husl(rgb, linear)
     return _channel(hsl, 0)
 
 
-def _rgb_to_xyz(rgb_nd: ndarray) -> ndarray:
-    rgbl = _to_linear(rgb_nd)
+def _rgb_to_xyz(rgb_nd: ndarray, linear: bool = False) -> ndarray:
+    rgbl = rgb_nd if linear else _to_linear(rgb_nd)
     return _dot_product(constants.M_INV, rgbl)
 
 
@@ -275,6 +991,11 @@ def _to_light(y_nd: ndarray) -> ndarray:
     return f_flat.reshape(y_nd.shape)
 
 
+def _clamp_unit(rgb_nd: ndarray) -> ndarray:
+    """Clamp float RGB to [0, 1], with NaN as 0 (like the C kernels)"""
+    return np.where(rgb_nd > 0.0, np.minimum(rgb_nd, 1.0), 0.0)
+
+
 @optimized
 @transform.rgb_float_input
 def _to_linear(rgb_nd: ndarray) -> ndarray:
@@ -293,7 +1014,7 @@ def _dot_product(scalars: list, rgb_nd: ndarray) -> ndarray:
     x = np.sum(scalars[0] * rgb_nd, sum_axis)
     y = np.sum(scalars[1] * rgb_nd, sum_axis)
     z = np.sum(scalars[2] * rgb_nd, sum_axis)
-    return np.dstack((x, y, z)).squeeze()
+    return np.stack((x, y, z), axis=-1)
 
 
 def _channel(data: ndarray, last_dim_idx) -> ndarray:
@@ -391,3 +1112,93 @@ def _from_light(l_nd: ndarray) -> ndarray:
     out[small] = constants.REF_Y * l_nd[small] / constants.KAPPA
     return out.reshape(l_nd.shape)
 
+
+
+### Quantized HSL (16-bit output, and the tiled HUSL file format in
+### `tiled.py`)
+
+HSL_MAX = np.asarray([360.0, 100.0, 100.0])
+
+
+def _hsl_as(hsl_nd: ndarray, dtype) -> ndarray:
+    """HSL doubles as `dtype`: floats as they are, uint16 as fixed point
+    (rounded like the C kernel's to_fixed16)"""
+    if dtype == np.uint16:
+        return np.floor(np.clip(hsl_nd * (65535 / HSL_MAX) + 0.5,
+                                0, 65535)).astype(np.uint16)
+    return hsl_nd.astype(dtype, copy=False)
+
+
+def from_fixed16(hsl_nd: ndarray) -> ndarray:
+    """HSL doubles of 16-bit fixed point HSL, from
+    `to_husl(..., dtype=np.uint16)`"""
+    return hsl_nd * (HSL_MAX / 65535)
+
+
+@optimized
+def _quantize_tiles(hsl_nd: ndarray, tile: int, bits: int) -> ndarray:
+    """Quantize a 3D HSL image to `bits`-bit ints, laid out tile by tile
+    with separate H, S, and L planes in each tile"""
+    top = (1 << bits) - 1
+    quantized = np.floor(np.clip(hsl_nd * (top / HSL_MAX) + 0.5, 0, top))
+    quantized = quantized.astype(_tile_dtype(bits))
+    planes = [np.moveaxis(quantized[r0: r1, c0: c1], -1, 0).ravel()
+              for r0, r1, c0, c1 in _tile_bounds(hsl_nd.shape, tile)]
+    return np.concatenate(planes) if planes else quantized.ravel()
+
+
+@optimized
+def _dequantize_tiles(tiles: ndarray, shape: tuple, tile: int,
+                      bits: int) -> ndarray:
+    """Expand the output of `_quantize_tiles` back into an HSL image"""
+    hsl_nd = np.empty(tuple(shape[:2]) + (3,), dtype=np.float64)
+    scale = HSL_MAX / ((1 << bits) - 1)
+    offset = 0
+    for r0, r1, c0, c1 in _tile_bounds(shape, tile):
+        size = (r1 - r0) * (c1 - c0) * 3
+        planes = tiles[offset: offset + size].reshape((3, r1-r0, c1-c0))
+        hsl_nd[r0: r1, c0: c1] = np.moveaxis(planes, 0, -1) * scale
+        offset += size
+    return hsl_nd
+
+
+@optimized
+def _diff_tiles(prev: ndarray, frame: ndarray, tile: int,
+                dirty: ndarray) -> int:
+    """Flag the tiles of `frame` that differ from `prev` in the bool array
+    `dirty` (one per tile, row-major) and copy them into `prev`. Returns
+    the number of dirty tiles."""
+    flat = dirty.reshape(-1)
+    for t, (r0, r1, c0, c1) in enumerate(_tile_bounds(frame.shape, tile)):
+        flat[t] = not np.array_equal(prev[r0: r1, c0: c1],
+                                     frame[r0: r1, c0: c1])
+        if flat[t]:
+            prev[r0: r1, c0: c1] = frame[r0: r1, c0: c1]
+    return int(flat.sum())
+
+
+@optimized
+def _rgb_tiles_to_husl(rgb: ndarray, tile: int, dirty: ndarray,
+                       hsl: ndarray, linear: bool = False) -> ndarray:
+    """Convert the `dirty` tiles of an RGB image into the same pixels
+    of the HSL image `hsl`"""
+    bounds = _tile_bounds(rgb.shape, tile)
+    for (r0, r1, c0, c1), is_dirty in zip(bounds, dirty.reshape(-1)):
+        if is_dirty:
+            hsl[r0: r1, c0: c1] = _rgb_to_husl(rgb[r0: r1, c0: c1], linear)
+    return hsl
+
+
+def _tile_bounds(shape: tuple, tile: int) -> list:
+    """Return (row_start, row_end, col_start, col_end) for each tile
+    of an image, in row-major tile order"""
+    rows, cols = shape[:2]
+    return [(r0, r1, c0, c1)
+            for r0, r1 in transform.chunk(rows, tile)
+            for c0, c1 in transform.chunk(cols, tile)]
+
+
+def _tile_dtype(bits: int):
+    if bits not in (8, 16):
+        raise ValueError("Tiles hold 8 or 16-bit ints, not {}".format(bits))
+    return np.uint8 if bits == 8 else np.uint16
@@ -0,0 +1,161 @@
+"""
+Out-of-core HUSL conversion for images that are bigger than RAM.
+Found in this module:
+
+1. `convert_file`: converts a raw or `.npy` image file into a new file
+2. `convert_memmap`: converts between two (usually `np.memmap`) arrays
+
+The input and output are memory mapped and converted in bands of rows,
+so the resident working set, counting the conversion's temporaries,
+stays near `max_memory` bytes no matter how big the image is. Each band goes straight through the conversion
+kernel, which writes into the memory-mapped output. The OS is told to
+expect sequential reads (`MADV_SEQUENTIAL`), the next band is prefetched
+(`MADV_WILLNEED`), and finished bands are flushed and dropped
+(`MADV_DONTNEED`) so that mapped pages don't pile up.
+"""
+
+import mmap
+
+import numpy as np
+
+from numpy import ndarray
+from . import nphusl
+from . import transform
+
+
+DEFAULT_MAX_MEMORY = 64 * 1024 * 1024  # bytes per band, all told
+
+# conversion name -> (output has a channel axis, output dtype)
+CONVERSIONS = {
+    "husl": (True, np.float64),
+    "hue": (False, np.float64),
+    "rgb": (True, np.uint8),
+}
+
+# conversion name -> API function, for nphusl.PEAK_BYTES_PER_PIXEL
+FUNCTIONS = {"husl": "to_husl", "hue": "to_hue", "rgb": "to_rgb"}
+
+_SEQUENTIAL = getattr(mmap, "MADV_SEQUENTIAL", None)
+_WILLNEED = getattr(mmap, "MADV_WILLNEED", None)
+_DONTNEED = getattr(mmap, "MADV_DONTNEED", None)
+
+
+@nphusl._selects_backend
+def convert_file(in_path: str, out_path: str, shape: tuple = None,
+                 dtype=np.uint8, conversion: str = "husl",
+                 max_memory: int = DEFAULT_MAX_MEMORY,
+                 offset: int = 0) -> ndarray:
+    """Convert the image in `in_path` and write the result to `out_path`.
+    Files ending in `.npy` are read and written with NumPy headers. Other
+    files are raw C-ordered data; a raw input needs its `shape` (e.g.
+    `(rows, cols, 3)`), its `dtype`, and optionally a header `offset`.
+    Returns the memory-mapped output array."""
+    src = _open_input(in_path, shape, dtype, offset)
+    out_shape, out_dtype = output_spec(src.shape, conversion)
+    out = _open_output(out_path, out_shape, out_dtype)
+    convert_memmap(src, out, conversion, max_memory)
+    return out
+
+
+@nphusl._selects_backend
+def convert_memmap(src: ndarray, out: ndarray, conversion: str = "husl",
+                   max_memory: int = DEFAULT_MAX_MEMORY) -> ndarray:
+    """Convert `src` into `out` one band of rows at a time. Both arrays
+    are typically `np.memmap` instances; ordinary arrays work too,
+    but then there are no pages to advise or drop."""
+    out_shape, _ = output_spec(src.shape, conversion)
+    if out.shape != out_shape:
+        raise ValueError("Expected output shape {}, got {}".format(
+                         out_shape, out.shape))
+    rows = src.shape[0]
+    row_bytes = band_bytes(src, out, conversion) // max(1, rows)
+    band_rows = max(1, max_memory // max(1, row_bytes))
+    bands = list(transform.chunk(rows, band_rows))
+    _madvise(src, _SEQUENTIAL)
+    for i, (start, end) in enumerate(bands):
+        if i + 1 < len(bands):
+            next_start, next_end = bands[i + 1]
+            _madvise(src[next_start: next_end], _WILLNEED)
+        src_band, out_band = src[start: end], out[start: end]
+        _convert_band(conversion, src_band, out_band)
+        _flush(out_band)
+        _madvise(out_band, _DONTNEED)
+        _madvise(src_band, _DONTNEED)
+    return out
+
+
+def band_bytes(src: ndarray, out: ndarray, conversion: str) -> int:
+    """Peak bytes of converting all of `src` into `out` at once: the
+    mapped input and output, plus the conversion's temporaries (see
+    `nphusl.PEAK_BYTES_PER_PIXEL`)"""
+    pixels = src.size // 3
+    return (src.nbytes + out.nbytes +
+            pixels * nphusl.PEAK_BYTES_PER_PIXEL[FUNCTIONS[conversion]])
+
+
+def output_spec(shape: tuple, conversion: str) -> tuple:
+    """Return the (shape, dtype) of the output for `conversion` of an
+    input array with `shape`"""
+    if conversion not in CONVERSIONS:
+        raise ValueError("Unknown conversion {!r} (choose from {})".format(
+                         conversion, ", ".join(sorted(CONVERSIONS))))
+    if len(shape) < 2 or shape[-1] != 3:
+        raise ValueError("Expected an array of triplets, got shape "
+                         "{}".format(shape))
+    has_channels, dtype = CONVERSIONS[conversion]
+    out_shape = tuple(shape) if has_channels else tuple(shape[:-1])
+    return out_shape, dtype
+
+
+def _convert_band(conversion: str, src: ndarray, out: ndarray) -> None:
+    if conversion == "husl":
+        nphusl._rgb_to_husl_out(src, out)
+    elif conversion == "hue":
+        out[...] = nphusl.to_hue(src)
+    else:
+        out[...] = nphusl.to_rgb(src)
+
+
+def _open_input(path: str, shape: tuple, dtype, offset: int) -> ndarray:
+    if path.endswith(".npy"):
+        return np.load(path, mmap_mode="r")
+    if shape is None:
+        raise ValueError("`shape` is required for raw input files")
+    return np.memmap(path, dtype=dtype, mode="r",
+                     shape=tuple(shape), offset=offset)
+
+
+def _open_output(path: str, shape: tuple, dtype) -> ndarray:
+    if path.endswith(".npy"):
+        return np.lib.format.open_memmap(
+            path, mode="w+", dtype=dtype, shape=shape)
+    return np.memmap(path, dtype=dtype, mode="w+", shape=shape)
+
+
+### Helpers for managing the pages behind a memory-mapped array
+
+def _page_range(arr: ndarray):
+    """Find the `mmap` behind `arr` and the page-aligned byte range that
+    `arr` occupies in it. Returns `None` for arrays that aren't mapped."""
+    mm = getattr(arr, "_mmap", None)
+    if mm is None or not arr.size:
+        return None
+    base = np.frombuffer(mm, dtype=np.uint8).ctypes.data
+    start = arr.ctypes.data - base
+    aligned = start - start % mmap.PAGESIZE
+    end = min(start + arr.nbytes, len(mm))
+    return mm, aligned, end - aligned
+
+
+def _madvise(arr: ndarray, advice) -> None:
+    page_range = _page_range(arr) if advice is not None else None
+    if page_range:
+        mm, start, length = page_range
+        mm.madvise(advice, start, length)
+
+
+def _flush(arr: ndarray) -> None:
+    page_range = _page_range(arr)
+    if page_range:
+        mm, start, length = page_range
+        mm.flush(start, length)
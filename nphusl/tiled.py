@@ -0,0 +1,208 @@
+"""
+A compact, tiled file format for caching HUSL images. Found in this module:
+
+1. `save`: quantizes an HSL image and writes it to a tiled HUSL file
+2. `load`: reads a whole tiled HUSL file back into an HSL array
+3. `TiledFile`: random access to the tiles and regions of a file
+
+A float64 HSL array costs 24 bytes per pixel. A tiled HUSL file stores
+H, S, and L as 16-bit ints (6 bytes per pixel, well below the visible
+error) or 8-bit ints (3 bytes per pixel). Each tile can also be
+compressed. Quantization and expansion run in parallel C kernels, and
+tiles are compressed and decompressed on a thread pool.
+
+File layout (all integers little-endian):
+
+    offset  size  field
+    0       8     magic, b"NPHUSLT\\0"
+    8       2     format version (1)
+    10      1     bits per value: 8 or 16
+    11      1     codec: 0 = none, 1 = zlib
+    12      4     image rows
+    16      4     image columns
+    20      4     tile size (tiles are square, clipped at the edges)
+    24      8     reserved (zero)
+    32      16*N  tile index: (u64 file offset, u64 byte length) for each
+                  of the N tiles, in row-major tile order
+    ...           tile data
+
+A tile covers `tile_rows x tile_cols` pixels and decodes to three planes
+(H, then S, then L) of `tile_rows * tile_cols` values each. Quantized
+values map linearly onto H in [0, 360] and S, L in [0, 100]:
+`value = q * max / (2**bits - 1)`.
+"""
+
+import os
+import struct
+import zlib
+
+from concurrent.futures import ThreadPoolExecutor
+
+import numpy as np
+
+from numpy import ndarray
+from . import nphusl
+
+
+MAGIC = b"NPHUSLT\0"
+VERSION = 1
+HEADER = struct.Struct("<8sHBBIII8x")
+INDEX_DTYPE = np.dtype([("offset", "<u8"), ("length", "<u8")])
+CODECS = {"none": 0, "zlib": 1}
+
+
+def save(path: str, hsl: ndarray, bits: int = 16, tile: int = 256,
+         codec: str = "zlib", level: int = 1, jobs: int = None) -> None:
+    """Write the 3D HSL array `hsl` to a tiled HUSL file at `path`.
+    `level` is the zlib compression level (1 is fastest)."""
+    if hsl.ndim != 3 or hsl.shape[-1] != 3:
+        raise ValueError("Expected a 3D HSL image, got shape {}".format(
+                         hsl.shape))
+    if codec not in CODECS:
+        raise ValueError("Unknown codec {!r} (choose from {})".format(
+                         codec, ", ".join(sorted(CODECS))))
+    rows, cols = hsl.shape[:2]
+    tiles = nphusl._quantize_tiles(hsl, tile, bits)
+    spans = _tile_spans(hsl.shape, tile)
+
+    def encode(span):
+        raw = tiles[span[0]: span[1]].astype("<u{}".format(bits // 8))
+        return zlib.compress(raw, level) if codec == "zlib" else raw
+
+    with ThreadPoolExecutor(jobs or os.cpu_count()) as pool:
+        blobs = list(pool.map(encode, spans))
+    index = np.zeros(len(blobs), dtype=INDEX_DTYPE)
+    index["length"] = [len(memoryview(b).cast("B")) for b in blobs]
+    index["offset"] = HEADER.size + index.nbytes + np.concatenate(
+        ([0], np.cumsum(index["length"])[:-1])).astype(np.uint64)
+    with open(path, "wb") as f:
+        f.write(HEADER.pack(MAGIC, VERSION, bits, CODECS[codec],
+                            rows, cols, tile))
+        f.write(index.tobytes())
+        for blob in blobs:
+            f.write(blob)
+
+
+def load(path: str, jobs: int = None) -> ndarray:
+    """Read a whole tiled HUSL file into a 3D float64 HSL array"""
+    with TiledFile(path) as tiled:
+        return tiled.read(jobs=jobs)
+
+
+class TiledFile:
+    """A memory-mapped tiled HUSL file. Use `read` to decode a region
+    and `read_tile` to decode a single tile; only the tiles that overlap
+    the requested region are touched."""
+
+    def __init__(self, path: str):
+        self.path = path
+        if os.path.getsize(path) < HEADER.size:
+            raise ValueError("{} is too short for a tiled HUSL file".format(
+                             path))
+        self._data = np.memmap(path, dtype=np.uint8, mode="r")
+        (magic, version, self.bits, codec,
+         rows, cols, self.tile) = HEADER.unpack_from(self._data)
+        if magic != MAGIC or version != VERSION:
+            raise ValueError("{} isn't a tiled HUSL file (version {})".format(
+                             path, VERSION))
+        codecs = {v: k for k, v in CODECS.items()}
+        if codec not in codecs or self.bits not in (8, 16) or not self.tile:
+            raise ValueError("{} has a corrupt header (codec {}, {} bits, "
+                             "tile {})".format(path, codec, self.bits,
+                                               self.tile))
+        self.codec = codecs[codec]
+        self.shape = (rows, cols, 3)
+        self.tiles_shape = (-(-rows // self.tile), -(-cols // self.tile))
+        n_tiles = self.tiles_shape[0] * self.tiles_shape[1]
+        if HEADER.size + n_tiles * INDEX_DTYPE.itemsize > len(self._data):
+            raise ValueError("{} is truncated: its tile index is cut "
+                             "short".format(path))
+        self.index = np.frombuffer(self._data, dtype=INDEX_DTYPE,
+                                   count=n_tiles, offset=HEADER.size)
+        ends = self.index["offset"] + self.index["length"]
+        if np.any(ends < self.index["offset"]) or \
+                np.any(ends > len(self._data)):
+            raise ValueError("{} is truncated: tile data runs past the end "
+                             "of the file".format(path))
+
+    def read(self, rows: slice = slice(None), cols: slice = slice(None),
+             jobs: int = None) -> ndarray:
+        """Decode the region `[rows, cols]` of the image"""
+        if rows.step not in (None, 1) or cols.step not in (None, 1):
+            # decode the rows and columns spanned, then step through them
+            ys = range(*rows.indices(self.shape[0]))
+            xs = range(*cols.indices(self.shape[1]))
+            if not ys or not xs:
+                return np.empty((len(ys), len(xs), 3))
+            y0, x0 = min(ys), min(xs)
+            region = self.read(slice(y0, max(ys) + 1),
+                               slice(x0, max(xs) + 1), jobs)
+            return region[ys[0] - y0:: ys.step, xs[0] - x0:: xs.step]
+        r0, r1, _ = rows.indices(self.shape[0])
+        c0, c1, _ = cols.indices(self.shape[1])
+        if r1 <= r0 or c1 <= c0:
+            return np.empty((max(0, r1 - r0), max(0, c1 - c0), 3))
+        tile = self.tile
+        ty0, tx0 = r0 // tile, c0 // tile
+        ty1, tx1 = -(-r1 // tile), -(-c1 // tile)
+
+        # the tiles covering the region, in order, form a smaller image
+        # with the same tile layout
+        sub_shape = (min(ty1 * tile, self.shape[0]) - ty0 * tile,
+                     min(tx1 * tile, self.shape[1]) - tx0 * tile, 3)
+        numbers = [ty * self.tiles_shape[1] + tx
+                   for ty in range(ty0, ty1) for tx in range(tx0, tx1)]
+        spans = _tile_spans(sub_shape, tile)
+        tiles = np.empty(sub_shape[0] * sub_shape[1] * 3,
+                         dtype=nphusl._tile_dtype(self.bits))
+
+        def decode(number_span):
+            number, (start, end) = number_span
+            values = self._decode(number)
+            if values.size != end - start:
+                raise ValueError("{}: tile {} has {} values, expected "
+                                 "{}".format(self.path, number, values.size,
+                                             end - start))
+            tiles[start: end] = values
+
+        with ThreadPoolExecutor(jobs or os.cpu_count()) as pool:
+            list(pool.map(decode, zip(numbers, spans)))
+        hsl = nphusl._dequantize_tiles(tiles, sub_shape, tile, self.bits)
+        return hsl[r0 - ty0*tile: r1 - ty0*tile, c0 - tx0*tile: c1 - tx0*tile]
+
+    def read_tile(self, tile_y: int, tile_x: int) -> ndarray:
+        """Decode the tile in row `tile_y` and column `tile_x` of tiles"""
+        if not (0 <= tile_y < self.tiles_shape[0] and
+                0 <= tile_x < self.tiles_shape[1]):
+            raise IndexError("No tile at ({}, {})".format(tile_y, tile_x))
+        r0, c0 = tile_y * self.tile, tile_x * self.tile
+        return self.read(slice(r0, r0 + self.tile), slice(c0, c0 + self.tile))
+
+    def _decode(self, number: int) -> ndarray:
+        offset = int(self.index["offset"][number])
+        length = int(self.index["length"][number])
+        blob = self._data[offset: offset + length]
+        try:
+            raw = zlib.decompress(blob) if self.codec == "zlib" else blob
+        except zlib.error as e:
+            raise ValueError("{}: tile {} is corrupt ({})".format(
+                             self.path, number, e))
+        return np.frombuffer(raw, dtype="<u{}".format(self.bits // 8))
+
+    def close(self) -> None:
+        self._data = self.index = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc_info):
+        self.close()
+
+
+def _tile_spans(shape: tuple, tile: int) -> list:
+    """Return the (start, end) of each tile's values in the flat array
+    of quantized tiles"""
+    sizes = [(r1 - r0) * (c1 - c0) * 3
+             for r0, r1, c0, c1 in nphusl._tile_bounds(shape, tile)]
+    ends = np.cumsum(sizes, dtype=np.int64)
+    return list(zip((ends - sizes).tolist(), ends.tolist()))
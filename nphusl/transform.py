@@ -9,6 +9,8 @@ from enum import Enum
 import numpy as np
 from numpy import ndarray
 
+from . import constants
+
 
 type_tuple = namedtuple("type_tuple", "base exact convert exact_required")
 
@@ -27,14 +29,31 @@ def to_rgb_float(dtype, arr: ndarray):
     return to_dtype(dtype, arr)
 
 
-def scale_up_rgb(rgb: ndarray):
-    """Convert RGB up to [0, 255] range"""
-    return np.round(rgb*255.0)
+def scale_up_rgb(rgb: ndarray, dtype=np.uint8):
+    """Convert RGB up to [0, 255] range ([0, 65535] for uint16)"""
+    return np.round(rgb*rgb_max(dtype))
 
 
 def scale_down_rgb(rgb: ndarray):
     """Convert RGB down to [0, 1] range"""
-    return rgb/255.0
+    return rgb/rgb_max(rgb.dtype)
+
+
+def rgb_max(dtype) -> float:
+    """Full intensity of RGB ints of `dtype`. uint16 RGB is 16-bit
+    (scale 10 and 12-bit samples up to 16 bits); other ints are 8-bit."""
+    return 65535.0 if np.dtype(dtype) == np.uint16 else 255.0
+
+
+def to_rgb_dtype(arr: ndarray, dtype=np.uint8) -> ndarray:
+    """Convert float RGB in [0, 1] to uint8 or uint16 RGB ints"""
+    dtype = np.dtype(dtype)
+    if dtype not in (np.uint8, np.uint16):
+        raise ValueError("RGB output must be uint8 or uint16, not "
+                         "{}".format(dtype))
+    if not np.issubdtype(arr.dtype, np.integer):
+        arr = scale_up_rgb(arr, dtype)
+    return np.abs(arr).astype(dtype)
 
 
 def to_dtype(dtype, arr: ndarray):
@@ -42,9 +61,9 @@ def to_dtype(dtype, arr: ndarray):
 
 
 _int_type = type_tuple(np.integer, np.int64, to_dtype, False)
-_float_type = type_tuple(np.float, np.float64, to_dtype, False)
+_float_type = type_tuple(np.floating, np.float64, to_dtype, False)
 _rgb_int_type = type_tuple(np.integer, np.uint8, to_rgb_int, True)
-_rgb_float_type = type_tuple(np.float, np.float64, to_rgb_float, True)
+_rgb_float_type = type_tuple(np.floating, np.float64, to_rgb_float, True)
 
 
 class Dtype(type_tuple, Enum):
@@ -86,6 +105,24 @@ rgb_int_input = ensure_input_dtype(Dtype.rgb_int)
 rgb_float_input = ensure_input_dtype(Dtype.rgb_float)
 
 
+def ensure_rgb_uint(arr: ndarray) -> ndarray:
+    """Like `ensure_rgb_int`, but 16-bit (uint16) RGB is passed through
+    unchanged instead of being truncated to uint8"""
+    return arr if arr.dtype == np.uint16 else ensure_rgb_int(arr)
+
+
+def ensure_rgb_native(arr: ndarray, linear: bool = False) -> ndarray:
+    """Prepare RGB for the C kernels without losing precision: uint16,
+    float32, and float64 RGB are passed through, and other ints become
+    uint8. Linear RGB is always float, so ints are scaled down to [0, 1]
+    if `linear` is set."""
+    if arr.dtype in (np.float32, np.float64):
+        return arr
+    if linear or np.issubdtype(arr.dtype, np.floating):
+        return ensure_rgb_float(arr)
+    return ensure_rgb_uint(arr)
+
+
 def ensure_output_dtype(dtype: Dtype):
     """Like `ensure_rgb_input_dtype`, but this decorator ensures
     that the *output* of a function has a specific dtype"""
@@ -168,7 +205,7 @@ def reshape_image_input(fn):
         elif arr.ndim == 2 and channels not in (3, 4):
             # Semi-flat inputs not handled, so [[r,g,b,r,g,b...],...] won't be
             # reshaped. What kind of monster would send in RGB data that way??
-            if np.issubdtype(arr.dtype, np.float):
+            if np.issubdtype(arr.dtype, np.number):
                 _alert_gray("Assuming 2D grayscale")
                 arr = from_grayscale(arr)
             else:
@@ -208,29 +245,85 @@ def reshape_husl_input(fn):
 
 
 def from_grayscale(img):
-    """Broadcast single-channel grayscale into the three channels
-    of a new RGB array"""
-    rgb = np.empty(shape=img.shape + (3,), dtype=img.dtype)
-    rgb[:] = img[..., None]
-    return rgb
+    """Broadcast single-channel grayscale into three RGB channels. The
+    result is a read-only view of `img` (see `is_grayscale`), so no
+    three-channel copy is made."""
+    return np.broadcast_to(img[..., None], img.shape + (3,))
+
+
+def is_grayscale(rgb: ndarray) -> bool:
+    """True if `rgb` is a `from_grayscale` view, whose three channels are
+    one gray channel (`rgb[..., 0]`)"""
+    return rgb.ndim > 1 and rgb.shape[-1] == 3 and rgb.strides[-1] == 0
+
+
+def from_planes(planes: ndarray) -> ndarray:
+    """View channel-first planes, e.g. (3, rows, cols), as a channels-last
+    image, e.g. (rows, cols, 3). The view is read where the planes are
+    (see `is_planar`), so no interleaved copy is made."""
+    return np.moveaxis(planes, 0, -1)
+
+
+def is_planar(img: ndarray) -> bool:
+    """True if `img` is a `from_planes` view of contiguous planes, so each
+    channel (`img[..., k]`) is contiguous"""
+    return img.ndim > 1 and img.shape[-1] in (3, 4) and \
+        not img.flags.c_contiguous and \
+        np.moveaxis(img, -1, 0).flags.c_contiguous
+
+
+def to_layout(hsl: ndarray, layout: str = "interleaved") -> ndarray:
+    """`hsl` as a `from_planes` view of H, S, and L planes if `layout` is
+    "planar", or else as it is"""
+    if layout == "planar" and not is_planar(hsl):
+        return from_planes(np.ascontiguousarray(np.moveaxis(hsl, -1, 0)))
+    return hsl
 
 
 def reshape_rgba_input(fn):
     """Decorator for handling 4-channel RGBA images"""
     @wraps(fn)
     def wrapped(arr: ndarray, *args, **kwargs):
-        if arr.ndim in (2, 3) and arr.shape[-1] == 4:
+        if is_rgba(arr):
             _alert_rgba("Assumed RGBA with white background")
-            isint = np.issubdtype(arr.dtype, np.integer)
-            rgb = arr[..., :3]
-            a = arr[..., 3]
-            ratio = a / 255.0 if isint else a
-            arr = rgb * ratio[..., None]  # 3D float RGB
-            arr = np.round(arr).astype(arr.dtype) if isint else arr
+            arr = composite_rgba(arr)
         return fn(arr, *args, **kwargs)
     return wrapped
 
 
+def alert_rgba_input(fn):
+    """Like `reshape_rgba_input`, but 4-channel images are passed on for
+    `fn` to composite (e.g. in a C kernel)"""
+    @wraps(fn)
+    def wrapped(arr: ndarray, *args, **kwargs):
+        if is_rgba(arr):
+            _alert_rgba("Assumed RGBA with white background")
+        return fn(arr, *args, **kwargs)
+    return wrapped
+
+
+def is_rgba(arr: ndarray) -> bool:
+    return arr.ndim in (2, 3) and arr.shape[-1] == 4
+
+
+def composite_rgba(arr: ndarray) -> ndarray:
+    """RGB of an RGBA image, weighted by alpha"""
+    isint = np.issubdtype(arr.dtype, np.integer)
+    rgb = arr[..., :3]
+    a = arr[..., 3]
+    ratio = a / rgb_max(arr.dtype) if isint else a
+    weighted = rgb * ratio[..., None]  # 3D float RGB
+    return np.round(weighted).astype(arr.dtype) if isint else weighted
+
+
+def to_rgb_order(arr: ndarray, order: str = "rgb") -> ndarray:
+    """RGB of an image in channel `order` ("rgb" or "bgr"), with or
+    without alpha (which is composited)"""
+    if order == "bgr":
+        arr = arr[..., [2, 1, 0, 3][:arr.shape[-1]]]
+    return composite_rgba(arr) if is_rgba(arr) else arr
+
+
 def squeeze_output(fn):
     """Decorator for squeezing the output array if it's necessary.
     For example, if the input for `to_husl` is an RGB list like
@@ -240,28 +333,221 @@ def squeeze_output(fn):
     @wraps(fn)
     def wrapped(*args, **kwargs):
         out = fn(*args, **kwargs)
-        if out.size == 3 and out.ndim == 2:
+        if isinstance(out, ndarray) and out.size == 3 and out.ndim == 2:
             out = np.squeeze(out)
         return out
     return wrapped
 
 
+### Functions for handling YUV 4:2:0 video frames
+
+YUV_FRACTION_BITS = 14  # must match YUV_FRACTION_BITS in _simd.c
+
+
+def yuv_planes(y: ndarray, u: ndarray, v: ndarray = None) -> tuple:
+    """Check the planes of a YUV 4:2:0 frame and return (Y, U, V) uint8
+    planes. If `v` is None, `u` is an interleaved NV12 UV plane, and U and
+    V are returned as strided views of it."""
+    y = _yuv_plane(y, "Y")
+    if v is None:
+        uv = _yuv_plane(u, "UV", ndims=(2, 3))
+        if uv.ndim == 2:
+            uv = uv.reshape((uv.shape[0], -1, 2))
+        u, v = uv[..., 0], uv[..., 1]
+    else:
+        u, v = _yuv_plane(u, "U"), _yuv_plane(v, "V")
+    chroma_shape = tuple((n + 1) // 2 for n in y.shape)
+    if u.shape != chroma_shape or v.shape != chroma_shape:
+        raise ValueError("Expected {} chroma planes for a {} Y plane, got "
+                         "U {} and V {}".format(chroma_shape, y.shape,
+                                                u.shape, v.shape))
+    return y, u, v
+
+
+def _yuv_plane(plane: ndarray, name: str, ndims=(2,)) -> ndarray:
+    plane = np.asarray(plane)
+    if plane.ndim not in ndims:
+        raise ValueError("Unrecognized {} plane shape: {}".format(
+                         name, plane.shape))
+    if plane.dtype != np.uint8:
+        if not np.issubdtype(plane.dtype, np.integer):
+            raise ValueError("Expected 8-bit integer {} samples, got "
+                             "{}".format(name, plane.dtype))
+        plane = plane.astype(np.uint8)
+    return plane
+
+
+def yuv_spec(matrix: str, yuv_range: str) -> tuple:
+    """Return (Kr, Kb, Y offset, Y span, chroma span) for a YUV matrix
+    (e.g. "bt709") and range ("limited" or "full")"""
+    if matrix not in constants.YUV_MATRICES:
+        raise ValueError("Unknown YUV matrix {!r} (choose from {})".format(
+                         matrix, ", ".join(sorted(constants.YUV_MATRICES))))
+    if yuv_range not in constants.YUV_RANGES:
+        raise ValueError("Unknown YUV range {!r} (choose from {})".format(
+                         yuv_range, ", ".join(sorted(constants.YUV_RANGES))))
+    return constants.YUV_MATRICES[matrix] + constants.YUV_RANGES[yuv_range]
+
+
+def yuv_to_rgb_coefficients(matrix: str, yuv_range: str) -> ndarray:
+    """Fixed point coefficients (with `YUV_FRACTION_BITS` fraction bits)
+    mapping 8-bit YUV to 8-bit RGB: [Y offset, Y scale, R/V, G/U, G/V, B/U],
+    with U and V centered on 128"""
+    kr, kb, y_offset, y_span, c_span = yuv_spec(matrix, yuv_range)
+    kg = 1 - kr - kb
+    c_scale = 255.0 / c_span
+    coeffs = np.asarray([
+        255.0 / y_span,
+        2 * (1 - kr) * c_scale,
+        -2 * kb * (1 - kb) / kg * c_scale,
+        -2 * kr * (1 - kr) / kg * c_scale,
+        2 * (1 - kb) * c_scale,
+    ])
+    fixed = np.round(coeffs * (1 << YUV_FRACTION_BITS))
+    return np.concatenate(([y_offset], fixed)).astype(np.int32)
+
+
+### Functions for handling indexed-color images
+
+def palette_image(palette) -> ndarray:
+    """Return an (n, 3) palette as a (1, n, 3) image for conversion"""
+    palette = np.asarray(palette)
+    if palette.ndim != 2 or palette.shape[1] != 3:
+        raise ValueError("Expected an (n, 3) palette, got shape {}".format(
+                         palette.shape))
+    return palette[None]
+
+
+# Fewest pixels for which `to_palette` fills a table of all 8-bit colors
+# (80 MB) instead of sorting; sorting is faster below about 2**18
+PALETTE_TABLE_MIN_PIXELS = 1 << 18
+
+
+def to_palette(rgb: ndarray) -> tuple:
+    """Return (indices, palette) for an RGB image: the image's distinct
+    colors as an (n, 3) palette, and the index of each pixel's color.
+    The colors of 8-bit images of at least PALETTE_TABLE_MIN_PIXELS pixels
+    are found with a table of all 2**24 colors rather than by sorting."""
+    flat = rgb.reshape((-1, 3))
+    if rgb.dtype == np.uint8:
+        keys = (flat[:, 0].astype(np.uint32) << 16) \
+            | (flat[:, 1].astype(np.uint32) << 8) | flat[:, 2]
+        if keys.size < PALETTE_TABLE_MIN_PIXELS:
+            colors, inverse = np.unique(keys, return_inverse=True)
+        else:
+            present = np.zeros(1 << 24, dtype=bool)
+            present[keys] = True
+            colors = np.flatnonzero(present)
+            table = np.empty(1 << 24, dtype=np.int32)  # 2**24 colors at most
+            table[colors] = np.arange(len(colors), dtype=np.int32)
+            inverse = table[keys]
+        palette = np.stack([colors >> 16, (colors >> 8) & 255, colors & 255],
+                           axis=-1).astype(np.uint8)
+    else:
+        palette, inverse = np.unique(flat, axis=0, return_inverse=True)
+    index_type = np.min_scalar_type(max(0, len(palette) - 1))
+    indices = inverse.reshape(rgb.shape[:-1]).astype(index_type)
+    return indices, palette
+
+
+def estimate_colors(rgb: ndarray, samples: int = 4096) -> float:
+    """Estimate the number of distinct colors in an RGB image from an
+    evenly spaced sample of its pixels. A sample of `s` pixels from `n`
+    equally common colors holds about `d = n*(1 - exp(-s/n))` distinct
+    colors, so `n` is solved for from the sample's `d`. Returns inf if
+    every sampled color is distinct."""
+    flat = rgb.reshape((-1, 3))
+    picks = np.linspace(0, len(flat) - 1, min(samples, len(flat)))
+    sample = flat[picks.astype(np.int64)]
+    s, d = len(sample), len(np.unique(sample, axis=0))
+    if d >= s:
+        return float("inf") if s else 0.0
+    low, high = float(d), float(s) * s
+    for _ in range(60):  # bisect, since d(n) increases with n
+        mid = (low + high) / 2
+        if mid * -np.expm1(-s / mid) < d:
+            low = mid
+        else:
+            high = mid
+    return high
+
+
+### Functions for laying out HUSL histograms
+
+HUSL_MAX = (360.0, 100.0, 100.0)  # H, S, and L bins span [0, max]
+
+
+def histogram_layout(bins: tuple, names: list) -> tuple:
+    """Lay out histograms of the HUSL channels named in `names` (e.g.
+    "hl" for a 2D hue x lightness histogram) in one flat array of counts,
+    with `bins` = (h, s, l) bins per channel. Returns (shapes, strides,
+    size), where row k of `strides` is (offset, h stride, s stride,
+    l stride) of histogram k, and `size` is the length of the array."""
+    if len(bins) != 3 or min(bins) < 1:
+        raise ValueError("Expected (h, s, l) bin counts, got {}".format(
+                         bins))
+    strides = np.zeros((len(names), 4), dtype=np.int64)
+    shapes = []
+    size = 0
+    for k, name in enumerate(names):
+        if (not name or set(name) - set("hsl") or
+                len(set(name)) != len(name)):
+            raise ValueError("Histogram channels must be some of 'h', 's', "
+                             "and 'l', not {!r}".format(name))
+        shape = tuple(int(bins["hsl".index(c)]) for c in name)
+        stride = 1
+        for c, n in reversed(list(zip(name, shape))):  # C order
+            strides[k, 1 + "hsl".index(c)] = stride
+            stride *= n
+        strides[k, 0] = size
+        shapes.append(shape)
+        size += stride
+    return shapes, strides, size
+
+
 ### Functions for applying transformations to images in chunks
 
 def in_chunks(img: ndarray, transform: callable,
-                  out: ndarray = None, chunksize: int = None) -> ndarray:
-    """Transform an image with `transform`, optionally in chunks
-    of `chunksize`, and optionally place results into `out` array."""
-    if chunksize and out is None:
-        raise ValueError("`out` array required if `chunksize` is given")
-    if chunksize:
-        chunks = chunk_img(img, chunksize)
-        chunk_trans = chunk_apply_1d if len(out.shape) == 1 else \
-                      chunk_apply
-        chunk_trans(transform, chunks, out)
+              chunksize: int = None, out: ndarray = None) -> ndarray:
+    """Transform an image with `transform`, optionally in square chunks of
+    `chunksize` rows and columns, and optionally place results into `out`
+    array. Without `out`, chunks go into an array like the first chunk's
+    result."""
+    if not chunksize:
+        if out is None:
+            return transform(img)
+        out[...] = transform(img)
         return out
-    else:
-        return transform(img)
+    for chunk, ((rstart, rend), (cstart, cend)) in chunk_img(img, chunksize):
+        result = transform(chunk)
+        if out is None:
+            out = _result_array(result, img.shape[:min(2, result.ndim)])
+        if out.ndim == 1:
+            out[rstart: rend] = result
+        else:
+            out[rstart: rend, cstart: cend] = result
+    return out
+
+
+def in_bands(img: ndarray, transform: callable, rows: int,
+             out: ndarray = None) -> ndarray:
+    """Transform an image in bands of `rows` rows (slices of its first
+    axis), so that only one band's temporaries exist at a time, and place
+    results into `out` array, or an array like the first band's result"""
+    if rows >= len(img):
+        return in_chunks(img, transform, out=out)
+    for start, end in chunk(len(img), rows):
+        result = transform(img[start: end])
+        if out is None:
+            out = _result_array(result, img.shape[:1])
+        out[start: end] = result
+    return out
+
+
+def _result_array(result: ndarray, leading: tuple) -> ndarray:
+    """An empty array like the result of a chunk, with `leading` axes of
+    the whole image instead of the chunk's (keeping planar layouts)"""
+    return np.empty_like(result, shape=leading + result.shape[len(leading):])
 
 
 def chunk_apply(transform, chunks, out: ndarray) -> None:
@@ -0,0 +1,205 @@
+"""
+Calibration of the "best" backend to the host. Found in this module:
+
+1. `calibrate`: times each backend, number of threads, and schedule chunk
+   size on images of a few sizes, and saves the fastest to a cache file
+2. `load`: follows the choices in a cache file (done on first use)
+3. `reset`: goes back to the fixed preference of SIMD, Cython, NumExpr,
+   then NumPy
+
+Which implementation is fastest depends on the host, the function, and the
+size of the image: thread teams don't pay for themselves on small images,
+and a backend with more threads can beat one with faster kernels. After
+calibration, API calls with the "best" backend look up the choice for the
+function and the size bucket of their input (the nearest measured size, on
+a log scale). The smallest image that gained from a team of threads also
+becomes the min size of the C kernels' parallel loops, which is a fixed
+guess (MIN_IMG_SIZE_THREADED) otherwise.
+
+The cache file is only followed on the host and build it was made for: the
+nphusl version, the available backends, and the number of OpenMP threads
+must match. It's at `$XDG_CACHE_HOME/nphusl/calibration.json`, or under
+`~/.cache` if XDG_CACHE_HOME isn't set.
+"""
+
+import json
+import math
+import os
+import timeit
+import warnings
+
+from contextlib import contextmanager
+
+import numpy as np
+
+from . import __version__
+from . import nphusl
+
+
+FUNCTIONS = ("to_husl", "to_rgb", "to_hue", "to_lightness")
+DEFAULT_SIZES = (32*32, 128*128, 512*512, 1024*1024)  # pixels
+CHUNKS = (1, 16)  # schedule chunks tried besides set_schedule's
+FILE_VERSION = 1
+
+
+def calibrate(path: str = None, sizes: tuple = DEFAULT_SIZES,
+              functions: tuple = FUNCTIONS, repeat: int = 3) -> dict:
+    """Time `functions` with each available backend, number of threads,
+    and schedule chunk size on random RGB images of `sizes` pixels, taking
+    the best of `repeat` runs. The fastest choices are followed from then
+    on and saved to `path` (by default, the cache file). Takes about half
+    a minute with the default sizes. Returns the choices for each function
+    as a list of (pixels, backend, threads, chunk) tuples, with a thread
+    count or chunk of 0 for the default."""
+    sizes = sorted(set(int(n) for n in sizes))
+    if not sizes or sizes[0] < 1:
+        raise ValueError("Expected positive image sizes, got {}".format(
+                         sizes))
+    for name in functions:
+        if name not in FUNCTIONS:
+            raise ValueError("Expected functions among {}, got {!r}".format(
+                             ", ".join(FUNCTIONS), name))
+    reset()
+    simd = nphusl.simd
+    if simd:  # let the team sizes decide, even for small images
+        threaded_min_size = simd._get_threaded_min_size()
+        simd._set_threaded_min_size(0)
+    try:
+        choices = {name: [] for name in functions}
+        for pixels in sizes:
+            rows = int(math.sqrt(pixels))
+            rgb = np.random.randint(0, 256, size=(rows, pixels // rows, 3),
+                                    dtype=np.uint8)
+            hsl = nphusl.to_husl(rgb, backend="numpy")
+            for name in functions:
+                img = hsl if name == "to_rgb" else rgb
+                choice = _fastest(getattr(nphusl, name), img, repeat)
+                choices[name].append((pixels,) + tuple(choice))
+    finally:
+        if simd:
+            simd._set_threaded_min_size(threaded_min_size)
+    cache = {"version": FILE_VERSION, "host": _host(),
+             "threaded_min_size": _threaded_min_size(choices),
+             "choices": choices}
+    _follow(cache)
+    path = path or cache_path()
+    os.makedirs(os.path.dirname(os.path.abspath(path)), exist_ok=True)
+    with open(path, "w") as f:
+        json.dump(cache, f, indent=1)
+    return choices
+
+
+def load(path: str = None) -> bool:
+    """Follow the choices in the cache file at `path` (by default, the
+    cache file), if it was made on this host and build. Returns True if
+    they're followed."""
+    nphusl._tuning = {}
+    path = path or cache_path()
+    try:
+        with open(path) as f:
+            cache = json.load(f)
+    except FileNotFoundError:
+        return False
+    except (OSError, ValueError) as e:
+        warnings.warn("Can't read the calibration file {}: {}".format(
+                      path, e))
+        return False
+    if cache.get("version") != FILE_VERSION or cache.get("host") != _host():
+        return False
+    _follow(cache)
+    return True
+
+
+def reset() -> None:
+    """Forget the choices of `calibrate` and `load` in this process (the
+    cache file is kept)"""
+    nphusl._tuning = {}
+    if nphusl.simd:
+        nphusl.simd._set_threaded_min_size(
+            nphusl.simd.MIN_IMG_SIZE_THREADED)
+
+
+def cache_path() -> str:
+    """Path of the cache file"""
+    cache_dir = (os.environ.get("XDG_CACHE_HOME") or
+                 os.path.join(os.path.expanduser("~"), ".cache"))
+    return os.path.join(cache_dir, "nphusl", "calibration.json")
+
+
+def _fastest(fn, img, repeat: int) -> nphusl.Tuned:
+    best, fastest = math.inf, None
+    for choice in _candidates(img.size // 3):
+        with _using(choice):
+            fn(img, backend="best")  # warm up
+            for _ in range(repeat):
+                elapsed = timeit.timeit(lambda: fn(img, backend="best"),
+                                        number=1)
+                if elapsed < best:
+                    best, fastest = elapsed, choice
+                elif elapsed > 2 * best:
+                    break  # not even close
+    return fastest
+
+
+def _candidates(pixels: int) -> list:
+    """Backend, threads, and chunk settings worth timing on `pixels`"""
+    threads = [0]
+    if nphusl.simd:
+        most = nphusl.simd._set_thread_team(0)
+        threads = sorted({most} | {2**k for k in range(most.bit_length())})
+    # "best" mixes backends: each step in the first that implements it
+    candidates = [nphusl.Tuned("best", t, 0) for t in threads]
+    candidates.append(nphusl.Tuned("numpy", 0, 0))
+    if nphusl.NUMEXPR:
+        candidates.append(nphusl.Tuned("numexpr", 0, 0))
+    if nphusl.CYTHON:
+        candidates += [nphusl.Tuned("cython", t, 0) for t in threads]
+    if nphusl.SIMD:
+        candidates += [nphusl.Tuned("simd", t, 0) for t in threads]
+        runs = -(-pixels // nphusl.simd.RUN_PIXELS)
+        candidates += [nphusl.Tuned("simd", t, chunk)
+                       for t in threads if t > 1
+                       for chunk in CHUNKS if chunk * t < runs]
+    return candidates
+
+
+@contextmanager
+def _using(choice: nphusl.Tuned):
+    """Follow `choice` for every call of the API functions"""
+    tuning = nphusl._tuning
+    nphusl._tuning = {name: ([], [choice]) for name in FUNCTIONS}
+    try:
+        yield
+    finally:
+        nphusl._tuning = tuning
+
+
+def _threaded_min_size(choices: dict) -> int:
+    """The smallest size (in values) in the bucket of the smallest image
+    that was converted fastest with a team of threads, or None"""
+    bounds = []
+    for name, measured in choices.items():
+        for k, (pixels, backend, threads, _) in enumerate(measured):
+            if backend != "numpy" and threads > 1:
+                below = measured[k - 1][0] if k else 0
+                bounds.append(3 * int(math.sqrt(below * pixels)))
+                break
+    return min(bounds) if bounds else None
+
+
+def _follow(cache: dict) -> None:
+    tuning = {}
+    for name, measured in cache["choices"].items():
+        sizes = [pixels for pixels, *_ in measured]
+        bounds = [math.sqrt(a * b) for a, b in zip(sizes, sizes[1:])]
+        tuning[name] = (bounds, [nphusl.Tuned(*choice)
+                                 for _, *choice in measured])
+    nphusl._tuning = tuning
+    if nphusl.simd and cache["threaded_min_size"] is not None:
+        nphusl.simd._set_threaded_min_size(cache["threaded_min_size"])
+
+
+def _host() -> dict:
+    backends = [name for name, fns in nphusl._IMPLEMENTATIONS.items() if fns]
+    threads = nphusl.simd._set_thread_team(0) if nphusl.simd else 0
+    return {"nphusl": __version__, "backends": backends, "threads": threads}
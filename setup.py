@@ -16,14 +16,8 @@ class Arg(CompileArg, Enum):
     CYTHONIZE = CompileArg("--cythonize", None)
     NO_CYTHON_EXT = CompileArg("--no-cython-ext", None)
     NO_SIMD_EXT = CompileArg("--no-simd-ext", None)
-    NO_LIGHT_LUT = CompileArg(
-        "--no-light-lut", "-DUSE_LIGHT_LUT")
-    NO_CHROMA_LUT = CompileArg(
-        "--no-chroma-lut", "-DUSE_CHROMA_LUT")
-    NO_HUE_ATAN2_APPROX = CompileArg(
-        "--no-hue-atan2-approx", "-DUSE_HUE_ATAN2_APPROX")
-    INTERPOLATE_CHROMA = CompileArg(
-        "--interpolate-chroma", "-DINTERPOLATE_CHROMA")
+    NO_HUGEPAGES = CompileArg(
+        "--no-hugepages", "-DUSE_HUGEPAGES")
 
 
 args = {}
@@ -113,19 +107,16 @@ simd_sources=["nphusl/_simd_opt"+ext,
               "nphusl/_simd.c",
               "nphusl/_linear_lookup.c",
               "nphusl/_scale_const.c",
+              "nphusl/_tiles.c",
+              "nphusl/_alloc.c",
+              "nphusl/_affinity.c",
+              "nphusl/_light_lookup.c",   # every kernel variant is built;
+              "nphusl/_chroma_lookup.c",  # see nphusl.set_quality
 ]
 
 
-if not args[Arg.NO_LIGHT_LUT]:
-    simd_sources.append("nphusl/_light_lookup.c")
-    simd_compile_args.append(Arg.NO_LIGHT_LUT.cc_cmd)
-if not args[Arg.NO_CHROMA_LUT]:
-    simd_sources.append("nphusl/_chroma_lookup.c")
-    simd_compile_args.append(Arg.NO_CHROMA_LUT.cc_cmd)
-if args[Arg.INTERPOLATE_CHROMA]:
-    simd_compile_args.append(Arg.INTERPOLATE_CHROMA.cc_cmd)
-if not args[Arg.NO_HUE_ATAN2_APPROX]:
-    simd_compile_args.append(Arg.NO_HUE_ATAN2_APPROX.cc_cmd)
+if not args[Arg.NO_HUGEPAGES]:
+    simd_compile_args.append(Arg.NO_HUGEPAGES.cc_cmd)
 
 
 cython_ext = Extension("nphusl._cython_opt",
@@ -1,4 +1,7 @@
+import glob
+import os
 import sys
+import time
 import timeit
 
 from collections import defaultdict
@@ -63,6 +66,643 @@ def test_perf_rgb_to_hue(impls, iters, img):
     _test_all(fn, img.rgb, locals(), impls, iters)
 
 
+def test_perf_tiled_load(iters, img, tmpdir):
+    from nphusl import tiled
+    tiled_path = str(tmpdir.join("img.hslt"))
+    npy_path = str(tmpdir.join("img.npy"))
+    tiled.save(tiled_path, img.hsl)
+    np.save(npy_path, img.hsl)
+    env = {**globals(), **locals()}
+    print("\n\nloading a cached HUSL image (best of {})\n".format(iters))
+    rows = []
+    for name, stmt in (("to_husl(rgb)", "nphusl.to_husl(img.rgb)"),
+                       ("np.load", "np.load(npy_path)"),
+                       ("tiled.load", "tiled.load(tiled_path)")):
+        best = min(timeit.repeat(stmt, repeat=iters, number=1, globals=env))
+        rows.append([name, best, img.rgb.size / 3 / best])
+    print(tabulate.tabulate(
+          rows, headers=("Method", "Duration (s)", "Pixels/s"),
+          tablefmt="pipe", floatfmt="6.2e"))
+    print()
+
+
+def test_perf_aio_latency(iters, img):
+    import asyncio
+    from nphusl import aio
+    requests = 16
+
+    async def timed(convert):
+        start = time.perf_counter()
+        await convert()
+        return time.perf_counter() - start
+
+    async def under_load(make_convert):
+        times = await asyncio.gather(
+            *(timed(make_convert()) for _ in range(requests)))
+        return np.percentile(times, [50, 99])
+
+    def executor():
+        loop = asyncio.get_event_loop()
+        return lambda: loop.run_in_executor(None, nphusl.to_husl, img.rgb)
+
+    print("\n\nlatency of {} concurrent to_husl requests (best of {})\n"
+          .format(requests, iters))
+    rows = []
+    loop = asyncio.new_event_loop()
+    asyncio.set_event_loop(loop)
+    try:
+        for name, make in (("aio.to_husl", lambda: lambda:
+                                aio.to_husl(img.rgb)),
+                           ("run_in_executor", executor)):
+            runs = [loop.run_until_complete(under_load(make))
+                    for _ in range(iters)]
+            p50, p99 = min(runs, key=lambda r: r[1])
+            rows.append([name, p50, p99])
+    finally:
+        loop.close()
+        asyncio.set_event_loop(None)
+    print(tabulate.tabulate(
+          rows, headers=("Method", "p50 latency (s)", "p99 latency (s)"),
+          tablefmt="pipe", floatfmt="6.2e"))
+    print()
+
+
+def test_perf_rgb_to_husl_large_output(impls, iters):
+    """A 7680x4320 image makes a ~800 MB HSL output, so page placement
+    matters. Compare NUMA layouts by running this under numactl, e.g.
+    `numactl --cpunodebind=0,1 --localalloc` vs `--membind=0`."""
+    nodes = glob.glob("/sys/devices/system/node/node[0-9]*")
+    print("\n\nNUMA nodes visible: {}".format(len(nodes) or "unknown"))
+    rgb = (np.random.rand(4320, 7680, 3) * 255).astype(np.uint8)
+    fn = "nphusl.to_husl"
+    _test_all(fn, rgb, locals(), impls, iters)
+
+
+def test_perf_yuv_to_husl(impls, iters):
+    """A 4K NV12 frame straight to HUSL vs. decoding it to RGB first"""
+    y = (np.random.rand(2160, 3840) * 255).astype(np.uint8)
+    uv = (np.random.rand(1080, 3840) * 255).astype(np.uint8)
+    planes = nphusl.transform.yuv_planes(y, uv)
+    coeffs = nphusl.transform.yuv_to_rgb_coefficients("bt709", "limited")
+    via_rgb = nphusl.nphusl.NUMPY["_yuv_to_husl"]  # NumPy YUV -> RGB
+    env = {**globals(), **locals()}
+    print("\n\n4K NV12 frame to HUSL (best of {})\n".format(iters))
+    rows = []
+    for impl in impls:
+        with getattr(nphusl, "{}_enabled".format(impl))():
+            for name, stmt in (
+                    ("to_husl_from_yuv", "nphusl.to_husl_from_yuv(y, uv)"),
+                    ("RGB, then to_husl", "via_rgb(*planes, coeffs)")):
+                best = min(timeit.repeat(stmt, repeat=iters, number=1,
+                                         globals=env))
+                rows.append([impl, name, best, y.size / best])
+    print(tabulate.tabulate(
+          rows, headers=("Impl", "Method", "Duration (s)", "Pixels/s"),
+          tablefmt="pipe", floatfmt="6.2e"))
+    print()
+
+
+def test_perf_rgb_to_husl_float(impls, iters, img):
+    """Float32/float64 sRGB and linear RGB input vs. uint8 input"""
+    rgb = img.rgb[..., :3]
+    linear = nphusl.nphusl._to_linear(rgb / 255.0)
+    inputs = (("uint8", rgb, False),
+              ("float64", rgb / 255.0, False),
+              ("float32", (rgb / 255.0).astype(np.float32), False),
+              ("float64 linear", linear, True),
+              ("float32 linear", linear.astype(np.float32), True))
+    env = {**globals(), **locals()}
+    print("\n\nto_husl with float RGB input (best of {})\n".format(iters))
+    rows = []
+    for impl in impls:
+        with getattr(nphusl, "{}_enabled".format(impl))():
+            for name, rgb, is_linear in inputs:
+                env.update(rgb=rgb, is_linear=is_linear)
+                best = min(timeit.repeat(
+                    "nphusl.to_husl(rgb, linear=is_linear)",
+                    repeat=iters, number=1, globals=env))
+                rows.append([impl, name, best, rgb.size / 3 / best])
+    print(tabulate.tabulate(
+          rows, headers=("Impl", "Input", "Duration (s)", "Pixels/s"),
+          tablefmt="pipe", floatfmt="6.2e"))
+    print()
+
+
+def test_perf_rgb_to_husl_format(impls, iters, img):
+    """Channel orders, alpha, and float32 output handled in the kernel vs.
+    converting the input/output in NumPy first"""
+    rgb = img.rgb[..., :3]
+    bgr = rgb[..., ::-1].copy()
+    rgba = np.concatenate((rgb, np.full_like(rgb[..., :1], 200)), axis=-1)
+    cases = (("rgb", "nphusl.to_husl(rgb)"),
+             ("bgr", "nphusl.to_husl(bgr, order='bgr')"),
+             ("bgr, flipped first", "nphusl.to_husl(bgr[..., ::-1])"),
+             ("rgba", "nphusl.to_husl(rgba)"),
+             ("rgba, composited first", "nphusl.to_husl("
+              "nphusl.transform.composite_rgba(rgba))"),
+             ("float32 out", "nphusl.to_husl(rgb, dtype=np.float32)"),
+             ("float32 out, cast after",
+              "nphusl.to_husl(rgb).astype(np.float32)"))
+    env = {**globals(), **locals()}
+    print("\n\nto_husl input and output formats (best of {})\n".format(
+          iters))
+    rows = []
+    for impl in impls:
+        with getattr(nphusl, "{}_enabled".format(impl))():
+            for name, stmt in cases:
+                best = min(timeit.repeat(stmt, repeat=iters, number=1,
+                                         globals=env))
+                rows.append([impl, name, best, rgb.size / 3 / best])
+    print(tabulate.tabulate(
+          rows, headers=("Impl", "Format", "Duration (s)", "Pixels/s"),
+          tablefmt="pipe", floatfmt="6.2e"))
+    print()
+
+
+def test_perf_planar(impls, iters, img):
+    """Channel-first input and planar output handled in the kernel vs.
+    transposing in NumPy, and a one-channel reduction over each layout"""
+    rgb = np.ascontiguousarray(img.rgb[..., :3])
+    chw = np.ascontiguousarray(np.moveaxis(rgb, -1, 0))
+    hsl = nphusl.to_husl(rgb)
+    hsl_planar = nphusl.to_husl(rgb, layout="planar")
+    cases = (("interleaved", "nphusl.to_husl(rgb)"),
+             ("planar out", "nphusl.to_husl(rgb, layout='planar')"),
+             ("planar out, transposed after", "np.ascontiguousarray("
+              "np.moveaxis(nphusl.to_husl(rgb), -1, 0))"),
+             ("planar in", "nphusl.to_husl("
+              "nphusl.transform.from_planes(chw))"),
+             ("planar in, transposed first", "nphusl.to_husl("
+              "np.ascontiguousarray(np.moveaxis(chw, 0, -1)))"),
+             ("L mean, interleaved", "hsl[..., 2].mean()"),
+             ("L mean, planar", "hsl_planar[..., 2].mean()"))
+    env = {**globals(), **locals()}
+    print("\n\nto_husl planar layouts (best of {})\n".format(iters))
+    rows = []
+    for impl in impls:
+        with getattr(nphusl, "{}_enabled".format(impl))():
+            for name, stmt in cases:
+                best = min(timeit.repeat(stmt, repeat=iters, number=1,
+                                         globals=env))
+                rows.append([impl, name, best, rgb.size / 3 / best])
+    print(tabulate.tabulate(
+          rows, headers=("Impl", "Layout", "Duration (s)", "Pixels/s"),
+          tablefmt="pipe", floatfmt="6.2e"))
+    print()
+
+
+def test_perf_husl_histogram(impls, iters):
+    """Hue x lightness and saturation histograms of a 4K frame, fused vs.
+    `to_husl` followed by NumPy histograms"""
+    rgb = (np.random.rand(2160, 3840, 3) * 255).astype(np.uint8)
+    bins = (36, 10, 20)
+
+    def separate():
+        hsl = nphusl.to_husl(rgb)
+        np.histogram2d(hsl[..., 0].ravel(), hsl[..., 2].ravel(),
+                       bins=(36, 20), range=((0, 360), (0, 100)))
+        np.histogram(hsl[..., 1], bins=10, range=(0, 100))
+
+    env = {**globals(), **locals()}
+    print("\n\n4K frame to HUSL histograms (best of {})\n".format(iters))
+    rows = []
+    for impl in impls:
+        with getattr(nphusl, "{}_enabled".format(impl))():
+            for name, stmt in (
+                    ("husl_histogram", "nphusl.husl_histogram("
+                                       "rgb, bins, ('hl', 's'))"),
+                    ("to_husl + np.histogram", "separate()")):
+                best = min(timeit.repeat(stmt, repeat=iters, number=1,
+                                         globals=env))
+                rows.append([impl, name, best, rgb.size / 3 / best])
+    print(tabulate.tabulate(
+          rows, headers=("Impl", "Method", "Duration (s)", "Pixels/s"),
+          tablefmt="pipe", floatfmt="6.2e"))
+    print()
+
+
+def test_perf_husl_stats(impls, iters):
+    """Statistics of a 4K frame, reduced in one pass vs. `to_husl`
+    followed by NumPy reductions"""
+    rgb = (np.random.rand(2160, 3840, 3) * 255).astype(np.uint8)
+
+    def separate():
+        hsl = nphusl.to_husl(rgb)
+        H, S, L = np.radians(hsl[..., 0]), hsl[..., 1], hsl[..., 2]
+        np.arctan2((S * np.sin(H)).sum(), (S * np.cos(H)).sum())
+        S.mean(), S.std(), L.mean(), L.std()
+        np.percentile(L, (5, 50, 95))
+
+    env = {**globals(), **locals()}
+    print("\n\n4K frame HUSL statistics (best of {})\n".format(iters))
+    rows = []
+    for impl in impls:
+        with getattr(nphusl, "{}_enabled".format(impl))():
+            for name, stmt in (("husl_stats", "nphusl.husl_stats(rgb)"),
+                               ("to_husl + NumPy", "separate()"),
+                               ("to_husl alone", "nphusl.to_husl(rgb)")):
+                best = min(timeit.repeat(stmt, repeat=iters, number=1,
+                                         globals=env))
+                rows.append([impl, name, best, rgb.size / 3 / best])
+    print(tabulate.tabulate(
+          rows, headers=("Impl", "Method", "Duration (s)", "Pixels/s"),
+          tablefmt="pipe", floatfmt="6.2e"))
+    print()
+
+
+def test_perf_gray_and_lightness(impls, iters):
+    """A 4K gray frame through the gray fast path vs. as 3-channel RGB, and
+    `to_lightness` vs. `to_husl` of a color frame"""
+    gray = (np.random.rand(2160, 3840) * 255).astype(np.uint8)
+    gray_rgb = np.stack([gray] * 3, axis=-1)
+    rgb = (np.random.rand(2160, 3840, 3) * 255).astype(np.uint8)
+    env = {**globals(), **locals()}
+    print("\n\n4K gray and lightness conversion (best of {})\n".format(
+          iters))
+    rows = []
+    for impl in impls:
+        with getattr(nphusl, "{}_enabled".format(impl))():
+            for name, stmt in (
+                    ("to_husl(gray)", "nphusl.to_husl(gray)"),
+                    ("to_husl(gray as RGB)", "nphusl.to_husl(gray_rgb)"),
+                    ("to_lightness(rgb)", "nphusl.to_lightness(rgb)"),
+                    ("to_husl(rgb)", "nphusl.to_husl(rgb)")):
+                best = min(timeit.repeat(stmt, repeat=iters, number=1,
+                                         globals=env))
+                rows.append([impl, name, best, gray.size / best])
+    print(tabulate.tabulate(
+          rows, headers=("Impl", "Method", "Duration (s)", "Pixels/s"),
+          tablefmt="pipe", floatfmt="6.2e"))
+    print()
+
+
+def test_perf_delta_converter(impls, iters):
+    """4K frames from a fixed camera, with 2% of 64x64 tiles changing each
+    frame: `delta.DeltaConverter` vs. `to_husl` of every frame"""
+    from nphusl import delta
+    frames = [(np.random.rand(2160, 3840, 3) * 255).astype(np.uint8)]
+    for _ in range(4):
+        frame = frames[-1].copy()
+        for _ in range(int(0.02 * (2160 // 64) * (3840 // 64))):
+            r, c = np.random.randint(2160), np.random.randint(3840)
+            frame[r, c] = 255 - frame[r, c]
+        frames.append(frame)
+
+    def run_delta():
+        converter = delta.DeltaConverter(tile=64)
+        for frame in frames:
+            converter.convert(frame)
+
+    env = {**globals(), **locals()}
+    print("\n\n{} 4K frames (best of {})\n".format(len(frames), iters))
+    rows = []
+    for impl in impls:
+        with getattr(nphusl, "{}_enabled".format(impl))():
+            for name, stmt in (
+                    ("DeltaConverter", "run_delta()"),
+                    ("to_husl", "[nphusl.to_husl(f) for f in frames]")):
+                best = min(timeit.repeat(stmt, repeat=iters, number=1,
+                                         globals=env))
+                rows.append([impl, name, best, len(frames) / best])
+    print(tabulate.tabulate(
+          rows, headers=("Impl", "Method", "Duration (s)", "Frames/s"),
+          tablefmt="pipe", floatfmt="6.2e"))
+    print()
+
+
+def test_perf_indexed(impls, iters):
+    """A 4K image of indices into a 256-color palette: `to_husl_indexed`
+    vs. expanding the palette to RGB and converting every pixel"""
+    palette = (np.random.rand(256, 3) * 255).astype(np.uint8)
+    indices = (np.random.rand(2160, 3840) * 256).astype(np.uint8)
+    env = {**globals(), **locals()}
+    print("\n\n4K indexed-color image (best of {})\n".format(iters))
+    rows = []
+    for impl in impls:
+        with getattr(nphusl, "{}_enabled".format(impl))():
+            for name, stmt in (
+                    ("to_husl_indexed",
+                     "nphusl.to_husl_indexed(indices, palette)"),
+                    ("to_husl(palette[indices])",
+                     "nphusl.to_husl(palette[indices])")):
+                best = min(timeit.repeat(stmt, repeat=iters, number=1,
+                                         globals=env))
+                rows.append([impl, name, best, indices.size / best])
+    print(tabulate.tabulate(
+          rows, headers=("Impl", "Method", "Duration (s)", "Pixels/s"),
+          tablefmt="pipe", floatfmt="6.2e"))
+    print()
+
+
+def test_perf_dedupe(impls, iters):
+    """4K frames with 1K, 10K, and 100K colors, and noise: `to_husl`
+    with `dedupe` vs. the dense conversion"""
+    frames = []
+    for colors in (1000, 10000, 100000):
+        palette = (np.random.rand(colors, 3) * 255).astype(np.uint8)
+        frames.append(("{} colors".format(colors),
+                       palette[np.random.randint(0, colors, (2160, 3840))]))
+    frames.append(("noise", (np.random.rand(2160, 3840, 3) * 255).astype(
+                   np.uint8)))
+    env = {**globals(), **locals()}
+    print("\n\n4K frame deduplication (best of {})\n".format(iters))
+    rows = []
+    for impl in impls:
+        with getattr(nphusl, "{}_enabled".format(impl))():
+            for name, rgb in frames:
+                env["rgb"] = rgb
+                for dedupe in (False, True, "auto"):
+                    stmt = "nphusl.to_husl(rgb, dedupe={!r})".format(dedupe)
+                    best = min(timeit.repeat(stmt, repeat=iters, number=1,
+                                             globals=env))
+                    rows.append([impl, name, dedupe, best, rgb.size/3/best])
+    print(tabulate.tabulate(
+          rows, headers=("Impl", "Image", "dedupe", "Duration (s)",
+                         "Pixels/s"),
+          tablefmt="pipe", floatfmt="6.2e"))
+    print()
+
+
+def _document(rows: int, cols: int) -> np.ndarray:
+    """A white page with lines of dark text-like strokes"""
+    page = np.full((rows, cols, 3), 255, dtype=np.uint8)
+    for top in range(100, rows - 100, 60):
+        strokes = np.random.rand(30, cols - 200) < 0.3
+        page[top: top + 30, 100: cols - 100][strokes] = (20, 20, 30)
+    return page
+
+
+def _screenshot(rows: int, cols: int) -> np.ndarray:
+    """Flat panels, buttons, and text on a dark background"""
+    shot = np.full((rows, cols, 3), (30, 30, 36), dtype=np.uint8)
+    shot[:80] = (60, 60, 70)  # title bar
+    shot[80:, :400] = (45, 45, 52)  # sidebar
+    for top in range(120, rows - 60, 90):
+        for left in range(460, cols - 300, 700):
+            shot[top: top + 50, left: left + 240] = (0, 120, 215)  # button
+            text = np.random.rand(20, 200) < 0.25
+            shot[top + 15: top + 35, left + 20: left + 220][text] = 255
+    return shot
+
+
+def test_perf_runs(img, impls, iters):
+    """A corpus of 4K documents and screen captures, and a photo for
+    contrast: `to_husl` with `runs=True` vs. the dense conversion"""
+    corpus = [("document", _document(2160, 3840)),
+              ("screenshot", _screenshot(2160, 3840)),
+              ("photo", img.rgb)]
+    env = {**globals(), **locals()}
+    print("\n\nRun-length conversion (best of {})\n".format(iters))
+    rows = []
+    for impl in impls:
+        with getattr(nphusl, "{}_enabled".format(impl))():
+            for name, rgb in corpus:
+                env["rgb"] = rgb
+                for runs in (False, True):
+                    stmt = "nphusl.to_husl(rgb, runs={})".format(runs)
+                    best = min(timeit.repeat(stmt, repeat=iters, number=1,
+                                             globals=env))
+                    rows.append([impl, name, runs, best, rgb.size/3/best])
+    print(tabulate.tabulate(
+          rows, headers=("Impl", "Image", "runs", "Duration (s)",
+                         "Pixels/s"),
+          tablefmt="pipe", floatfmt="6.2e"))
+    print()
+
+
+def test_perf_quality(img, impls, iters):
+    """`to_husl` at each `quality` level: speed, and mean error in S and L
+    vs. the "exact" level"""
+    rgb = img.rgb[..., :3]
+    env = {**globals(), **locals()}
+    print("\n\nKernel quality levels (best of {})\n".format(iters))
+    rows = []
+    for impl in impls:
+        with getattr(nphusl, "{}_enabled".format(impl))():
+            exact = nphusl.to_husl(rgb, quality="exact")
+            for quality in nphusl.nphusl.QUALITY_LEVELS:
+                stmt = "nphusl.to_husl(rgb, quality={!r})".format(quality)
+                best = min(timeit.repeat(stmt, repeat=iters, number=1,
+                                         globals=env))
+                error = np.abs(nphusl.to_husl(rgb, quality=quality) - exact)
+                rows.append([impl, quality, best, rgb.size/3/best,
+                             error[..., 1].mean(), error[..., 2].mean()])
+    print(tabulate.tabulate(
+          rows, headers=("Impl", "Quality", "Duration (s)", "Pixels/s",
+                         "S error", "L error"),
+          tablefmt="pipe", floatfmt="6.2e"))
+    print()
+
+
+def test_perf_schedule(iters):
+    """SIMD `to_husl` of 4K frames with skewed content (cheap white or
+    black regions next to random colors) under each OpenMP schedule. Run
+    with several cores (e.g. OMP_NUM_THREADS=8) to see load balance."""
+    rgb = (np.random.rand(2160, 3840, 3) * 255).astype(np.uint8)
+    top_white = rgb.copy()
+    top_white[:1080] = 255
+    bottom_black = rgb.copy()
+    bottom_black[1620:] = 0
+    left_white = rgb.copy()
+    left_white[:, :1920] = 255
+    frames = (("random", rgb), ("top half white", top_white),
+              ("bottom quarter black", bottom_black),
+              ("left half white", left_white))
+    schedules = (("static", 0), ("dynamic", 1), ("dynamic", 4),
+                 ("dynamic", 16), ("guided", 4))
+    print("\n\n4K frames under each OpenMP schedule (best of {})\n".format(
+          iters))
+    rows = []
+    with nphusl.simd_enabled():
+        try:
+            for frame_name, frame in frames:
+                for schedule, chunk in schedules:
+                    nphusl.set_schedule(schedule, chunk)
+                    best = min(timeit.repeat(
+                        lambda: nphusl.to_husl(frame), repeat=iters,
+                        number=1))
+                    rows.append([frame_name, schedule, chunk, best,
+                                 frame.size/3/best])
+        finally:
+            nphusl.set_schedule()
+    print(tabulate.tabulate(
+          rows, headers=("Frame", "Schedule", "Chunk", "Duration (s)",
+                         "Pixels/s"),
+          tablefmt="pipe", floatfmt="6.2e"))
+    print()
+
+
+def test_perf_affinity(iters):
+    """Latency percentiles of back-to-back SIMD `to_husl` calls on a 720p
+    frame, with threads free to migrate vs. pinned with `set_affinity`.
+    Run it next to other load (e.g. `stress -c 4`) to see the tail."""
+    if not hasattr(os, "sched_getaffinity"):
+        pytest.skip("no sched_getaffinity")
+    rgb = (np.random.rand(720, 1280, 3) * 255).astype(np.uint8)
+    cpus = sorted(os.sched_getaffinity(0))
+    calls = 50 * iters
+    print("\n\n720p to_husl latency, {} calls on CPUs {}\n".format(
+          calls, cpus))
+    rows = []
+    with nphusl.simd_enabled():
+        try:
+            for name, pinned in (("unpinned", None), ("pinned", cpus)):
+                nphusl.set_affinity(pinned)
+                nphusl.to_husl(rgb)  # pin the threads before timing
+                latency = []
+                for _ in range(calls):
+                    start = time.perf_counter()
+                    nphusl.to_husl(rgb)
+                    latency.append(time.perf_counter() - start)
+                p50, p99 = np.percentile(latency, (50, 99))
+                rows.append([name, p50, p99, max(latency),
+                             np.std(latency)])
+        finally:
+            nphusl.set_affinity(None)
+    print(tabulate.tabulate(
+          rows, headers=("Threads", "p50 (s)", "p99 (s)", "Max (s)",
+                         "Std (s)"),
+          tablefmt="pipe", floatfmt="6.2e"))
+    print()
+
+
+def test_perf_calibrate(iters):
+    """Each API function on images between the calibrated sizes, with the
+    fixed preference (SIMD, then Cython...) of the "best" backend vs. the
+    choices of `calibrate` for this host"""
+    import tempfile
+    from nphusl import tuning
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, "calibration.json")
+        start = time.perf_counter()
+        nphusl.calibrate(path)
+        elapsed = time.perf_counter() - start
+        tuning.reset()
+        rows = []
+        for side in (64, 300, 1500):
+            rgb = (np.random.rand(side, side, 3) * 255).astype(np.uint8)
+            hsl = nphusl.to_husl(rgb)
+            for name in tuning.FUNCTIONS:
+                fn = getattr(nphusl, name)
+                img = hsl if name == "to_rgb" else rgb
+                times = []
+                for load in (False, True):
+                    if load:
+                        tuning.load(path)
+                    times.append(min(timeit.repeat(
+                        lambda: fn(img), repeat=iters, number=1)))
+                bounds, choices = nphusl.nphusl._tuning[name]
+                choice = choices[np.searchsorted(bounds, side*side, "right")]
+                tuning.reset()
+                rows.append([name, side*side, times[0], times[1],
+                             "{} ({} threads, chunk {})".format(*choice)])
+    print("\n\nFixed vs. calibrated backends (best of {}; calibration took "
+          "{:.1f} s)\n".format(iters, elapsed))
+    print(tabulate.tabulate(
+          rows, headers=("Function", "Pixels", "Fixed (s)",
+                         "Calibrated (s)", "Choice"),
+          tablefmt="pipe", floatfmt="6.2e"))
+    print()
+
+
+def test_perf_memory_budget(iters):
+    """`to_husl` of a 4 Mpx image, whole vs. in bands for memory budgets:
+    duration, and the peak of memory allocated through NumPy while
+    converting (tracemalloc doesn't see the C kernels' own outputs)"""
+    import tracemalloc
+    rgb = (np.random.rand(2000, 2000, 3) * 255).astype(np.uint8)
+    rows = []
+    for backend in ("numpy", "simd"):
+        for budget in (None, 1 << 28, 1 << 26, 1 << 24):
+            convert = lambda: nphusl.to_husl(rgb, backend=backend,
+                                             memory_budget=budget)
+            best = min(timeit.repeat(convert, repeat=iters, number=1))
+            tracemalloc.start()
+            convert()
+            _, peak = tracemalloc.get_traced_memory()
+            tracemalloc.stop()
+            rows.append([backend, budget and budget >> 20, best,
+                         peak / 2**20])
+    print("\n\n4 Mpx to_husl within memory budgets (best of {})\n".format(
+          iters))
+    print(tabulate.tabulate(
+          rows, headers=("Backend", "Budget (MiB)", "Duration (s)",
+                         "NumPy peak (MiB)"),
+          tablefmt="pipe", floatfmt="6.2e", missingval="none"))
+    print()
+
+
+def test_perf_batching(iters):
+    """Single-color requests from 16 threads: one `to_husl` call each vs.
+    a `BatchingConverter`, and a stream of submitted requests"""
+    from concurrent.futures import ThreadPoolExecutor
+    from nphusl.batch import BatchingConverter
+    colors = (np.random.rand(1000 * iters, 3) * 255).astype(np.uint8)
+    threads = 16
+
+    def direct(color):
+        start = time.perf_counter()
+        nphusl.to_husl(color)
+        return time.perf_counter() - start
+
+    def run(name, convert):
+        start = time.perf_counter()
+        with ThreadPoolExecutor(threads) as pool:
+            latency = list(pool.map(convert, colors))
+        duration = time.perf_counter() - start
+        p50, p99 = np.percentile(latency, (50, 99))
+        rows.append([name, len(colors) / duration, p50, p99])
+
+    rows = []
+    print("\n\n{} single-color requests\n".format(len(colors)))
+    with nphusl.simd_enabled():
+        run("to_husl per request", direct)
+        for window in (0.0001, 0.0005, 0.002):
+            with BatchingConverter(window=window) as converter:
+                def batched(color):
+                    start = time.perf_counter()
+                    converter.convert(color)
+                    return time.perf_counter() - start
+                run("batched, {} ms window".format(window * 1000), batched)
+        with BatchingConverter() as converter:
+            start = time.perf_counter()
+            futures = [converter.submit(c) for c in colors]
+            for future in futures:
+                future.result()
+            duration = time.perf_counter() - start
+            rows.append(["batched, submitted at once",
+                         len(colors) / duration, float("nan"),
+                         float("nan")])
+    print(tabulate.tabulate(
+          rows, headers=("Requests", "Requests/s", "p50 (s)", "p99 (s)"),
+          tablefmt="pipe", floatfmt="6.2e"))
+    print()
+
+
+def test_perf_hugepage_tables(iters):
+    """SIMD `to_husl` of a random 4K frame, with the chroma LUT on 4 KiB
+    pages vs. its copy on huge pages, at the levels that read the LUT"""
+    simd = pytest.importorskip("nphusl._simd_opt")
+    rgb = (np.random.rand(2160, 3840, 3) * 255).astype(np.uint8)
+    env = {**globals(), **locals()}
+    print("\n\nChroma LUT pages (best of {})\n".format(iters))
+    rows = []
+    with nphusl.simd_enabled():
+        for quality in ("fast", "balanced"):
+            stmt = "nphusl.to_husl(rgb, quality={!r})".format(quality)
+            for huge in (False, True):
+                in_use = simd._use_hugepage_tables(huge)
+                best = min(timeit.repeat(stmt, repeat=iters, number=1,
+                                         globals=env))
+                rows.append([quality, "huge" if in_use else "4 KiB", best,
+                             rgb.size/3/best])
+    simd._use_hugepage_tables(True)
+    print(tabulate.tabulate(
+          rows, headers=("Quality", "Pages", "Duration (s)", "Pixels/s"),
+          tablefmt="pipe", floatfmt="6.2e"))
+    print()
+
+
 def _test_all(fn, img, env, impls, iters):
     env = {**globals(), **locals()}
     print("\n\n{}({})".format(fn, "img"))
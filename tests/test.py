@@ -1,6 +1,8 @@
 import argparse
+import os
 import sys
 import functools
+import tempfile
 
 import imageio
 import numpy as np
@@ -37,22 +39,22 @@ def try_optimizations(*opts):
         _optimized.add(fn.__name__)
 
         def with_numpy(*args, **kwargs):
-            with nphusl.numpy_enabled(back_to_std=True):
+            with nphusl.numpy_enabled():
                 fn(*args, **kwargs)
 
         def with_expr(*args, **kwargs):
             assert hasattr(nphusl, "_numexpr_opt")
-            with nphusl.numexpr_enabled(back_to_std=True):
+            with nphusl.numexpr_enabled():
                 fn(*args, **kwargs)
 
         def with_cyth(*args, **kwargs):
             assert hasattr(nphusl, "_cython_opt")
-            with nphusl.cython_enabled(back_to_std=True):
+            with nphusl.cython_enabled():
                 fn(*args, **kwargs)
 
         def with_simd(*args, **kwargs):
             assert hasattr(nphusl, "_simd_opt")
-            with nphusl.simd_enabled(back_to_std=True):
+            with nphusl.simd_enabled():
                 fn(*args, **kwargs)
 
         globals()[fn.__name__ + "__with_numpy"] = with_numpy
@@ -514,6 +516,899 @@ def test_transform_rgb():
     _diff(as_husl, chunk_husl)
 
 
+@try_optimizations(Opt.cython, Opt.simd)
+def test_convert_file():
+    img = _img()
+    with tempfile.TemporaryDirectory() as tmp:
+        in_path = os.path.join(tmp, "img.raw")
+        out_path = os.path.join(tmp, "img.hsl")
+        img.tofile(in_path)
+        # a tiny memory budget forces the image through in many bands
+        peak = nphusl.nphusl.PEAK_BYTES_PER_PIXEL["to_husl"]
+        band_bytes = 7 * img.shape[1] * (3 + 24 + peak)
+        hsl = nphusl.convert_file(in_path, out_path, img.shape,
+                                  max_memory=band_bytes)
+        expected = nphusl.to_husl(img)
+        _diff(hsl, expected, diff=1e-6)
+        del hsl
+        from_disk = np.fromfile(out_path, dtype=np.float64)
+        _diff(from_disk.reshape(img.shape), expected, diff=1e-6)
+
+
+@try_optimizations(Opt.cython, Opt.simd)
+def test_convert_file_npy():
+    img = _img()
+    with tempfile.TemporaryDirectory() as tmp:
+        in_path = os.path.join(tmp, "img.npy")
+        np.save(in_path, img)
+        hue = nphusl.convert_file(in_path, os.path.join(tmp, "hue.npy"),
+                                  conversion="hue", max_memory=1)
+        _diff(hue, nphusl.to_hue(img), diff=1e-6)
+        del hue
+        assert np.load(os.path.join(tmp, "hue.npy")).shape == img.shape[:-1]
+
+
+def test_convert_memmap_to_rgb(monkeypatch):
+    from nphusl import stream
+    img = _img()
+    hsl = nphusl.to_husl(img)
+    rgb = np.zeros_like(img)
+    # bands fit the budget with the conversion's temporaries counted
+    bands = []
+    convert_band = stream._convert_band
+    monkeypatch.setattr(stream, "_convert_band", lambda conversion, src, out:
+                        bands.append(len(src)) or
+                        convert_band(conversion, src, out))
+    row_pixels = img.shape[1]
+    max_memory = 4 * row_pixels * (24 + 3 +
+                                   nphusl.nphusl.PEAK_BYTES_PER_PIXEL["to_rgb"])
+    nphusl.convert_memmap(hsl, rgb, conversion="rgb", max_memory=max_memory)
+    assert max(bands) == 4 and sum(bands) == len(img)
+    _diff(rgb, nphusl.to_rgb(hsl), diff=0)
+    with pytest.raises(ValueError):
+        nphusl.convert_memmap(hsl, rgb[1:], conversion="rgb")
+
+
+def test_cli_to_husl_and_back():
+    from nphusl import cli
+    img = _img()
+    with tempfile.TemporaryDirectory() as tmp:
+        npy_path = os.path.join(tmp, "a.npy")
+        raw_path = os.path.join(tmp, "b.raw")
+        np.save(npy_path, img)
+        img.tofile(raw_path)
+        shape = "x".join(str(n) for n in img.shape)
+        assert cli.main(["to-husl", "-j", "1", "-s", shape,
+                         npy_path, raw_path]) == 0
+        hsl = np.load(os.path.join(tmp, "a.hsl.npy"))
+        _diff(hsl, nphusl.to_husl(img), diff=1e-6)
+        _diff(np.load(os.path.join(tmp, "b.hsl.npy")), hsl, diff=0)
+        assert cli.main(["to-rgb", "-j", "1", "-e", ".rgb.npy",
+                         os.path.join(tmp, "a.hsl.npy")]) == 0
+        rgb = np.load(os.path.join(tmp, "a.hsl.rgb.npy"))
+        _diff(rgb, nphusl.to_rgb(hsl), diff=0)
+        assert cli.main(["to-hue", "-j", "1", "missing.npy"]) == 1
+
+
+def test_cli_keeps_default_backend():
+    from nphusl import cli
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, "a.npy")
+        np.save(path, _img())
+        nphusl.set_backend("numpy")
+        try:
+            assert cli.main(["to-hue", "-j", "1", "-b", "numpy", path]) == 0
+            assert cli.main(["bench", "--size", "16x8", "-i", "1",
+                             "-b", "numpy"]) == 0
+            assert nphusl.get_backend() == "numpy"
+        finally:
+            nphusl.set_backend("best")
+
+
+def test_cli_output_paths():
+    from nphusl import cli
+    img = _img()
+    with tempfile.TemporaryDirectory() as tmp:
+        frames = [os.path.join(tmp, "shot.{:04d}.npy".format(i))
+                  for i in range(2)]
+        np.save(frames[0], img)
+        np.save(frames[1], img[::-1])
+        assert cli.main(["to-hue", "-j", "1"] + frames) == 0
+        for frame, rgb in zip(frames, (img, img[::-1])):
+            hue = np.load(frame[:-len(".npy")] + ".hue.npy")
+            _diff(hue, nphusl.to_hue(rgb), diff=1e-6)
+        # an output over an input, or two inputs with one output
+        hsl_path = os.path.join(tmp, "a.hsl.npy")
+        np.save(hsl_path, nphusl.to_husl(img))
+        assert cli.main(["to-rgb", "-j", "1", "-e", ".npy",
+                         hsl_path]) == 1
+        _diff(np.load(hsl_path), nphusl.to_husl(img), diff=0)
+        raw_path = frames[0][:-len(".npy")] + ".raw"
+        img.tofile(raw_path)
+        shape = "x".join(str(n) for n in img.shape)
+        assert cli.main(["to-hue", "-j", "1", "-s", shape,
+                         frames[0], raw_path]) == 1
+
+
+def test_cli_parallel_workers():
+    from nphusl import cli
+    img = _img()
+    with tempfile.TemporaryDirectory() as tmp:
+        paths = [os.path.join(tmp, "{}.npy".format(i)) for i in range(3)]
+        for path in paths:
+            np.save(path, img)
+        environ = dict(os.environ)
+        assert cli.main(["to-hue", "-j", "2", "-m", "1M"] + paths) == 0
+        assert dict(os.environ) == environ
+        with nphusl.best_enabled():  # the workers' backend
+            expected = nphusl.to_hue(img)
+        for i in range(3):
+            hue = np.load(os.path.join(tmp, "{}.hue.npy".format(i)))
+            _diff(hue, expected, diff=1e-6)
+
+
+@try_optimizations(Opt.cython, Opt.simd)
+def test_to_husl_uint16():
+    img = _img()
+    as_16bit = img.astype(np.uint16) * 257
+    _diff_husl(nphusl.to_husl(as_16bit), nphusl.to_husl(img))
+    _diff(nphusl.to_hue(as_16bit), nphusl.to_hue(img), diff=0.3)
+    # dark 16-bit values must not be read as 8-bit (or truncated)
+    dark = nphusl.to_husl(np.asarray([[200, 200, 200]], dtype=np.uint16))
+    assert dark[2] < 3.0
+    red = nphusl.to_husl(np.asarray([65535, 0, 0], dtype=np.uint16))
+    _diff_husl(red, nphusl.to_husl([255, 0, 0]))
+
+
+@try_optimizations(Opt.cython)
+def test_to_rgb_uint16():
+    rgb = (np.random.rand(20, 30, 3) * 65535).astype(np.uint16)
+    back = nphusl.to_rgb(nphusl.to_husl(rgb), dtype=np.uint16)
+    assert back.dtype == np.uint16
+    _diff(back.astype(int), rgb, diff=1)
+    with pytest.raises(ValueError):
+        nphusl.to_rgb(nphusl.to_husl(rgb), dtype=np.int32)
+
+
+@try_optimizations(Opt.cython, Opt.simd)
+def test_to_husl_float():
+    img = _img()
+    expected = nphusl.to_husl(img)
+    for dtype in (np.float64, np.float32):
+        hsl = nphusl.to_husl(img.astype(dtype) / 255)
+        assert hsl.dtype == np.float64
+        _diff_husl(hsl, expected)
+
+
+@try_optimizations(Opt.cython, Opt.simd)
+def test_to_husl_linear():
+    img = _img()
+    expected = nphusl.to_husl(img)
+    linear = nphusl.nphusl._to_linear(img / 255.0)
+    for dtype in (np.float64, np.float32):
+        _diff_husl(nphusl.to_husl(linear.astype(dtype), linear=True),
+                   expected)
+    # hue is ill-defined for grays, so only check colorful pixels
+    colorful = expected[..., 1] > 5
+    hue = nphusl.to_hue(linear, linear=True)
+    _diff(hue[colorful], expected[colorful][:, 0], diff=0.5)
+    # ints are scaled to [0, 1], but not decoded
+    _diff(nphusl.to_husl(img, linear=True),
+          nphusl.to_husl(img / 255.0, linear=True), diff=1e-9)
+
+
+@try_optimizations(Opt.cython, Opt.simd)
+def test_to_husl_float_not_finite():
+    # NaN is converted like 0, and infinities like 0 or 1
+    img = _img() / 255.0
+    img[::3, ::2, 0] = np.nan
+    img[1::3, ::2] = np.inf
+    img[2::3, ::2, 1:] = -np.inf
+    img[:, 1::4] = np.nan  # grays
+    finite = np.nan_to_num(img, nan=0.0, posinf=1.0, neginf=0.0)
+    expected = nphusl.to_husl(finite, backend="numpy")
+    for dtype in (np.float64, np.float32):
+        hsl = nphusl.to_husl(img.astype(dtype), quality="exact")
+        assert np.all(np.isfinite(hsl))
+        _diff_husl(hsl, expected)
+        _diff(nphusl.to_lightness(img.astype(dtype)), expected[..., 2],
+              diff=0.1)
+
+
+@try_optimizations(Opt.simd)
+def test_to_husl_gray_fast_path():
+    gray = _img()[..., 0]
+    rgb = np.stack([gray] * 3, axis=-1)
+    view = transform.from_grayscale(gray)
+    assert np.shares_memory(view, gray) and transform.is_grayscale(view)
+    hsl = nphusl.to_husl(gray)
+    assert hsl.shape == rgb.shape
+    assert np.all(hsl[..., 1] == 0)
+    assert np.all(hsl[gray > 0, 0] == nphusl.constants.WHITE_HUE)
+    _diff(hsl[..., 2], nphusl.to_husl(rgb)[..., 2], diff=1e-6)
+    _diff_husl(hsl, nphusl.to_husl(rgb))
+    _diff(nphusl.to_hue(gray), hsl[..., 0], diff=1e-9)
+    for dtype in (np.uint16, np.float32, np.float64):
+        scaled = gray.astype(np.uint16) * 257 \
+            if dtype == np.uint16 else gray.astype(dtype) / 255
+        _diff(nphusl.to_husl(transform.from_grayscale(scaled)), hsl,
+              diff=1e-3)
+
+
+@try_optimizations(Opt.simd)
+def test_to_husl_indexed():
+    palette = (np.random.rand(200, 3) * 255).astype(np.uint8)
+    indices = np.random.randint(0, len(palette), (30, 40)).astype(np.uint8)
+    hsl = nphusl.to_husl_indexed(indices, palette)
+    assert hsl.shape == (30, 40, 3)
+    _diff(hsl, nphusl.to_husl(palette[indices]), diff=1e-9)
+    for dtype in (np.int16, np.uint16, np.int64):
+        _diff(nphusl.to_husl_indexed(indices.astype(dtype), palette), hsl,
+              diff=0)
+    with pytest.raises(IndexError):
+        nphusl.to_husl_indexed(indices, palette[:100])
+    with pytest.raises(IndexError):
+        nphusl.to_husl_indexed(-indices.astype(np.int32) - 1, palette)
+    husl_palette = nphusl.to_husl(palette[None]).reshape((-1, 3))
+    rgb = nphusl.to_rgb_indexed(indices, husl_palette)
+    assert np.all(rgb == nphusl.to_rgb(husl_palette[indices]))
+
+
+@try_optimizations(Opt.simd)
+def test_to_husl_dedupe():
+    palette = (np.random.rand(50, 3) * 255).astype(np.uint8)
+    flat = palette[np.random.randint(0, 50, (60, 80))]
+    noisy = _img()
+    for img in (flat, noisy):
+        expected = nphusl.to_husl(img)
+        for dedupe in (True, "auto"):
+            _diff(nphusl.to_husl(img, dedupe=dedupe), expected, diff=1e-9)
+    assert nphusl.nphusl._rgb_dedupe_to_husl(flat, 49) is None
+    assert 45 < transform.estimate_colors(flat) < 55
+    noise = (np.random.rand(100, 100, 3) * 255).astype(np.uint8)
+    assert transform.estimate_colors(noise) > 1e5
+    with pytest.raises(ValueError):
+        nphusl.to_husl(flat, dedupe="always")
+
+
+@try_optimizations(Opt.simd)
+def test_to_husl_runs():
+    page = np.full((40, 90, 3), 255, dtype=np.uint8)
+    page[5:35, 10:80:3] = 0  # text
+    page[20:25, 30:60] = (30, 90, 200)  # a highlight
+    page[:, -1] = (250, 250, 245)  # off-white border
+    for img in (page, _img(), _img()[3]):
+        _diff(nphusl.to_husl(img, runs=True), nphusl.to_husl(img), diff=1e-9)
+
+
+@try_optimizations(Opt.simd)
+def test_to_husl_order_and_dtype():
+    rgb = _img()
+    expected = nphusl.to_husl(rgb)
+    alpha = np.random.randint(0, 256, rgb.shape[:-1] + (1,)).astype(np.uint8)
+    rgba = np.concatenate((rgb, alpha), axis=-1)
+    with_alpha = nphusl.to_husl(transform.composite_rgba(rgba))
+    for dtype in (np.float64, np.float32):
+        hsl = nphusl.to_husl(rgb[..., ::-1].copy(), order="bgr", dtype=dtype)
+        assert hsl.dtype == dtype
+        _diff(hsl, expected, diff=1e-4)
+        _diff(nphusl.to_husl(rgb, dtype=dtype), expected, diff=1e-4)
+        _diff(nphusl.to_husl(rgba, dtype=dtype), with_alpha, diff=1e-4)
+        bgra = rgba[..., [2, 1, 0, 3]].copy()
+        _diff(nphusl.to_husl(bgra, order="bgr", dtype=dtype), with_alpha,
+              diff=1e-4)
+        _diff(nphusl.to_husl(bgra, order="bgr", runs=True), with_alpha,
+              diff=1e-9)
+    # 16-bit fixed point, interleaved or planar, from any order
+    fixed = nphusl.to_husl(rgb, dtype=np.uint16)
+    assert fixed.dtype == np.uint16
+    _diff(nphusl.from_fixed16(fixed), expected, diff=360 / 65535)
+    _diff(nphusl.to_husl(bgra, order="bgr", dtype=np.uint16).astype(int),
+          nphusl.nphusl._hsl_as(with_alpha, np.uint16), diff=1)
+    planar = nphusl.to_husl(rgb, dtype=np.uint16, layout="planar")
+    _diff(planar, fixed, diff=0)
+    with pytest.raises(ValueError):
+        nphusl.to_husl(rgb, order="gbr")
+    with pytest.raises(ValueError):
+        nphusl.to_husl(rgb, dtype=np.uint8)
+
+
+@try_optimizations(Opt.simd)
+def test_to_husl_planar():
+    rgb = _img()
+    expected = nphusl.to_husl(rgb)
+    planes = np.ascontiguousarray(np.moveaxis(rgb, -1, 0))  # CHW
+    view = transform.from_planes(planes)
+    assert transform.is_planar(view) and np.shares_memory(view, planes)
+    assert not transform.is_planar(rgb)
+    for dtype in (np.float64, np.float32):
+        for img in (rgb, view):
+            hsl = nphusl.to_husl(img, layout="planar", dtype=dtype)
+            assert transform.is_planar(hsl) and hsl.dtype == dtype
+            assert hsl[..., 0].flags.c_contiguous
+            _diff(hsl, expected, diff=1e-4)
+        _diff(nphusl.to_husl(view, dtype=dtype), expected, diff=1e-4)
+        bgr = transform.from_planes(planes[::-1].copy())
+        _diff(nphusl.to_husl(bgr, order="bgr", dtype=dtype), expected,
+              diff=1e-4)
+    hsl = nphusl.to_husl(view, layout="planar", runs=True)
+    assert transform.is_planar(hsl)
+    _diff(hsl, expected, diff=1e-9)
+    with pytest.raises(ValueError):
+        nphusl.to_husl(rgb, layout="chw")
+
+
+@try_optimizations(Opt.simd)
+def test_to_husl_quality():
+    img = _img()
+    exact = nphusl.to_husl(img, quality="exact")
+    for quality in ("fast", "balanced", "exact"):
+        hsl = nphusl.to_husl(img, quality=quality)
+        _diff(hsl[..., 2], exact[..., 2], diff=0.05)
+        lit = exact[..., 2] > 1  # the LUTs are coarse for very dark pixels
+        _diff(hsl[lit, 1], exact[lit, 1], diff=5.0)
+        colorful = exact[..., 1] > 5
+        hue_diff = np.abs(hsl[colorful, 0] - exact[colorful, 0])
+        assert np.all(np.minimum(hue_diff, 360 - hue_diff) <= 1.0)
+    for rgb in ((10, 200, 30), (240, 10, 10), (30, 40, 250), (90, 80, 70)):
+        hsl = nphusl.to_husl(np.array([[rgb]], dtype=np.uint8),
+                             quality="exact")
+        _diff(hsl.ravel(), _ref_to_husl(rgb), diff=0.01)
+    assert nphusl.get_quality() == "fast"
+    fast = nphusl.to_husl(img)
+    nphusl.set_quality("exact")
+    try:
+        assert nphusl.get_quality() == "exact"
+        _diff(nphusl.to_husl(img), exact, diff=1e-9)
+        _diff(nphusl.to_husl(img, quality="fast"), fast, diff=1e-9)
+    finally:
+        nphusl.set_quality("fast")
+    with pytest.raises(ValueError):
+        nphusl.to_husl(img, quality="best")
+    with pytest.raises(ValueError):
+        nphusl.set_quality("best")
+
+
+@try_optimizations(Opt.simd)
+def test_set_schedule():
+    img = np.random.randint(0, 256, size=(120, 200, 3)).astype(np.uint8)
+    img[:60] = 255  # cheap rows first, for uneven work
+    expected = nphusl.to_husl(img)
+    hist = nphusl.husl_histogram(img)
+    assert nphusl.get_schedule() == ("dynamic", 4)
+    try:
+        for schedule in nphusl.nphusl.SCHEDULES:
+            for chunk in (0, 1, 7):
+                nphusl.set_schedule(schedule, chunk)
+                assert nphusl.get_schedule() == (schedule, chunk)
+                assert np.all(nphusl.to_husl(img) == expected)
+                assert np.all(nphusl.husl_histogram(img) == hist)
+    finally:
+        nphusl.set_schedule()
+    with pytest.raises(ValueError):
+        nphusl.set_schedule("stealing")
+    with pytest.raises(ValueError):
+        nphusl.set_schedule("dynamic", -1)
+
+
+@pytest.mark.skipif(not hasattr(os, "sched_getaffinity"),
+                    reason="no sched_getaffinity")
+@try_optimizations(Opt.simd)
+def test_set_affinity():
+    from concurrent.futures import ThreadPoolExecutor
+    img = np.random.randint(0, 256, size=(120, 200, 3)).astype(np.uint8)
+    expected = nphusl.to_husl(img)
+    caller_cpus = os.sched_getaffinity(0)
+    cpu = min(caller_cpus)
+    assert nphusl.get_affinity() == ()
+    try:
+        nphusl.set_affinity([cpu])
+        assert nphusl.get_affinity() == (cpu,)
+        assert np.all(nphusl.to_husl(img) == expected)
+        assert os.sched_getaffinity(0) == caller_cpus
+        with pytest.raises(ValueError):
+            nphusl.set_affinity([cpu, cpu])
+        with pytest.raises(ValueError):
+            nphusl.set_affinity([max(caller_cpus) + 4096])
+        assert nphusl.get_affinity() == (cpu,)
+        # kernels on other threads read the set while it's replaced
+        with ThreadPoolExecutor(2) as pool:
+            futures = [pool.submit(nphusl.to_husl, img,
+                                   backend=nphusl.get_backend())
+                       for _ in range(20)]
+            for k in range(200):
+                nphusl.set_affinity([cpu] if k % 2 else None)
+            assert all(np.all(f.result() == expected) for f in futures)
+    finally:
+        nphusl.set_affinity(None)
+    assert nphusl.get_affinity() == ()
+    assert np.all(nphusl.to_husl(img) == expected)
+
+
+@try_optimizations(Opt.simd)
+def test_to_rgb_palette():
+    img = _img()
+    hsl = nphusl.to_husl(img)
+    indices, palette = nphusl.to_rgb(hsl, palette=True)
+    rgb = nphusl.to_rgb(hsl)
+    assert np.all(palette[indices] == rgb)
+    assert len(palette) == len(np.unique(rgb.reshape((-1, 3)), axis=0))
+    assert indices.dtype == (np.uint8 if len(palette) <= 256 else np.uint16)
+    indices, palette = nphusl.to_rgb(hsl, palette=True, dtype=np.uint16)
+    assert np.all(palette[indices] == nphusl.to_rgb(hsl, dtype=np.uint16))
+
+
+def test_to_palette_sort_and_table(monkeypatch):
+    img = _img()
+    small = transform.to_palette(img)  # sorted, below the table's size
+    monkeypatch.setattr(transform, "PALETTE_TABLE_MIN_PIXELS", 1)
+    table = transform.to_palette(img)
+    for a, b in zip(small, table):
+        assert a.dtype == b.dtype and np.all(a == b)
+    assert np.all(table[1][table[0]] == img)
+
+
+@try_optimizations(Opt.simd)
+def test_to_lightness():
+    img = _img()
+    _diff(nphusl.to_lightness(img), nphusl.to_husl(img)[..., 2], diff=1e-6)
+    gray = img[..., 0]
+    _diff(nphusl.to_lightness(gray), nphusl.to_husl(gray)[..., 2], diff=1e-9)
+    linear = nphusl.nphusl._to_linear(img / 255.0)
+    _diff(nphusl.to_lightness(linear, linear=True),
+          nphusl.to_lightness(img), diff=0.1)  # steps of the light LUT
+    _diff(nphusl.to_lightness([255, 255, 255]), 100.0, diff=1e-9)
+
+
+@try_optimizations(Opt.simd)
+def test_husl_histogram():
+    img = _img()
+    pixels = img.shape[0] * img.shape[1]
+    hsl = nphusl.to_husl(img)
+    # values past either end are counted in the first or last bin
+    H, S, L = (np.clip(hsl[..., i].ravel(), 0, top)
+               for i, top in enumerate((360, 100, 100)))
+    hl, s = nphusl.husl_histogram(img, bins=(12, 5, 8), channels=("hl", "s"))
+    assert hl.shape == (12, 8) and s.shape == (5,)
+    assert hl.dtype == s.dtype == np.int64
+    assert hl.sum() == s.sum() == pixels
+    # values on a bin edge may land on either side of it
+    expected, _, _ = np.histogram2d(H, L, bins=(12, 8),
+                                    range=((0, 360), (0, 100)))
+    assert np.abs(hl - expected).sum() <= 2
+    expected, _ = np.histogram(S, bins=5, range=(0, 100))
+    assert np.abs(s - expected).sum() <= 2
+    hsl_hist = nphusl.husl_histogram(img, bins=(12, 5, 8))
+    assert hsl_hist.shape == (12, 5, 8)
+    _diff(hsl_hist.sum(axis=1), hl, diff=0)
+    # other RGB types are counted without going through uint8
+    for rgb in (img / 255.0, (img / 255.0).astype(np.float32),
+                img.astype(np.uint16) * 257):
+        other = nphusl.husl_histogram(rgb, bins=(12, 5, 8), channels="hl")
+        assert np.abs(other - hl).sum() <= pixels // 50
+    with pytest.raises(ValueError):
+        nphusl.husl_histogram(img, channels="hx")
+
+
+@try_optimizations(Opt.simd)
+def test_husl_stats():
+    img = _img()
+    mask = np.zeros(img.shape[:2], dtype=bool)
+    mask[:, ::2] = True
+    for m in (None, mask):
+        stats = nphusl.husl_stats(img, mask=m, percentiles=(10, 50, 90))
+        hsl = nphusl.to_husl(img)
+        hsl = hsl.reshape((-1, 3)) if m is None else hsl[m]
+        H, S, L = np.radians(hsl[:, 0]), hsl[:, 1], hsl[:, 2]
+        assert stats.pixels == len(hsl)
+        mean_hue = np.degrees(np.arctan2((S * np.sin(H)).sum(),
+                                         (S * np.cos(H)).sum())) % 360
+        _diff(stats.hue_mean, mean_hue, diff=1e-6)
+        assert 0 <= stats.hue_concentration <= 1
+        _diff(stats.saturation_mean, S.mean(), diff=1e-6)
+        _diff(stats.saturation_std, S.std(), diff=1e-6)
+        _diff(stats.lightness_mean, L.mean(), diff=1e-6)
+        _diff(stats.lightness_std, L.std(), diff=1e-6)
+        # the sketch has 0.1 wide lightness bins
+        _diff(stats.lightness_percentiles,
+              np.percentile(L, (10, 50, 90)), diff=0.5)
+    # one color has that hue and all of its saturation
+    red = nphusl.husl_stats(np.full((5, 5, 3), (200, 10, 10), np.uint8))
+    _diff(red.hue_concentration, 1.0, diff=1e-6)
+    _diff(red.hue_mean, nphusl.to_hue([200, 10, 10]), diff=1e-6)
+    empty = nphusl.husl_stats(img, mask=np.zeros(img.shape[:2], bool))
+    assert empty.pixels == 0 and np.isnan(empty.lightness_mean)
+    with pytest.raises(ValueError):
+        nphusl.husl_stats(img, mask=mask[1:])
+
+
+@try_optimizations(Opt.cython, Opt.simd)
+def test_yuv_round_trip():
+    # 2x2 blocks of one color survive 4:2:0 chroma subsampling
+    img = _img()[:38:2, :28:2]
+    img = np.repeat(np.repeat(img, 2, axis=0), 2, axis=1)
+    hsl = nphusl.to_husl(img)
+    for matrix in ("bt601", "bt709", "bt2020"):
+        for yuv_range in ("limited", "full"):
+            y, u, v = nphusl.to_yuv(hsl, matrix, yuv_range)
+            assert y.shape == img.shape[:2] and u.shape == (19, 14)
+            back = nphusl.to_husl_from_yuv(y, u, v, matrix, yuv_range)
+            # 8-bit YUV can't hold every RGB triplet exactly
+            rgb_diff = np.abs(nphusl.to_rgb(back) - img.astype(int))
+            assert rgb_diff.mean() < 1.5
+    # limited range white and black
+    y = np.asarray([[235, 16], [235, 16]], dtype=np.uint8)
+    u = v = np.full((1, 1), 128, dtype=np.uint8)
+    hsl = nphusl.to_husl_from_yuv(y, u, v)
+    _diff(hsl[0, 0], [19.916, 0, 100], diff=0.01)
+    _diff(hsl[0, 1], [0, 0, 0], diff=0)
+
+
+def test_yuv_nv12_and_odd_sizes():
+    img = _img()[:37, :27]
+    hsl = nphusl.to_husl(img)
+    y, u, v = nphusl.to_yuv(hsl)
+    y_nv12, uv = nphusl.to_yuv(hsl, layout="nv12")
+    assert u.shape == (19, 14) and uv.shape == (19, 28)
+    _diff(y_nv12, y, diff=0)
+    _diff(uv[:, ::2], u, diff=0)
+    _diff(uv[:, 1::2], v, diff=0)
+    i420 = nphusl.to_husl_from_yuv(y, u, v)
+    _diff(nphusl.to_husl_from_yuv(y, uv), i420, diff=0)
+    # a decoder's Y plane with padded rows
+    padded = np.zeros((y.shape[0], y.shape[1] + 5), dtype=np.uint8)
+    padded[:, :y.shape[1]] = y
+    _diff(nphusl.to_husl_from_yuv(padded[:, :y.shape[1]], uv), i420, diff=0)
+    with nphusl.numpy_enabled():
+        _diff(nphusl.to_husl_from_yuv(y, uv),
+              nphusl.to_husl_from_yuv(y, u, v), diff=0)
+    with pytest.raises(ValueError):
+        nphusl.to_husl_from_yuv(y, u[1:], v[1:])
+    with pytest.raises(ValueError):
+        nphusl.to_husl_from_yuv(y, u, v, matrix="bt999")
+
+
+@try_optimizations(Opt.cython, Opt.simd)
+def test_aio():
+    import asyncio
+    from nphusl import aio
+    img = _img()
+    hsl = nphusl.to_husl(img)
+
+    async def convert_all():
+        results = await asyncio.gather(
+            aio.to_husl(img), aio.to_hue(img), aio.to_rgb(hsl))
+        with pytest.raises(ValueError):
+            await aio.to_rgb(np.zeros((4, 4, 5)))
+        return results
+
+    loop = asyncio.new_event_loop()
+    try:
+        husl, hue, rgb = loop.run_until_complete(convert_all())
+    finally:
+        loop.close()
+    _diff(husl, hsl, diff=0)
+    _diff(hue, nphusl.to_hue(img), diff=0)
+    _diff(rgb, nphusl.to_rgb(hsl), diff=0)
+
+
+def test_backend_per_call_and_context():
+    import asyncio
+    import threading
+    from nphusl import aio
+    img = _img()
+    with nphusl.numpy_enabled():
+        expected = nphusl.to_husl(img)
+    assert nphusl.get_backend() == "best"
+    _diff(nphusl.to_husl(img, backend="numpy"), expected, diff=0)
+    assert nphusl.get_backend() == "best"
+
+    # a thread that uses NumPy doesn't change another thread's backend
+    inside = threading.Barrier(2)
+    seen = {}
+
+    def numpy_thread():
+        with nphusl.use_backend("numpy"):
+            inside.wait()
+            seen["numpy"] = (nphusl.get_backend(), nphusl.to_husl(img))
+            inside.wait()
+
+    thread = threading.Thread(target=numpy_thread)
+    thread.start()
+    inside.wait()
+    seen["main"] = nphusl.get_backend()
+    inside.wait()
+    thread.join()
+    assert seen["main"] == "best"
+    assert seen["numpy"][0] == "numpy"
+    _diff(seen["numpy"][1], expected, diff=0)
+
+    # aio conversions run with the backend of the task that awaits them
+    async def convert():
+        with nphusl.use_backend("numpy"):
+            return await aio.to_husl(img)
+
+    loop = asyncio.new_event_loop()
+    try:
+        _diff(loop.run_until_complete(convert()), expected, diff=0)
+    finally:
+        loop.close()
+
+    nphusl.set_backend("numpy")
+    try:
+        _diff(nphusl.to_husl(img), expected, diff=0)
+    finally:
+        nphusl.set_backend()
+    with pytest.raises(ValueError):
+        nphusl.to_husl(img, backend="gpu")
+    with pytest.raises(ValueError):
+        nphusl.set_backend("gpu")
+
+
+def test_calibrate():
+    import json
+    from nphusl import tuning
+    img = _img()
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, "calibration.json")
+        try:
+            choices = nphusl.calibrate(path, sizes=(16, 4096), repeat=1)
+            assert sorted(choices) == sorted(tuning.FUNCTIONS)
+            for measured in choices.values():
+                assert [pixels for pixels, *_ in measured] == [16, 4096]
+                for _, backend, threads, chunk in measured:
+                    assert backend in nphusl.nphusl.BACKENDS
+                    assert threads >= 0 and chunk >= 0
+
+            # "best" follows the choice for the size bucket of the input
+            for size, rgb in ((16, img[:2, :2]), (4096, img)):
+                backend = dict((p, b) for p, b, *_ in choices["to_rgb"])[size]
+                hsl = nphusl.to_husl(rgb, backend="numpy")
+                _diff(nphusl.to_rgb(hsl), nphusl.to_rgb(hsl, backend=backend),
+                      diff=0)
+            with nphusl.numpy_enabled():  # explicit backends aren't tuned
+                _diff(nphusl.to_hue(img),
+                      nphusl.to_hue(img, backend="numpy"), diff=0)
+
+            tuning.reset()
+            assert not nphusl.nphusl._tuning
+            assert tuning.load(path)
+            assert sorted(nphusl.nphusl._tuning) == sorted(choices)
+
+            # made on another host
+            with open(path) as f:
+                cache = json.load(f)
+            cache["host"]["threads"] += 1
+            with open(path, "w") as f:
+                json.dump(cache, f)
+            assert not tuning.load(path)
+            assert not nphusl.nphusl._tuning
+            with open(path, "w") as f:
+                f.write("{")
+            with pytest.warns(UserWarning):
+                assert not tuning.load(path)
+            assert not tuning.load(os.path.join(tmp, "missing.json"))
+        finally:
+            tuning.reset()
+    with pytest.raises(ValueError):
+        nphusl.calibrate(path, functions=("to_yuv",))
+    with pytest.raises(ValueError):
+        nphusl.calibrate(path, sizes=())
+
+
+@try_optimizations(Opt.cython, Opt.simd)
+def test_memory_budget():
+    img = _img()
+    hsl = nphusl.to_husl(img)
+    budget = 20 * img.shape[1] * 200  # bands of 20 rows
+    for fn, arg in ((nphusl.to_husl, img), (nphusl.to_hue, img),
+                    (nphusl.to_lightness, img), (nphusl.to_rgb, hsl)):
+        whole = fn(arg)
+        _diff(fn(arg, memory_budget=budget), whole, diff=0)
+        _diff(fn(arg, memory_budget=1), whole, diff=0)  # row by row
+        _diff(fn(arg, chunksize=50), whole, diff=0)
+        if fn is not nphusl.to_rgb:  # which converts `out` to uint8
+            out = np.zeros_like(whole)
+            assert fn(arg, out=out, memory_budget=budget) is out
+            _diff(out, whole, diff=0)
+    planar = nphusl.to_husl(img, layout="planar", dtype=np.float32,
+                            memory_budget=budget)
+    assert transform.is_planar(planar) and planar.dtype == np.float32
+    _diff(planar, hsl, diff=1e-4)
+    pixels = img.reshape((-1, 3))  # (pixels, 3) bands of pixels
+    _diff(nphusl.to_husl(pixels, memory_budget=budget),
+          hsl.reshape((-1, 3)), diff=0)
+
+    assert nphusl.get_memory_budget() is None
+    nphusl.set_memory_budget(budget)
+    try:
+        assert nphusl.get_memory_budget() == budget
+        _diff(nphusl.to_husl(img), hsl, diff=0)
+    finally:
+        nphusl.set_memory_budget()
+    with pytest.raises(ValueError):
+        nphusl.set_memory_budget(0)
+    with pytest.raises(ValueError):
+        nphusl.to_husl(img, memory_budget=-1)
+
+
+def test_out_of_memory_retry():
+    img = _img()
+    expected = nphusl.to_hue(img)
+    converted = []
+
+    def hungry(rgb):  # runs out of memory on more than 8 rows
+        if len(rgb) > 8:
+            raise MemoryError("8 rows at most")
+        converted.append(len(rgb))
+        return nphusl.to_hue(rgb)
+
+    def starved(rgb):
+        raise MemoryError("no rows at all")
+
+    stream_budget = _nphusl.STREAM_BUDGET
+    _nphusl.STREAM_BUDGET = 8 * img.shape[1] * 200
+    try:
+        with pytest.warns(UserWarning):
+            hue = _nphusl._within_budget("to_hue", img, hungry)
+        _diff(hue, expected, diff=0)
+        assert max(converted) == 8
+        with pytest.raises(MemoryError):  # even one band is too much
+            with pytest.warns(UserWarning):
+                _nphusl._within_budget("to_hue", img, starved)
+    finally:
+        _nphusl.STREAM_BUDGET = stream_budget
+
+
+@pytest.mark.skipif(not sys.platform.startswith("linux"),
+                    reason="needs RLIMIT_AS")
+def test_kernel_out_of_memory():
+    # an HSL array the C kernels can't allocate used to exit the process
+    import subprocess
+    code = """if 1:
+        import os, resource, numpy as np, nphusl
+        rgb = np.zeros((2000, 2000, 3), dtype=np.uint8)
+        nphusl.to_husl(rgb[:100])  # start the OpenMP threads first
+        pages = int(open("/proc/self/statm").read().split()[0])
+        used = pages * os.sysconf("SC_PAGE_SIZE")
+        resource.setrlimit(resource.RLIMIT_AS,
+                           (used + (32 << 20), resource.RLIM_INFINITY))
+        for backend in ("simd", "numpy"):
+            try:
+                nphusl.to_husl(rgb, backend=backend)
+            except MemoryError:
+                print(backend, "MemoryError")
+        nphusl.husl_stats(rgb[:10])
+        print("alive")
+        """
+    env = dict(os.environ, PYTHONPATH=os.pathsep.join(sys.path))
+    result = subprocess.run([sys.executable, "-c", code], env=env,
+                            stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                            universal_newlines=True, timeout=120)
+    assert result.returncode == 0, result.stderr
+    lines = result.stdout.split()
+    if hasattr(nphusl, "_simd_opt"):
+        assert "simd" in lines
+    assert "numpy" in lines and "alive" in lines
+
+
+@try_optimizations(Opt.simd)
+def test_batching_converter():
+    import threading
+    from nphusl.batch import BatchingConverter
+    img = _img()
+    requests = [img[0, 0], img[:3, :5], img[4:6, 7:9].astype(np.uint16) * 257,
+                img[10, :4] / 255.0, img[:1, :1]]
+    expected = [nphusl.to_husl(np.asarray(r).reshape((1, -1, 3)))
+                .reshape(np.shape(r)) for r in requests]
+    with BatchingConverter(window=0.01) as converter:
+        futures = [converter.submit(r) for r in requests]
+        for future, hsl in zip(futures, expected):
+            _diff(future.result(), hsl, diff=1e-9)
+
+        # many threads at once, each with its own colors (and a new
+        # thread's context, so the default backend)
+        results = {}
+
+        def convert(row):
+            results[row] = ([converter.convert(px) for px in img[row, :20]],
+                            nphusl.to_husl(img[row:row + 1, :20])[0])
+
+        threads = [threading.Thread(target=convert, args=(row,))
+                   for row in range(8)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        for hsl, expected_hsl in results.values():
+            _diff(np.array(hsl), expected_hsl, diff=1e-9)
+        with pytest.raises(ValueError):
+            converter.submit(np.zeros((4, 4)))
+    with pytest.raises(RuntimeError):
+        converter.submit(img[0, 0])
+    with BatchingConverter(max_pixels=1, backend="numpy") as converter:
+        with nphusl.numpy_enabled():
+            expected = nphusl.to_husl(img[:2, :2])
+        _diff(converter.convert(img[:2, :2]), expected, diff=0)
+
+
+@try_optimizations(Opt.cython, Opt.simd)
+def test_tiled_save_and_load():
+    from nphusl import tiled
+    hsl = nphusl.to_husl(_img())
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, "img.hslt")
+        for bits, max_diff in ((16, 0.003), (8, 0.71)):
+            tiled.save(path, hsl, bits=bits, tile=24)
+            _diff(tiled.load(path), hsl, diff=max_diff)
+        tiled.save(path, hsl, codec="none", tile=24)
+        assert os.path.getsize(path) < hsl.nbytes / 3.9
+        _diff(tiled.load(path), hsl, diff=0.003)
+
+
+@try_optimizations(Opt.simd)
+def test_delta_converter():
+    from nphusl import delta
+    img = _img()
+    converter = delta.DeltaConverter(tile=8)
+    hsl = converter.convert(img)
+    assert converter.dirty.all()
+    _diff(hsl, nphusl.to_husl(img), diff=1e-9)
+    converter.convert(img.copy())
+    assert not converter.dirty.any() and not converter.dirty_regions()
+    changed = img.copy()
+    changed[9, 17] = 255 - changed[9, 17]
+    changed[-1, -1] = 255 - changed[-1, -1]
+    hsl = converter.convert(changed)
+    assert converter.dirty.sum() == 2
+    assert converter.dirty[1, 2] and converter.dirty[-1, -1]
+    assert converter.dirty_regions()[0] == (slice(8, 16), slice(16, 24))
+    _diff(hsl, nphusl.to_husl(changed), diff=1e-9)
+    hsl = converter.convert(changed.astype(np.float32) / 255)  # new dtype
+    assert converter.dirty.all()
+    _diff_husl(hsl, nphusl.to_husl(changed))
+
+
+def test_tiled_file_regions():
+    from nphusl import tiled
+    hsl = nphusl.to_husl(_img())
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, "img.hslt")
+        tiled.save(path, hsl, tile=8)
+        whole = tiled.load(path)
+        with tiled.TiledFile(path) as f:
+            assert f.shape == hsl.shape
+            _diff(f.read(slice(5, 30), slice(9, 22)),
+                  whole[5:30, 9:22], diff=0)
+            _diff(f.read_tile(1, 2), whole[8:16, 16:24], diff=0)
+            last = f.read_tile(f.tiles_shape[0] - 1, 0)
+            assert last.shape[0] == (hsl.shape[0] - 1) % 8 + 1
+            with pytest.raises(IndexError):
+                f.read_tile(*f.tiles_shape)
+            _diff(f.read(slice(0, 30, 2), slice(21, 2, -3)),
+                  whole[0:30:2, 21:2:-3], diff=0)
+
+
+def test_tiled_file_corrupt():
+    from nphusl import tiled
+    hsl = nphusl.to_husl(_img())
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, "img.hslt")
+        tiled.save(path, hsl, tile=8)
+        with open(path, "rb") as f:
+            data = f.read()
+        bad_path = os.path.join(tmp, "bad.hslt")
+        bad_codec = bytearray(data)
+        bad_codec[11] = 7
+        bad_tile = data[:-4] + b"\0\0\0\0"  # the last tile's checksum
+        for bad in (data[:20], data[:40], data[:-1], bytes(bad_codec),
+                    bad_tile):
+            with open(bad_path, "wb") as f:
+                f.write(bad)
+            with pytest.raises(ValueError, match="bad.hslt"):
+                tiled.load(bad_path)
+
+
 @try_optimizations(Opt.cython, Opt.numexpr)
 def test_to_hue_2d():
     img = _img()[:, 14]  # 2D RGB
@@ -679,7 +1574,7 @@ def test_to_husl_1d_grayscale():
     hsl_from_rgb = nphusl.to_husl([[0.1, 0.1, 0.1], [0.1, 0.1, 0.1]])
     expected = [[2.88467242e+02, 1.02865661e-05, 9.30666400],
                 [2.88467242e+02, 1.02865661e-05, 9.30666400]]
-    assert np.all(hsl_from_gray == hsl_from_rgb)
+    _diff_husl(hsl_from_gray, hsl_from_rgb)
     _diff_husl(hsl_from_gray, expected)
     _diff_husl(hsl_from_rgb, expected)
 